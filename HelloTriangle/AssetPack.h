@@ -0,0 +1,469 @@
+#pragma once
+#include "VulkanHelpers.h"
+#include "MeshCodec.h"
+#include "MeshSimplifier.h"
+#include "TextureStreamer.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//MappedFile : read-only memory mapping of a whole file. Pages are read from disk when first touched.
+class MappedFile {
+public:
+	explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			throw std::runtime_error("failed to open " + path + "!");
+		}
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(file, &fileSize);
+		size = static_cast<size_t>(fileSize.QuadPart);
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr) {
+			CloseHandle(file);
+			throw std::runtime_error("failed to map " + path + "!");
+		}
+		data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		if (data == nullptr) {
+			CloseHandle(mapping);
+			CloseHandle(file);
+			throw std::runtime_error("failed to map " + path + "!");
+		}
+#else
+		fd = open(path.c_str(), O_RDONLY); //kept open for read()
+		if (fd < 0) {
+			throw std::runtime_error("failed to open " + path + "!");
+		}
+		struct stat status;
+		fstat(fd, &status);
+		size = static_cast<size_t>(status.st_size);
+		void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (address == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error("failed to map " + path + "!");
+		}
+		data = static_cast<const uint8_t*>(address);
+#endif
+	}
+
+	~MappedFile() {
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+		CloseHandle(mapping);
+		CloseHandle(file);
+#else
+		munmap(const_cast<uint8_t*>(data), size);
+		close(fd);
+#endif
+	}
+
+	//copies a range of the file into dst with positional reads, without going through the mapping: the kernel writes
+	//straight into dst (e.g. mapped staging memory), and the pages of the mapping are never faulted in. Thread safe.
+	void read(uint64_t offset, size_t count, void* dst) const {
+		uint8_t* out = static_cast<uint8_t*>(dst);
+		while (count > 0) {
+#ifdef _WIN32
+			OVERLAPPED position = {};
+			position.Offset = static_cast<DWORD>(offset);
+			position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+			DWORD chunk = static_cast<DWORD>(std::min<size_t>(count, 1u << 30));
+			DWORD done = 0;
+			if (!ReadFile(file, out, chunk, &done, &position) || done == 0) {
+				throw std::runtime_error("failed to read asset pack!");
+			}
+#else
+			ssize_t done = pread(fd, out, count, static_cast<off_t>(offset));
+			if (done <= 0) {
+				throw std::runtime_error("failed to read asset pack!");
+			}
+#endif
+			out += done;
+			offset += done;
+			count -= done;
+		}
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+
+private:
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
+
+//AssetPack : every asset of a scene in one file, stored the way the GPU consumes it, so that loading is a memory mapping
+//and the upload paths copy straight from the mapping into staging memory.
+//
+//Layout : PackHeader | PackEntry[entryCount] | payloads
+//Payloads are aligned on 4 KB (pages), and textures on 64 KB so that their levels can later be bound as sparse blocks.
+//  mesh    : MeshHeader | Submesh[submeshCount] | MeshLod[lodCount] | MaterialRecord[materialCount] | vertices | indices,
+//            both streams encoded by MeshCodec. Every level of detail of every submesh is in the indices.
+//  texture : TextureHeader | TextureLevel[levelCount] | padding to 16 bytes | RGBA8 levels, most detailed first
+//  shader  : SPIR-V words
+//All integers are little endian, the pack is not meant to travel between architectures.
+enum class AssetType : uint32_t {
+	Mesh,
+	Texture,
+	Shader
+};
+
+class AssetPack {
+public:
+	static const uint32_t MAGIC = 0x4b50564b; //"KVPK"
+	static const uint32_t VERSION = 4;
+	static const uint64_t PAGE_ALIGNMENT = 4096;
+	static const uint64_t TEXTURE_ALIGNMENT = 65536;
+
+	struct PackHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t entryCount;
+		uint32_t vertexSize; //sizeof(Vertex) when packed: a change of the vertex layout invalidates the pack
+	};
+
+	struct PackEntry {
+		char name[64]; //path of the loose file it replaces, or scene name for meshes
+		AssetType type;
+		uint32_t reserved;
+		uint64_t offset; //from the start of the file
+		uint64_t size;
+		uint64_t hash; //FNV-1a of the payload
+	};
+
+	struct MeshHeader {
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t lodCount;
+		uint32_t submeshCount;
+		uint32_t materialCount;
+		uint32_t vertexBytes; //encoded sizes of the streams
+		uint32_t indexBytes;
+		uint32_t reserved;
+	};
+
+	//texture of a material, by the name of its entry in the pack. Empty for the default texture.
+	struct MaterialRecord {
+		char texture[64];
+	};
+
+	struct TextureHeader {
+		uint32_t width;
+		uint32_t height;
+		uint32_t levelCount;
+		uint32_t reserved;
+	};
+
+	struct TextureLevel {
+		uint32_t width;
+		uint32_t height;
+		uint64_t offset; //from the first level
+		uint64_t size;
+	};
+
+	static std::shared_ptr<AssetPack> open(const std::string& path) {
+		std::shared_ptr<AssetPack> pack(new AssetPack(path));
+		return pack;
+	}
+
+	const PackEntry* find(const std::string& name, AssetType type) const {
+		for (uint32_t i = 0; i < header().entryCount; i++) {
+			const PackEntry& entry = entries()[i];
+			if (entry.type == type && name == entry.name) return &entry;
+		}
+		return nullptr;
+	}
+
+	const PackEntry& get(const std::string& name, AssetType type) const {
+		const PackEntry* entry = find(name, type);
+		if (entry == nullptr) {
+			throw std::runtime_error("asset " + name + " is not in the asset pack!");
+		}
+		return *entry;
+	}
+
+	const uint8_t* payload(const PackEntry& entry) const {
+		return file.data + entry.offset;
+	}
+
+	//touches every page of the pack: used to check a freshly written pack, not on the loading path. The loading path still
+	//checks that every range it reads is inside its entry, so that a corrupted pack fails to load instead of reading out
+	//of bounds.
+	void verify() const {
+		for (uint32_t i = 0; i < header().entryCount; i++) {
+			const PackEntry& entry = entries()[i];
+			if (hash(payload(entry), entry.size) != entry.hash) {
+				throw std::runtime_error(std::string("asset ") + entry.name + " is corrupted in the asset pack!");
+			}
+		}
+	}
+
+	uint64_t fileSize() const {
+		return file.size;
+	}
+
+	void read(uint64_t offset, size_t size, void* dst) const {
+		file.read(offset, size, dst);
+	}
+
+	void readMesh(const std::string& name, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<MeshLod>& lods,
+		std::vector<Submesh>& submeshes, std::vector<std::string>& materials) const {
+		const PackEntry& entry = get(name, AssetType::Mesh);
+		PayloadCursor cursor(*this, entry);
+		MeshHeader mesh;
+		memcpy(&mesh, cursor.take(sizeof(mesh)), sizeof(mesh));
+
+		submeshes.resize(mesh.submeshCount);
+		memcpy(submeshes.data(), cursor.take(uint64_t(mesh.submeshCount) * sizeof(Submesh)), submeshes.size() * sizeof(Submesh));
+		lods.resize(mesh.lodCount);
+		memcpy(lods.data(), cursor.take(uint64_t(mesh.lodCount) * sizeof(MeshLod)), lods.size() * sizeof(MeshLod));
+		materials.clear();
+		for (uint32_t i = 0; i < mesh.materialCount; i++) {
+			MaterialRecord material;
+			memcpy(&material, cursor.take(sizeof(material)), sizeof(material));
+			materials.push_back(std::string(material.texture, strnlen(material.texture, sizeof(material.texture))));
+		}
+
+		//the level ranges are drawn as they are: they have to stay inside the index buffer
+		for (const MeshLod& lod : lods) {
+			if (uint64_t(lod.firstIndex) + lod.indexCount > mesh.indexCount) cursor.corrupted();
+		}
+		for (const Submesh& submesh : submeshes) {
+			if (uint64_t(submesh.firstLod) + submesh.lodCount > mesh.lodCount) cursor.corrupted();
+		}
+
+		vertices.resize(mesh.vertexCount);
+		MeshCodec::decodeVertices(cursor.take(mesh.vertexBytes), mesh.vertexBytes, vertices);
+		indices.resize(mesh.indexCount);
+		MeshCodec::decodeIndices(cursor.take(mesh.indexBytes), mesh.indexBytes, indices);
+	}
+
+	//no copy: the chain points into the mapping, and keeps the pack alive. Its reader reads the file directly.
+	static MipChain mapTexture(const std::shared_ptr<const AssetPack>& pack, const std::string& name) {
+		const PackEntry& entry = pack->get(name, AssetType::Texture);
+		PayloadCursor cursor(*pack, entry);
+		const uint8_t* data = pack->payload(entry);
+		TextureHeader texture;
+		memcpy(&texture, cursor.take(sizeof(texture)), sizeof(texture));
+		if (texture.levelCount == 0) cursor.corrupted();
+
+		std::vector<MipChain::Level> levels(texture.levelCount);
+		const uint8_t* packedLevels = cursor.take(uint64_t(texture.levelCount) * sizeof(TextureLevel));
+		size_t pixelsOffset = texturePixelsOffset(texture.levelCount);
+		if (pixelsOffset > entry.size) cursor.corrupted();
+		uint64_t pixelsSize = entry.size - pixelsOffset;
+		for (uint32_t i = 0; i < texture.levelCount; i++) {
+			TextureLevel level;
+			memcpy(&level, packedLevels + i * sizeof(TextureLevel), sizeof(level));
+			if (level.offset > pixelsSize || level.size > pixelsSize - level.offset || level.size < uint64_t(level.width) * level.height * 4) {
+				cursor.corrupted();
+			}
+			levels[i] = { level.width, level.height, static_cast<size_t>(level.offset), static_cast<size_t>(level.size) };
+		}
+		MipChain chain = MipChain::view(data + pixelsOffset, static_cast<size_t>(entry.size - pixelsOffset), std::move(levels), pack);
+		const AssetPack* file = pack.get(); //kept alive by chain.source
+		uint64_t fileOffset = entry.offset + pixelsOffset;
+		chain.reader = [file, fileOffset](size_t offset, size_t size, void* dst) { file->read(fileOffset + offset, size, dst); };
+		return chain;
+	}
+
+	//SPIR-V words, 4 byte aligned since every payload is page aligned
+	std::pair<const uint32_t*, size_t> shader(const std::string& name) const {
+		const PackEntry& entry = get(name, AssetType::Shader);
+		return { reinterpret_cast<const uint32_t*>(payload(entry)), static_cast<size_t>(entry.size) };
+	}
+
+	static uint64_t hash(const uint8_t* data, uint64_t size) {
+		uint64_t value = 14695981039346656037ull;
+		for (uint64_t i = 0; i < size; i++) {
+			value = (value ^ data[i]) * 1099511628211ull;
+		}
+		return value;
+	}
+
+	static size_t texturePixelsOffset(uint32_t levelCount) {
+		size_t offset = sizeof(TextureHeader) + levelCount * sizeof(TextureLevel);
+		return (offset + 15) & ~size_t(15);
+	}
+
+private:
+	//PayloadCursor : consecutive ranges of a payload, each checked to be inside the entry before it is read
+	class PayloadCursor {
+	public:
+		PayloadCursor(const AssetPack& pack, const PackEntry& entry) : entry(entry), data(pack.payload(entry)) {}
+
+		const uint8_t* take(uint64_t size) {
+			if (size > entry.size - position) corrupted();
+			const uint8_t* range = data + position;
+			position += size;
+			return range;
+		}
+
+		[[noreturn]] void corrupted() const {
+			throw std::runtime_error(std::string("asset ") + entry.name + " is corrupted in the asset pack!");
+		}
+
+	private:
+		const PackEntry& entry;
+		const uint8_t* data;
+		uint64_t position = 0;
+	};
+
+	explicit AssetPack(const std::string& path) : file(path) {
+		if (file.size < sizeof(PackHeader) || header().magic != MAGIC) {
+			throw std::runtime_error(path + " is not an asset pack!");
+		}
+		if (header().version != VERSION || header().vertexSize != sizeof(Vertex)) {
+			throw std::runtime_error(path + " was packed by another version, pack it again!");
+		}
+		if (file.size < sizeof(PackHeader) + uint64_t(header().entryCount) * sizeof(PackEntry)) {
+			throw std::runtime_error(path + " is truncated!");
+		}
+		for (uint32_t i = 0; i < header().entryCount; i++) {
+			const PackEntry& entry = entries()[i];
+			if (entry.offset > file.size || entry.size > file.size - entry.offset) {
+				throw std::runtime_error(path + " is truncated!");
+			}
+			if (strnlen(entry.name, sizeof(entry.name)) == sizeof(entry.name)) {
+				throw std::runtime_error(path + " is corrupted!");
+			}
+		}
+	}
+
+	const PackHeader& header() const {
+		return *reinterpret_cast<const PackHeader*>(file.data);
+	}
+
+	const PackEntry* entries() const {
+		return reinterpret_cast<const PackEntry*>(file.data + sizeof(PackHeader));
+	}
+
+	MappedFile file;
+};
+
+//AssetPackWriter : builds an asset pack from assets already in memory, used by the --pack mode
+class AssetPackWriter {
+public:
+	//materials are the pack names of their textures, which are added separately
+	void addMesh(const std::string& name, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+		const std::vector<MeshLod>& lods, const std::vector<Submesh>& submeshes, const std::vector<std::string>& materials) {
+		std::vector<uint8_t> encodedVertices = MeshCodec::encodeVertices(vertices);
+		std::vector<uint8_t> encodedIndices = MeshCodec::encodeIndices(indices);
+		AssetPack::MeshHeader mesh = { static_cast<uint32_t>(vertices.size()), static_cast<uint32_t>(indices.size()),
+			static_cast<uint32_t>(lods.size()), static_cast<uint32_t>(submeshes.size()), static_cast<uint32_t>(materials.size()),
+			static_cast<uint32_t>(encodedVertices.size()), static_cast<uint32_t>(encodedIndices.size()) };
+		std::vector<uint8_t> payload(sizeof(mesh) + submeshes.size() * sizeof(Submesh) + lods.size() * sizeof(MeshLod) +
+			materials.size() * sizeof(AssetPack::MaterialRecord) + encodedVertices.size() + encodedIndices.size());
+		uint8_t* out = payload.data();
+		memcpy(out, &mesh, sizeof(mesh));
+		out += sizeof(mesh);
+		memcpy(out, submeshes.data(), submeshes.size() * sizeof(Submesh));
+		out += submeshes.size() * sizeof(Submesh);
+		memcpy(out, lods.data(), lods.size() * sizeof(MeshLod));
+		out += lods.size() * sizeof(MeshLod);
+		for (const std::string& material : materials) {
+			AssetPack::MaterialRecord record = {};
+			if (material.size() >= sizeof(record.texture)) {
+				throw std::runtime_error("texture name " + material + " is too long for the asset pack!");
+			}
+			memcpy(record.texture, material.data(), material.size());
+			memcpy(out, &record, sizeof(record));
+			out += sizeof(record);
+		}
+		memcpy(out, encodedVertices.data(), encodedVertices.size());
+		out += encodedVertices.size();
+		memcpy(out, encodedIndices.data(), encodedIndices.size());
+		add(name, AssetType::Mesh, std::move(payload), AssetPack::PAGE_ALIGNMENT);
+	}
+
+	void addTexture(const std::string& name, const MipChain& mips) {
+		AssetPack::TextureHeader texture = { mips.levels[0].width, mips.levels[0].height, mips.levelCount(), 0 };
+		size_t pixelsOffset = AssetPack::texturePixelsOffset(mips.levelCount());
+		std::vector<uint8_t> payload(pixelsOffset + mips.size());
+		memcpy(payload.data(), &texture, sizeof(texture));
+		for (uint32_t i = 0; i < mips.levelCount(); i++) {
+			AssetPack::TextureLevel level = { mips.levels[i].width, mips.levels[i].height, mips.levels[i].offset, mips.levels[i].size };
+			memcpy(payload.data() + sizeof(texture) + i * sizeof(level), &level, sizeof(level));
+		}
+		memcpy(payload.data() + pixelsOffset, mips.bytes(), mips.size());
+		add(name, AssetType::Texture, std::move(payload), AssetPack::TEXTURE_ALIGNMENT);
+	}
+
+	void addShader(const std::string& name, const std::vector<char>& code) {
+		add(name, AssetType::Shader, std::vector<uint8_t>(code.begin(), code.end()), AssetPack::PAGE_ALIGNMENT);
+	}
+
+	//returns the size of the file
+	uint64_t write(const std::string& path) const {
+		std::vector<AssetPack::PackEntry> entries(assets.size());
+		uint64_t offset = sizeof(AssetPack::PackHeader) + entries.size() * sizeof(AssetPack::PackEntry);
+		for (size_t i = 0; i < assets.size(); i++) {
+			offset = (offset + assets[i].alignment - 1) & ~(assets[i].alignment - 1);
+			entries[i] = {};
+			strncpy(entries[i].name, assets[i].name.c_str(), sizeof(entries[i].name) - 1);
+			entries[i].type = assets[i].type;
+			entries[i].offset = offset;
+			entries[i].size = assets[i].payload.size();
+			entries[i].hash = AssetPack::hash(assets[i].payload.data(), assets[i].payload.size());
+			offset += assets[i].payload.size();
+		}
+
+		std::ofstream file(path, std::ios::binary);
+		if (!file.is_open()) {
+			throw std::runtime_error("failed to open " + path + "!");
+		}
+		AssetPack::PackHeader header = { AssetPack::MAGIC, AssetPack::VERSION, static_cast<uint32_t>(entries.size()), sizeof(Vertex) };
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(AssetPack::PackEntry));
+		for (size_t i = 0; i < assets.size(); i++) {
+			std::vector<char> padding(static_cast<size_t>(entries[i].offset - static_cast<uint64_t>(file.tellp())), 0);
+			file.write(padding.data(), padding.size());
+			file.write(reinterpret_cast<const char*>(assets[i].payload.data()), assets[i].payload.size());
+		}
+		if (!file) {
+			throw std::runtime_error("failed to write " + path + "!");
+		}
+		return offset;
+	}
+
+private:
+	struct Asset {
+		std::string name;
+		AssetType type;
+		std::vector<uint8_t> payload;
+		uint64_t alignment;
+	};
+
+	void add(const std::string& name, AssetType type, std::vector<uint8_t> payload, uint64_t alignment) {
+		if (name.size() >= sizeof(AssetPack::PackEntry::name)) {
+			throw std::runtime_error("asset name " + name + " is too long for the asset pack!");
+		}
+		assets.push_back({ name, type, std::move(payload), alignment });
+	}
+
+	std::vector<Asset> assets;
+};
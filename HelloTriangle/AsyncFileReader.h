@@ -0,0 +1,443 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <ostream>
+
+//io_uring needs liburing, which not every Linux box has: opt in with -DUSE_IO_URING (and -luring)
+#if defined(__linux__) && defined(USE_IO_URING)
+#include <liburing.h>
+#define ASYNC_FILE_READER_IO_URING
+#endif
+
+//AsyncFileReader : reads whole files (or ranges of them) without blocking the caller.
+//Requests wait in a priority queue, so what is visible on screen gets read before what is only prefetched, and many
+//of them are in flight at once. The completion callback runs on an I/O thread: it is the place to decode, then hand
+//the result over to the render thread (e.g. through a promise) for the upload.
+//
+//Backends :
+//  IoUring     one thread reaps the completions of up to QUEUE_DEPTH reads submitted to the kernel (Linux, USE_IO_URING)
+//  ThreadPool  blocking positional reads on a few worker threads, everywhere else
+//  Synchronous reads and completes inside read(), i.e. the old sequential loading
+class AsyncFileReader {
+public:
+	enum Backend { IoUring, ThreadPool, Synchronous };
+
+	static const uint64_t WHOLE_FILE = UINT64_MAX;
+	static const unsigned QUEUE_DEPTH = 64;
+
+	struct Result {
+		std::string path;
+		std::vector<char> data;
+		std::string error; //empty on success
+	};
+
+	//lower values are read first
+	enum Priority { Visible = 0, Nearby = 1, Prefetch = 2 };
+
+	struct Request {
+		std::string path;
+		uint64_t offset = 0;
+		uint64_t size = WHOLE_FILE;
+		int priority = Visible;
+		std::function<void(Result&)> onComplete;
+	};
+
+	//the best backend available when none is asked for
+	static Backend defaultBackend() {
+#ifdef ASYNC_FILE_READER_IO_URING
+		return IoUring;
+#else
+		return ThreadPool;
+#endif
+	}
+
+	static const char* backendName(Backend backend) {
+		switch (backend) {
+		case IoUring: return "io_uring";
+		case ThreadPool: return "thread pool";
+		default: return "synchronous";
+		}
+	}
+
+	explicit AsyncFileReader(Backend backend = defaultBackend(), unsigned threadCount = 0) : backend(backend) {
+#ifndef ASYNC_FILE_READER_IO_URING
+		if (this->backend == IoUring) this->backend = ThreadPool; //not compiled in
+#endif
+		if (this->backend == ThreadPool) {
+			if (threadCount == 0) threadCount = std::max(2u, std::min(8u, std::thread::hardware_concurrency()));
+			for (unsigned i = 0; i < threadCount; i++) {
+				threads.emplace_back([this]() { workerLoop(); });
+			}
+		}
+#ifdef ASYNC_FILE_READER_IO_URING
+		if (this->backend == IoUring) {
+			if (io_uring_queue_init(QUEUE_DEPTH, &ring, 0) < 0) {
+				this->backend = ThreadPool; //e.g. disabled by the kernel or a seccomp profile
+				threads.emplace_back([this]() { workerLoop(); });
+				threads.emplace_back([this]() { workerLoop(); });
+			}
+			else {
+				threads.emplace_back([this]() { completionLoop(); });
+			}
+		}
+#endif
+	}
+
+	//waits for the reads in flight, drops the ones not started
+	~AsyncFileReader() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			pending = decltype(pending)();
+#ifdef ASYNC_FILE_READER_IO_URING
+			if (backend == IoUring) {
+				wakeCompletionThread();
+				io_uring_submit(&ring);
+			}
+#endif
+		}
+		wakeUp.notify_all();
+		for (std::thread& thread : threads) thread.join();
+#ifdef ASYNC_FILE_READER_IO_URING
+		if (backend == IoUring) io_uring_queue_exit(&ring);
+#endif
+	}
+
+	AsyncFileReader(const AsyncFileReader&) = delete;
+	AsyncFileReader& operator=(const AsyncFileReader&) = delete;
+
+	Backend getBackend() const {
+		return backend;
+	}
+
+	void read(Request request) {
+		if (backend == Synchronous) {
+			Result result = readBlocking(request);
+			request.onComplete(result);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending.push({ std::move(request), nextSequence++ });
+			outstanding++;
+#ifdef ASYNC_FILE_READER_IO_URING
+			if (backend == IoUring) submitPending();
+#endif
+		}
+		wakeUp.notify_one();
+	}
+
+	//blocks until every request read so far has completed, callbacks included
+	void waitIdle() {
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this]() { return outstanding == 0; });
+	}
+
+	//drops the file from the OS page cache, so that the next read comes from the disk. False when not supported.
+	static bool evictFromPageCache(const std::string& path) {
+#if defined(__linux__)
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		fdatasync(fd);
+		bool evicted = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+		close(fd);
+		return evicted;
+#else
+		return false; //Windows has no per file equivalent, short of unbuffered handles
+#endif
+	}
+
+	//reads every file, all requests issued at once, and returns the wall clock time in ms
+	static double timeReads(Backend backend, const std::vector<std::string>& paths, uint64_t& bytes) {
+		std::atomic<uint64_t> total{ 0 };
+		std::atomic<size_t> failures{ 0 };
+		auto start = std::chrono::high_resolution_clock::now();
+		{
+			AsyncFileReader reader(backend);
+			for (const std::string& path : paths) {
+				Request request;
+				request.path = path;
+				request.onComplete = [&total, &failures](Result& result) {
+					total += result.data.size();
+					if (!result.error.empty()) failures++;
+				};
+				reader.read(std::move(request));
+			}
+			reader.waitIdle();
+		}
+		if (failures > 0) {
+			throw std::runtime_error("failed to read " + std::to_string(failures.load()) + " of the benchmark files!");
+		}
+		bytes = total;
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	//cold (evicted from the page cache) then warm reads of the files, with every backend
+	static void benchmark(const std::vector<std::string>& paths, std::ostream& out) {
+		for (Backend backend : { Synchronous, ThreadPool, IoUring }) {
+			AsyncFileReader probe(backend); //IoUring falls back when not available: skip it then
+			if (probe.getBackend() != backend) continue;
+
+			bool cold = true;
+			for (const std::string& path : paths) cold = evictFromPageCache(path) && cold;
+			uint64_t bytes = 0;
+			double coldMs = timeReads(backend, paths, bytes);
+			double warmMs = timeReads(backend, paths, bytes);
+
+			out << backendName(backend) << " : " << paths.size() << " files, " << bytes / (1024 * 1024) << " MB" << std::endl;
+			out << "  " << (cold ? "cold" : "cold (could not evict, cache may be warm)") << " : " << coldMs << " ms, "
+				<< bytes / (1024.0 * 1024.0) / (coldMs / 1000.0) << " MB/s" << std::endl;
+			out << "  warm : " << warmMs << " ms, " << bytes / (1024.0 * 1024.0) / (warmMs / 1000.0) << " MB/s" << std::endl;
+		}
+	}
+
+	static Result readBlocking(const Request& request) {
+		Result result;
+		result.path = request.path;
+		try {
+			FileHandle file(request.path);
+			result.data.resize(static_cast<size_t>(readSize(request, file.size())));
+			file.read(request.offset, result.data.data(), result.data.size());
+		}
+		catch (const std::exception& e) {
+			result.error = e.what();
+		}
+		return result;
+	}
+
+private:
+	//bytes a request reads from a file of fileSize bytes, throws when they are not all in the file
+	static uint64_t readSize(const Request& request, uint64_t fileSize) {
+		if (request.offset > fileSize || (request.size != WHOLE_FILE && request.size > fileSize - request.offset)) {
+			throw std::runtime_error("read past the end of " + request.path + "!");
+		}
+		return request.size == WHOLE_FILE ? fileSize - request.offset : request.size;
+	}
+
+	struct Queued {
+		Request request;
+		uint64_t sequence; //first come first served within a priority
+
+		bool operator<(const Queued& other) const { //std::priority_queue pops the largest
+			return request.priority != other.request.priority ? request.priority > other.request.priority : sequence > other.sequence;
+		}
+	};
+
+	//FileHandle : the open file of one request
+	class FileHandle {
+	public:
+		explicit FileHandle(const std::string& path) {
+#ifdef _WIN32
+			handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (handle == INVALID_HANDLE_VALUE) throw std::runtime_error("failed to open " + path + "!");
+#else
+			fd = open(path.c_str(), O_RDONLY);
+			if (fd < 0) throw std::runtime_error("failed to open " + path + "!");
+#endif
+		}
+
+		~FileHandle() {
+#ifdef _WIN32
+			if (handle != INVALID_HANDLE_VALUE) CloseHandle(handle);
+#else
+			if (fd >= 0) close(fd);
+#endif
+		}
+
+		FileHandle(const FileHandle&) = delete;
+		FileHandle& operator=(const FileHandle&) = delete;
+
+		uint64_t size() const {
+#ifdef _WIN32
+			LARGE_INTEGER fileSize;
+			GetFileSizeEx(handle, &fileSize);
+			return static_cast<uint64_t>(fileSize.QuadPart);
+#else
+			struct stat status;
+			fstat(fd, &status);
+			return static_cast<uint64_t>(status.st_size);
+#endif
+		}
+
+		void read(uint64_t offset, char* out, size_t count) const {
+			while (count > 0) {
+#ifdef _WIN32
+				OVERLAPPED position = {};
+				position.Offset = static_cast<DWORD>(offset);
+				position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+				DWORD done = 0;
+				if (!ReadFile(handle, out, static_cast<DWORD>(std::min<size_t>(count, 1u << 30)), &done, &position) || done == 0) {
+					throw std::runtime_error("failed to read file!");
+				}
+#else
+				ssize_t done = pread(fd, out, count, static_cast<off_t>(offset));
+				if (done <= 0) throw std::runtime_error("failed to read file!");
+#endif
+				out += done;
+				offset += done;
+				count -= done;
+			}
+		}
+
+#ifdef _WIN32
+		HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+		int fd = -1;
+#endif
+	};
+
+	void complete(const Request& request, Result& result) {
+		request.onComplete(result);
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--outstanding == 0) idle.notify_all();
+	}
+
+	void workerLoop() {
+		while (true) {
+			Queued next;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeUp.wait(lock, [this]() { return stopping || !pending.empty(); });
+				if (stopping) return;
+				next = pending.top();
+				pending.pop();
+			}
+			Result result = readBlocking(next.request);
+			complete(next.request, result);
+		}
+	}
+
+#ifdef ASYNC_FILE_READER_IO_URING
+	//a read submitted to the ring. Short reads are resubmitted for the rest.
+	struct InFlight {
+		Request request;
+		Result result;
+		std::unique_ptr<FileHandle> file;
+		size_t done = 0;
+	};
+
+	void prepareRead(InFlight* read) {
+		io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+		io_uring_prep_read(sqe, read->file->fd, read->result.data.data() + read->done,
+			static_cast<unsigned>(std::min<size_t>(read->result.data.size() - read->done, 1u << 30)), read->request.offset + read->done);
+		io_uring_sqe_set_data(sqe, read);
+	}
+
+	//called with the mutex held: moves the most urgent requests into the ring, up to its depth
+	void submitPending() {
+		bool submitted = false;
+		while (!pending.empty() && inFlight < QUEUE_DEPTH - 1) { //one entry is kept for the shutdown nop
+			InFlight* read = new InFlight();
+			read->request = pending.top().request;
+			pending.pop();
+			read->result.path = read->request.path;
+			try {
+				read->file.reset(new FileHandle(read->request.path));
+				read->result.data.resize(static_cast<size_t>(readSize(read->request, read->file->size())));
+			}
+			catch (const std::exception& e) {
+				read->result.error = e.what();
+			}
+			if (!read->result.error.empty() || read->result.data.empty()) {
+				finished.push_back(read); //completed by the completion thread, callbacks never run under the mutex
+				wakeCompletionThread();
+				submitted = true;
+				continue;
+			}
+			prepareRead(read);
+			inFlight++;
+			submitted = true;
+		}
+		if (submitted) io_uring_submit(&ring);
+	}
+
+	//a nop completion with no read attached
+	void wakeCompletionThread() {
+		io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+		if (sqe == nullptr) return; //the ring is full: a completion is on its way anyway
+		io_uring_prep_nop(sqe);
+		io_uring_sqe_set_data(sqe, nullptr);
+	}
+
+	//on shutdown, keeps reaping until every read in flight completed, so that none of them leaks
+	void completionLoop() {
+		while (true) {
+			io_uring_cqe* cqe = nullptr;
+			bool haveCompletion = io_uring_wait_cqe(&ring, &cqe) == 0;
+			std::vector<InFlight*> done;
+			bool stop;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (haveCompletion) {
+					InFlight* read = static_cast<InFlight*>(io_uring_cqe_get_data(cqe));
+					int bytes = cqe->res;
+					io_uring_cqe_seen(&ring, cqe);
+					if (read == nullptr) {
+						//a wake up: shutdown, or reads that failed before being submitted are in finished
+					}
+					else if (bytes <= 0) {
+						read->result.error = "failed to read " + read->request.path + "!";
+						inFlight--;
+						done.push_back(read);
+					}
+					else if ((read->done += bytes) < read->result.data.size()) {
+						prepareRead(read);
+						io_uring_submit(&ring);
+					}
+					else {
+						inFlight--;
+						done.push_back(read);
+					}
+				}
+				if (!stopping) submitPending();
+				done.insert(done.end(), finished.begin(), finished.end());
+				finished.clear();
+				stop = stopping && inFlight == 0;
+			}
+			for (InFlight* read : done) {
+				read->file.reset();
+				complete(read->request, read->result);
+				delete read;
+			}
+			if (stop) return;
+		}
+	}
+
+	io_uring ring;
+	unsigned inFlight = 0;
+	std::vector<InFlight*> finished;
+#endif
+
+	Backend backend;
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	std::condition_variable idle;
+	std::priority_queue<Queued> pending;
+	uint64_t nextSequence = 0;
+	size_t outstanding = 0; //requests read() but not completed yet
+	bool stopping = false;
+};
@@ -0,0 +1,302 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+enum class Scene {
+	Cube,
+	Heart,
+	Chalet,
+	Synthetic, //grid of cubes, to scale the vertex count
+	CullTest //a box hiding another, and one behind the camera: what the culling pass has to count is known
+};
+
+//how upload data gets into staging memory
+enum class StagingIo {
+	Copy, //memcpy from wherever the data is in memory
+	Read, //read from the asset pack file straight into mapped staging memory
+	Import //use the mapped asset pack itself as staging memory (VK_EXT_external_memory_host), falls back to Read
+};
+
+//where the transform (mvp matrix) of each draw comes from
+enum class ObjectTransforms {
+	PushConstants, //vkCmdPushConstants before the draw
+	UniformBuffer //written to a per-frame uniform buffer, and a descriptor set per object pointing at it
+};
+
+//how frames are handed to the display, from the lowest input latency to the least tearing and power
+enum class LatencyMode {
+	Immediate, //present right away and tear (IMMEDIATE), or MAILBOX when the surface can't
+	Mailbox, //the newest finished frame is shown at the next vblank, older ones are dropped
+	Vsync, //every frame is shown, the CPU waits for the display when it runs ahead (FIFO)
+	Relaxed //vsync, but a late frame is shown right away and tears instead of waiting for one more vblank (FIFO_RELAXED)
+};
+
+//AppOptions : command line of the application.
+//Without arguments the interactive viewer runs as before. --benchmark renders a fixed number of frames with a fixed
+//simulated timestep, so two runs render exactly the same images, and prints the results as JSON.
+struct AppOptions {
+	bool benchmark = false;
+	bool headless = false; //no window nor swap chain: render into offscreen images (CI, software ICDs)
+	uint32_t frames = 1000;
+	uint32_t warmupFrames = 10; //not counted in the frame time results
+	float timestepMs = 1000.0f / 60.0f;
+	Scene scene = Scene::Chalet;
+	uint32_t syntheticInstances = 100;
+	std::string resultsPath; //benchmark results go to stdout when empty
+	bool parallelStartup = true; //load the scene and decode the texture on worker threads during initVulkan
+	uint32_t textureBudgetMB = 0; //VRAM the streamed textures may use, 0 for a share of the device local heap
+	std::string assetsPath; //asset pack to load the scene from, loose files when empty
+	std::string packPath; //write the asset pack of the scene there and exit
+	StagingIo stagingIo = StagingIo::Import; //only makes a difference with --assets
+	bool ioBenchmark = false; //time cold and warm reads of ioBenchmarkFiles with every reader backend, and exit
+	std::vector<std::string> ioBenchmarkFiles; //the assets of the scene when empty
+	bool objectDraws = false; //synthetic scene : one draw per cube, each with its own model matrix
+	ObjectTransforms objectTransforms = ObjectTransforms::PushConstants;
+	bool matrixBenchmark = false; //time the matrix batch kernels against glm on matrixBenchmarkCount matrices, check their accuracy, and exit
+	uint32_t matrixBenchmarkCount = 10000;
+	bool sortBenchmark = false; //time the draw key radix sort against std::stable_sort on sortBenchmarkCount draws, and exit
+	uint32_t sortBenchmarkCount = 100000;
+	bool codecBenchmark = false; //encoded sizes and decode throughput of the vertex and index streams of the scene, and exit
+	bool renderGraphTest = false; //compile small render graphs, check their barriers, culling and aliasing, and exit
+	bool cullTest = false; //render the cull test scene headless, check the counters the culling pass read back, and exit
+	bool culling = true; //frustum and occlusion culling of the objects on the GPU, against the previous frame's depth
+	bool depthPrepass = false; //depth only subpass first, then shade with an EQUAL depth test: each pixel is shaded once
+	int32_t lod = -1; //level of detail every object is drawn with, -1 to choose it from the size of the object on screen
+	LatencyMode latencyMode = LatencyMode::Mailbox; //falls back to vsync (FIFO) when the surface doesn't support it
+	uint32_t swapchainImages = 0; //0 for one more than the minimum of the surface, clamped to what it supports
+	uint32_t fpsLimit = 0; //0 for no limit. Frames start just in time to be done at the rate, input is sampled late.
+	std::string profilePath; //timestamp queries around the passes of each frame, shown by --report, and the whole run written there as a Chrome trace on exit
+	bool report = false; //every 2 s, print how long the GPU lags behind the CPU and the frame statistics, and the frame time histogram on exit, not with --benchmark
+	std::string frameStatsPath; //per frame CPU timings (acquire/update/submit/present), always recorded, written there as CSV on exit
+
+	static const char* usage() {
+		return "usage: HelloTriangle [--benchmark] [--headless] [--frames N] [--warmup N] [--timestep MS]\n"
+			"                     [--scene cube|heart|chalet|synthetic:N] [--results FILE]\n"
+			"                     [--serial-startup] [--texture-budget MB] [--assets PACK] [--staging-io copy|read|import]\n"
+			"                     [--object-draws] [--object-transforms push|uniform] [--lod auto|N] [--no-culling]\n"
+			"                     [--depth-prepass] [--latency immediate|mailbox|vsync|relaxed] [--swapchain-images N]\n"
+			"                     [--fps-limit N] [--report] [--profile FILE] [--frame-stats FILE]\n"
+			"       HelloTriangle --pack PACK [--scene cube|heart|chalet|synthetic:N]\n"
+			"       HelloTriangle --io-benchmark [FILE...]\n"
+			"       HelloTriangle --matrix-benchmark [COUNT]\n"
+			"       HelloTriangle --sort-benchmark [COUNT]\n"
+			"       HelloTriangle --codec-benchmark [--scene cube|heart|chalet|synthetic:N]\n"
+			"       HelloTriangle --cull-test\n"
+			"       HelloTriangle --render-graph-test";
+	}
+
+	static AppOptions parse(int argc, char** argv) {
+		AppOptions options;
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			auto value = [&]() -> std::string {
+				if (i + 1 >= argc) throw std::runtime_error("missing value after " + arg + "!");
+				return argv[++i];
+			};
+
+			if (arg == "--benchmark") options.benchmark = true;
+			else if (arg == "--headless") options.headless = true;
+			else if (arg == "--frames") options.frames = parseCount(value());
+			else if (arg == "--warmup") options.warmupFrames = parseCount(value());
+			else if (arg == "--timestep") options.timestepMs = std::stof(value());
+			else if (arg == "--results") options.resultsPath = value();
+			else if (arg == "--serial-startup") options.parallelStartup = false;
+			else if (arg == "--texture-budget") options.textureBudgetMB = parseCount(value());
+			else if (arg == "--assets") options.assetsPath = value();
+			else if (arg == "--pack") options.packPath = value();
+			else if (arg == "--object-draws") options.objectDraws = true;
+			else if (arg == "--no-culling") options.culling = false;
+			else if (arg == "--depth-prepass") options.depthPrepass = true;
+			else if (arg == "--codec-benchmark") options.codecBenchmark = true;
+			else if (arg == "--cull-test") options.cullTest = true;
+			else if (arg == "--render-graph-test") options.renderGraphTest = true;
+			else if (arg == "--swapchain-images") options.swapchainImages = parseCount(value());
+			else if (arg == "--fps-limit") options.fpsLimit = parseCount(value());
+			else if (arg == "--report") options.report = true;
+			else if (arg == "--profile") options.profilePath = value();
+			else if (arg == "--frame-stats") options.frameStatsPath = value();
+			else if (arg == "--latency") {
+				std::string mode = value();
+				if (mode == "immediate") options.latencyMode = LatencyMode::Immediate;
+				else if (mode == "mailbox") options.latencyMode = LatencyMode::Mailbox;
+				else if (mode == "vsync") options.latencyMode = LatencyMode::Vsync;
+				else if (mode == "relaxed") options.latencyMode = LatencyMode::Relaxed;
+				else throw std::runtime_error("unknown latency mode " + mode + "!");
+			}
+			else if (arg == "--matrix-benchmark") {
+				options.matrixBenchmark = true;
+				if (i + 1 < argc && std::string(argv[i + 1]).compare(0, 2, "--") != 0) {
+					options.matrixBenchmarkCount = parseCount(argv[++i]);
+				}
+			}
+			else if (arg == "--sort-benchmark") {
+				options.sortBenchmark = true;
+				if (i + 1 < argc && std::string(argv[i + 1]).compare(0, 2, "--") != 0) {
+					options.sortBenchmarkCount = parseCount(argv[++i]);
+				}
+			}
+			else if (arg == "--object-transforms") {
+				std::string transforms = value();
+				if (transforms == "push") options.objectTransforms = ObjectTransforms::PushConstants;
+				else if (transforms == "uniform") options.objectTransforms = ObjectTransforms::UniformBuffer;
+				else throw std::runtime_error("unknown object transforms " + transforms + "!");
+			}
+			else if (arg == "--lod") {
+				std::string lod = value();
+				options.lod = lod == "auto" ? -1 : static_cast<int32_t>(std::stoul(lod));
+			}
+			else if (arg == "--io-benchmark") {
+				options.ioBenchmark = true;
+				while (i + 1 < argc && std::string(argv[i + 1]).compare(0, 2, "--") != 0) {
+					options.ioBenchmarkFiles.push_back(argv[++i]);
+				}
+			}
+			else if (arg == "--staging-io") {
+				std::string io = value();
+				if (io == "copy") options.stagingIo = StagingIo::Copy;
+				else if (io == "read") options.stagingIo = StagingIo::Read;
+				else if (io == "import") options.stagingIo = StagingIo::Import;
+				else throw std::runtime_error("unknown staging io " + io + "!");
+			}
+			else if (arg == "--scene") {
+				std::string scene = value();
+				if (scene == "cube") options.scene = Scene::Cube;
+				else if (scene == "heart") options.scene = Scene::Heart;
+				else if (scene == "chalet") options.scene = Scene::Chalet;
+				else if (scene.compare(0, 10, "synthetic:") == 0) {
+					options.scene = Scene::Synthetic;
+					options.syntheticInstances = parseCount(scene.substr(10));
+				}
+				else throw std::runtime_error("unknown scene " + scene + "!");
+			}
+			else throw std::runtime_error("unknown argument " + arg + "!");
+		}
+
+		if (options.cullTest) {
+			if (!options.culling) throw std::runtime_error("--cull-test needs culling!");
+			//a few frames past the first, which has no depth pyramid to cull against yet. No time passes, nothing moves.
+			options.benchmark = true;
+			options.headless = true;
+			options.scene = Scene::CullTest;
+			options.frames = 8;
+			options.warmupFrames = 0;
+			options.timestepMs = 0.0f;
+		}
+		if (options.headless && !options.benchmark) {
+			throw std::runtime_error("--headless only makes sense with --benchmark!");
+		}
+		if (options.objectDraws && options.scene != Scene::Synthetic) {
+			throw std::runtime_error("--object-draws needs --scene synthetic:N!");
+		}
+		return options;
+	}
+
+	static const char* sceneName(Scene scene) {
+		switch (scene) {
+		case Scene::Cube: return "cube";
+		case Scene::Heart: return "heart";
+		case Scene::Chalet: return "chalet";
+		case Scene::CullTest: return "cull-test";
+		default: return "synthetic";
+		}
+	}
+
+	static const char* objectTransformsName(ObjectTransforms transforms) {
+		return transforms == ObjectTransforms::PushConstants ? "push" : "uniform";
+	}
+
+	static const char* latencyModeName(LatencyMode mode) {
+		switch (mode) {
+		case LatencyMode::Immediate: return "immediate";
+		case LatencyMode::Mailbox: return "mailbox";
+		case LatencyMode::Vsync: return "vsync";
+		default: return "relaxed";
+		}
+	}
+
+private:
+	static uint32_t parseCount(const std::string& text) {
+		unsigned long count = std::stoul(text);
+		if (count == 0) throw std::runtime_error("expected a positive count, got " + text + "!");
+		return static_cast<uint32_t>(count);
+	}
+};
+
+//PhaseTimer : wall clock time of consecutive named phases, e.g. the steps of the startup
+class PhaseTimer {
+public:
+	//ends the current phase, if any, and starts the next one
+	void begin(const char* name) {
+		end();
+		current = name;
+		start = std::chrono::high_resolution_clock::now();
+	}
+
+	//a phase measured elsewhere, e.g. by a worker thread. It overlaps the other phases, so it is not part of totalMs.
+	void record(const std::string& name, double ms) {
+		tasks.push_back({ name, ms });
+	}
+
+	void end() {
+		if (current == nullptr) return;
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		phases.push_back({ current, ms });
+		current = nullptr;
+	}
+
+	//sequential phases first, then the recorded tasks
+	std::vector<std::pair<std::string, double>> results() const {
+		std::vector<std::pair<std::string, double>> all = phases;
+		all.insert(all.end(), tasks.begin(), tasks.end());
+		return all;
+	}
+
+	double totalMs() const {
+		double total = 0.0;
+		for (auto& phase : phases) total += phase.second;
+		return total;
+	}
+
+private:
+	const char* current = nullptr;
+	std::chrono::high_resolution_clock::time_point start;
+	std::vector<std::pair<std::string, double>> phases;
+	std::vector<std::pair<std::string, double>> tasks;
+};
+
+//largest resident set size of the process so far, in bytes
+inline uint64_t peakResidentMemory() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return counters.PeakWorkingSetSize;
+	}
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+		return usage.ru_maxrss; //bytes on macOS
+#else
+		return static_cast<uint64_t>(usage.ru_maxrss) * 1024; //kilobytes on Linux
+#endif
+	}
+	return 0;
+#endif
+}
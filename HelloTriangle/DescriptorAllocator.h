@@ -0,0 +1,342 @@
+#pragma once
+#include "VulkanHelpers.h"
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+
+//DescriptorWrites : contents of a descriptor set, i.e. what vkUpdateDescriptorSets would write into it.
+//Two sets with the same layout and the same writes are interchangeable, which is what DescriptorAllocator caches on.
+class DescriptorWrites {
+public:
+	DescriptorWrites& buffer(uint32_t binding, VkDescriptorType type, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+		Entry entry = {};
+		entry.binding = binding;
+		entry.type = type;
+		entry.buffer = buffer;
+		entry.offset = offset;
+		entry.range = range;
+		entries.push_back(entry);
+		return *this;
+	}
+
+	DescriptorWrites& image(uint32_t binding, uint32_t element, VkDescriptorType type, VkImageView view, VkSampler sampler,
+		VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+		Entry entry = {};
+		entry.binding = binding;
+		entry.element = element;
+		entry.type = type;
+		entry.view = view;
+		entry.sampler = sampler;
+		entry.layout = layout;
+		entries.push_back(entry);
+		return *this;
+	}
+
+	//FNV-1a over the fields, not the structs, so that padding does not matter
+	uint64_t hash() const {
+		uint64_t h = 14695981039346656037ull;
+		auto mix = [&h](uint64_t value) {
+			for (int i = 0; i < 8; i++) {
+				h ^= (value >> (i * 8)) & 0xff;
+				h *= 1099511628211ull;
+			}
+		};
+		for (const Entry& entry : entries) {
+			mix(entry.binding);
+			mix(entry.element);
+			mix(entry.type);
+			mix((uint64_t)entry.buffer);
+			mix(entry.offset);
+			mix(entry.range);
+			mix((uint64_t)entry.view);
+			mix((uint64_t)entry.sampler);
+			mix(entry.layout);
+		}
+		return h;
+	}
+
+	bool operator==(const DescriptorWrites& other) const {
+		return entries.size() == other.entries.size() && std::equal(entries.begin(), entries.end(), other.entries.begin(),
+			[](const Entry& a, const Entry& b) {
+				return a.binding == b.binding && a.element == b.element && a.type == b.type && a.buffer == b.buffer &&
+					a.offset == b.offset && a.range == b.range && a.view == b.view && a.sampler == b.sampler && a.layout == b.layout;
+			});
+	}
+
+	void write(VkDevice device, VkDescriptorSet set) const {
+		std::vector<VkDescriptorBufferInfo> bufferInfos(entries.size());
+		std::vector<VkDescriptorImageInfo> imageInfos(entries.size());
+		std::vector<VkWriteDescriptorSet> descriptorWrites(entries.size());
+		for (size_t i = 0; i < entries.size(); i++) {
+			const Entry& entry = entries[i];
+			descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[i].dstSet = set;
+			descriptorWrites[i].dstBinding = entry.binding;
+			descriptorWrites[i].dstArrayElement = entry.element;
+			descriptorWrites[i].descriptorType = entry.type;
+			descriptorWrites[i].descriptorCount = 1;
+			if (entry.view != VK_NULL_HANDLE) {
+				imageInfos[i].imageView = entry.view;
+				imageInfos[i].sampler = entry.sampler;
+				imageInfos[i].imageLayout = entry.layout;
+				descriptorWrites[i].pImageInfo = &imageInfos[i];
+			}
+			else {
+				bufferInfos[i].buffer = entry.buffer;
+				bufferInfos[i].offset = entry.offset;
+				bufferInfos[i].range = entry.range;
+				descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+			}
+		}
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	}
+
+private:
+	struct Entry {
+		uint32_t binding;
+		uint32_t element;
+		VkDescriptorType type;
+		VkBuffer buffer;
+		VkDeviceSize offset;
+		VkDeviceSize range;
+		VkImageView view;
+		VkSampler sampler;
+		VkImageLayout layout;
+	};
+	std::vector<Entry> entries;
+};
+
+//DescriptorAllocator : descriptor sets that live for one frame.
+//Each frame in flight owns a chain of pools per layout, sized for that layout, and a new pool is added to the chain
+//when the last one is full. When the slot comes around again its frame is complete, so all its pools are reset at
+//once instead of freeing sets one by one. Within a frame, sets are cached by contents: asking twice for the same
+//writes returns the same set, e.g. for draws sharing a material.
+//Sets whose contents rarely change, like the texture table, are persistent instead: one per layout, kept across frames
+//and only replaced when its writes change, each in a pool of its own sized for that one set.
+class DescriptorAllocator {
+public:
+	struct PoolSize {
+		VkDescriptorType type;
+		uint32_t perSet;
+	};
+
+	//since create, for the benchmark results and the periodic report
+	struct Stats {
+		uint64_t requests = 0;
+		uint64_t allocations = 0; //cache misses
+		uint64_t poolsCreated = 0;
+		uint64_t poolResets = 0;
+		double allocateMs = 0.0; //allocating and writing the sets that missed the cache
+	};
+
+	static const uint32_t FIRST_POOL_SETS = 4; //sets in the first pool of each chain, doubled for each new pool up to MAX_POOL_SETS
+	static const uint32_t MAX_POOL_SETS = 256;
+
+	DescriptorAllocator(const VDeleter<VkDevice>& device) : device(device) {}
+
+	~DescriptorAllocator() {
+		destroy();
+	}
+
+	void create(uint32_t framesInFlight) {
+		frames.resize(framesInFlight);
+	}
+
+	//layouts must be registered before sets are allocated with them, as Vulkan cannot tell what a layout holds
+	void registerLayout(VkDescriptorSetLayout layout, const std::vector<PoolSize>& sizes) {
+		layouts[layout] = { sizes };
+	}
+
+	//the frame that last used the slot has completed
+	void beginFrame(size_t slot) {
+		frameIndex++;
+		//the frames that could use a replaced persistent set have all completed once every slot came around since
+		while (!retired.empty() && retired.front().frameIndex + frames.size() <= frameIndex) {
+			vkDestroyDescriptorPool(device, retired.front().set.pool, nullptr);
+			retired.pop_front();
+		}
+
+		current = &frames[slot];
+		for (auto& chain : current->chains) {
+			for (VkDescriptorPool pool : chain.second.pools) {
+				vkResetDescriptorPool(device, pool, 0);
+				stats.poolResets++;
+			}
+			chain.second.current = 0;
+		}
+		current->cache.clear();
+	}
+
+	//a set holding writes, valid until the slot of the current frame comes around again
+	VkDescriptorSet get(VkDescriptorSetLayout layout, const DescriptorWrites& writes) {
+		stats.requests++;
+		uint64_t hash = writes.hash();
+		std::vector<CachedSet>& candidates = current->cache[hash];
+		for (const CachedSet& cached : candidates) {
+			if (cached.layout == layout && cached.writes == writes) return cached.set;
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		VkDescriptorSet set = allocate(layout);
+		writes.write(device, set);
+		candidates.push_back({ layout, writes, set });
+		stats.allocateMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		return set;
+	}
+
+	//the persistent set of the layout, written again only when writes differ from what it holds. The set it replaces
+	//stays valid until the frames in flight that may use it are complete.
+	VkDescriptorSet getPersistent(VkDescriptorSetLayout layout, const DescriptorWrites& writes) {
+		stats.requests++;
+		uint64_t hash = writes.hash();
+		auto found = persistent.find(layout);
+		if (found != persistent.end()) {
+			if (found->second.hash == hash && found->second.writes == writes) return found->second.set;
+			retired.push_back({ frameIndex, found->second });
+			persistent.erase(found);
+		}
+
+		auto info = layouts.find(layout);
+		if (info == layouts.end()) {
+			throw std::runtime_error("failed to allocate descriptor set, unknown layout!");
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		PersistentSet set = { createPool(info->second, 1), VK_NULL_HANDLE, hash, writes };
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = set.pool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &layout;
+		if (vkAllocateDescriptorSets(device, &allocInfo, &set.set) != VK_SUCCESS) {
+			vkDestroyDescriptorPool(device, set.pool, nullptr);
+			throw std::runtime_error("failed to allocate descriptor set!");
+		}
+		stats.allocations++;
+		writes.write(device, set.set);
+		persistent[layout] = set;
+		stats.allocateMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		return set.set;
+	}
+
+	const Stats& getStats() const {
+		return stats;
+	}
+
+	//only call this when the device is idle
+	void destroy() {
+		for (Frame& frame : frames) {
+			for (auto& chain : frame.chains) {
+				for (VkDescriptorPool pool : chain.second.pools) vkDestroyDescriptorPool(device, pool, nullptr);
+			}
+		}
+		for (auto& set : persistent) vkDestroyDescriptorPool(device, set.second.pool, nullptr);
+		for (RetiredSet& set : retired) vkDestroyDescriptorPool(device, set.set.pool, nullptr);
+		frames.clear();
+		persistent.clear();
+		retired.clear();
+		current = nullptr;
+	}
+
+private:
+	struct LayoutInfo {
+		std::vector<PoolSize> sizes;
+	};
+
+	struct Chain {
+		std::vector<VkDescriptorPool> pools;
+		size_t current = 0; //pools before this one are full
+	};
+
+	struct CachedSet {
+		VkDescriptorSetLayout layout;
+		DescriptorWrites writes;
+		VkDescriptorSet set;
+	};
+
+	struct Frame {
+		std::map<VkDescriptorSetLayout, Chain> chains;
+		std::unordered_map<uint64_t, std::vector<CachedSet>> cache; //by DescriptorWrites::hash
+	};
+
+	struct PersistentSet {
+		VkDescriptorPool pool; //holds only this set
+		VkDescriptorSet set;
+		uint64_t hash;
+		DescriptorWrites writes;
+	};
+
+	struct RetiredSet {
+		uint64_t frameIndex; //the last frame that may use it
+		PersistentSet set;
+	};
+
+	const VDeleter<VkDevice>& device;
+	std::map<VkDescriptorSetLayout, LayoutInfo> layouts;
+	std::vector<Frame> frames;
+	Frame* current = nullptr;
+	uint64_t frameIndex = 0; //of the current frame, counting beginFrame calls
+	std::map<VkDescriptorSetLayout, PersistentSet> persistent;
+	std::deque<RetiredSet> retired; //oldest first
+	Stats stats;
+
+	VkDescriptorSet allocate(VkDescriptorSetLayout layout) {
+		auto info = layouts.find(layout);
+		if (info == layouts.end()) {
+			throw std::runtime_error("failed to allocate descriptor set, unknown layout!");
+		}
+
+		Chain& chain = current->chains[layout];
+		for (; ; chain.current++) {
+			if (chain.current == chain.pools.size()) {
+				chain.pools.push_back(createChainPool(info->second, chain.pools.size()));
+			}
+
+			VkDescriptorSetAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+			allocInfo.descriptorPool = chain.pools[chain.current];
+			allocInfo.descriptorSetCount = 1;
+			allocInfo.pSetLayouts = &layout;
+
+			VkDescriptorSet set;
+			VkResult result = vkAllocateDescriptorSets(device, &allocInfo, &set);
+			if (result == VK_SUCCESS) {
+				stats.allocations++;
+				return set;
+			}
+			//a pool sized for its layout only runs out because it is full: move on to the next one
+			if (result != VK_ERROR_OUT_OF_POOL_MEMORY_KHR && result != VK_ERROR_FRAGMENTED_POOL) {
+				throw std::runtime_error("failed to allocate descriptor set!");
+			}
+		}
+	}
+
+	VkDescriptorPool createChainPool(const LayoutInfo& info, size_t index) {
+		uint32_t sets = FIRST_POOL_SETS;
+		for (size_t i = 0; i < index && sets < MAX_POOL_SETS; i++) sets *= 2;
+		return createPool(info, sets);
+	}
+
+	VkDescriptorPool createPool(const LayoutInfo& info, uint32_t sets) {
+		std::vector<VkDescriptorPoolSize> poolSizes;
+		for (const PoolSize& size : info.sizes) {
+			poolSizes.push_back({ size.type, size.perSet * sets });
+		}
+
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+		poolInfo.pPoolSizes = poolSizes.data();
+		poolInfo.maxSets = sets;
+
+		VkDescriptorPool pool;
+		if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create descriptor pool!");
+		}
+		stats.poolsCreated++;
+		return pool;
+	}
+};
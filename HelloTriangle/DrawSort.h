@@ -0,0 +1,222 @@
+#pragma once
+#include "VulkanHelpers.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <ostream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+//DrawKey : the state a draw needs, packed in 64 bits from the most to the least expensive to change. Sorting the keys
+//groups the draws by pipeline, then by material, then by mesh, and within a group orders them front to back.
+struct DrawKey {
+	static const int PIPELINE_BITS = 4;
+	static const int MATERIAL_BITS = 16;
+	static const int MESH_BITS = 16;
+	static const int DEPTH_BITS = 28;
+
+	//depth from 0 (near) to 1 (far), clamped. Quantized in double: in float, 1.0 * (2^28 - 1) rounds up to 2^28 and would
+	//carry into the mesh.
+	static uint64_t pack(uint32_t pipeline, uint32_t material, uint32_t mesh, float depth) {
+		if (pipeline >= (1u << PIPELINE_BITS) || material >= (1u << MATERIAL_BITS) || mesh >= (1u << MESH_BITS)) {
+			throw std::out_of_range("draw key field out of range!");
+		}
+		uint64_t quantized = static_cast<uint64_t>(std::min(std::max(static_cast<double>(depth), 0.0), 1.0) * ((1u << DEPTH_BITS) - 1));
+		return static_cast<uint64_t>(pipeline) << (MATERIAL_BITS + MESH_BITS + DEPTH_BITS) |
+			static_cast<uint64_t>(material) << (MESH_BITS + DEPTH_BITS) |
+			static_cast<uint64_t>(mesh) << DEPTH_BITS |
+			quantized;
+	}
+
+	static uint32_t pipeline(uint64_t key) {
+		return static_cast<uint32_t>(key >> (MATERIAL_BITS + MESH_BITS + DEPTH_BITS));
+	}
+
+	static uint32_t material(uint64_t key) {
+		return static_cast<uint32_t>(key >> (MESH_BITS + DEPTH_BITS)) & ((1u << MATERIAL_BITS) - 1);
+	}
+
+	static uint32_t mesh(uint64_t key) {
+		return static_cast<uint32_t>(key >> DEPTH_BITS) & ((1u << MESH_BITS) - 1);
+	}
+};
+
+//DrawSort : LSD radix sort of the draws by key, 8 bits per pass. One read of the keys builds the histograms of all the
+//passes, and a pass where every key has the same byte (e.g. the pipeline when there is only one) is skipped. Each pass
+//reads one buffer in order and writes into 256 sequential streams of the other. Stable, so equal keys keep the order
+//they were added in.
+class DrawSort {
+public:
+	struct Draw {
+		uint64_t key;
+		uint32_t index; //of the object, or whatever the caller draws
+	};
+
+	//scratch is resized to the size of draws, keep it around to not allocate every frame
+	static void sort(std::vector<Draw>& draws, std::vector<Draw>& scratch) {
+		size_t count = draws.size();
+		if (count < 2) return;
+		scratch.resize(count);
+
+		static const int PASSES = sizeof(uint64_t);
+		std::array<uint32_t, PASSES * 256> histograms = {}; //8 KB, on the stack rather than allocated every frame
+		for (const Draw& draw : draws) {
+			for (int pass = 0; pass < PASSES; pass++) histograms[pass * 256 + ((draw.key >> (pass * 8)) & 0xff)]++;
+		}
+
+		Draw* from = draws.data();
+		Draw* to = scratch.data();
+		for (int pass = 0; pass < PASSES; pass++) {
+			int shift = pass * 8;
+			uint32_t* histogram = &histograms[pass * 256];
+			if (histogram[(from[0].key >> shift) & 0xff] == count) continue;
+
+			uint32_t offset = 0;
+			for (int bucket = 0; bucket < 256; bucket++) {
+				uint32_t size = histogram[bucket];
+				histogram[bucket] = offset;
+				offset += size;
+			}
+			for (size_t i = 0; i < count; i++) {
+				to[histogram[(from[i].key >> shift) & 0xff]++] = from[i];
+			}
+			std::swap(from, to);
+		}
+		if (from != draws.data()) draws.swap(scratch);
+	}
+
+	//--sort-benchmark : time the radix sort against std::stable_sort on count draws with keys like the renderer's, and
+	//check that both give the same order
+	static void benchmark(size_t count, std::ostream& out) {
+		std::mt19937 random(1234);
+		std::uniform_int_distribution<uint32_t> pipeline(0, 3), material(0, 255), mesh(0, 1023);
+		std::uniform_real_distribution<float> depth(0.0f, 1.0f);
+		std::vector<Draw> input(count);
+		for (size_t i = 0; i < count; i++) {
+			input[i] = { DrawKey::pack(pipeline(random), material(random), mesh(random), depth(random)), static_cast<uint32_t>(i) };
+		}
+
+		//enough repetitions for ~10M sorted draws, so that the timings are not noise
+		size_t repeat = std::max<size_t>(1, 10000000 / count);
+		std::vector<Draw> draws, scratch, reference;
+		double radixMs = 0.0, stdMs = 0.0;
+		for (size_t i = 0; i < repeat; i++) {
+			draws = input;
+			auto start = std::chrono::high_resolution_clock::now();
+			sort(draws, scratch);
+			radixMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+			reference = input;
+			start = std::chrono::high_resolution_clock::now();
+			std::stable_sort(reference.begin(), reference.end(), [](const Draw& a, const Draw& b) { return a.key < b.key; });
+			stdMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		}
+		radixMs /= repeat;
+		stdMs /= repeat;
+
+		bool same = std::equal(draws.begin(), draws.end(), reference.begin(),
+			[](const Draw& a, const Draw& b) { return a.key == b.key && a.index == b.index; });
+		out << "radix sort : " << count << " draws in " << radixMs << " ms, " << radixMs * 1e6 / count << " ns each" << std::endl;
+		out << "std::stable_sort : " << count << " draws in " << stdMs << " ms, " << stdMs * 1e6 / count << " ns each" << std::endl;
+		if (!same) {
+			throw std::runtime_error("radix sort order differs from std::stable_sort!");
+		}
+	}
+};
+
+//BindCache : what is bound in a command buffer, so that the draws recorded in key order only bind what changes.
+//Every pipeline the sets are bound with must use layouts compatible with each other.
+class BindCache {
+public:
+	//binds recorded, and skipped because the same thing was already bound
+	struct Stats {
+		uint64_t pipelines = 0;
+		uint64_t descriptorSets = 0;
+		uint64_t vertexBuffers = 0;
+		uint64_t indexBuffers = 0;
+		uint64_t materials = 0;
+		uint64_t skipped = 0;
+
+		Stats& operator+=(const Stats& other) {
+			pipelines += other.pipelines;
+			descriptorSets += other.descriptorSets;
+			vertexBuffers += other.vertexBuffers;
+			indexBuffers += other.indexBuffers;
+			materials += other.materials;
+			skipped += other.skipped;
+			return *this;
+		}
+	};
+
+	static const uint32_t MAX_SETS = 4;
+
+	//nothing is bound at the start of a command buffer
+	void reset() {
+		pipeline = VK_NULL_HANDLE;
+		std::fill(sets, sets + MAX_SETS, static_cast<VkDescriptorSet>(VK_NULL_HANDLE));
+		vertexBuffer = VK_NULL_HANDLE;
+		indexBuffer = VK_NULL_HANDLE;
+		material = UINT32_MAX;
+	}
+
+	void bindPipeline(VkCommandBuffer commandBuffer, VkPipeline newPipeline) {
+		if (skip(pipeline == newPipeline)) return;
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, newPipeline);
+		pipeline = newPipeline;
+		stats.pipelines++;
+	}
+
+	void bindDescriptorSet(VkCommandBuffer commandBuffer, VkPipelineLayout layout, uint32_t index, VkDescriptorSet set) {
+		if (skip(sets[index] == set)) return;
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, index, 1, &set, 0, nullptr);
+		sets[index] = set;
+		stats.descriptorSets++;
+	}
+
+	void bindVertexBuffer(VkCommandBuffer commandBuffer, VkBuffer buffer) {
+		if (skip(vertexBuffer == buffer)) return;
+		VkDeviceSize offset = 0;
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &buffer, &offset);
+		vertexBuffer = buffer;
+		stats.vertexBuffers++;
+	}
+
+	void bindIndexBuffer(VkCommandBuffer commandBuffer, VkBuffer buffer, VkIndexType type) {
+		if (skip(indexBuffer == buffer && indexType == type)) return;
+		vkCmdBindIndexBuffer(commandBuffer, buffer, 0, type);
+		indexBuffer = buffer;
+		indexType = type;
+		stats.indexBuffers++;
+	}
+
+	//true when the material changes, and the caller has to record whatever selects it
+	bool changeMaterial(uint32_t newMaterial) {
+		if (skip(material == newMaterial)) return false;
+		material = newMaterial;
+		stats.materials++;
+		return true;
+	}
+
+	//since the last call
+	Stats takeStats() {
+		Stats taken = stats;
+		stats = Stats();
+		return taken;
+	}
+
+private:
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkDescriptorSet sets[MAX_SETS] = {};
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+	uint32_t material = UINT32_MAX;
+	Stats stats;
+
+	bool skip(bool bound) {
+		if (bound) stats.skipped++;
+		return bound;
+	}
+};
@@ -0,0 +1,146 @@
+#pragma once
+#include "GpuTimeline.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//FrameLimiter : caps the frame rate by starting each frame just in time rather than sleeping after it. The frame is
+//expected to take about as long as the recent ones did, so it starts that long (plus a margin) before its deadline:
+//the input it samples first thing is as fresh as it can be when the frame is done, instead of one period old.
+class FrameLimiter {
+public:
+	typedef std::chrono::high_resolution_clock Clock;
+
+	//frames per second, 0 for no limit
+	void setRate(uint32_t fps) {
+		period = fps == 0 ? Clock::duration::zero() : std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps));
+		deadline = Clock::time_point();
+	}
+
+	bool enabled() const {
+		return period != Clock::duration::zero();
+	}
+
+	//sleeps until the next frame has to start to be done by its deadline, returns the ms slept
+	double wait() {
+		if (!enabled()) return 0.0;
+		Clock::time_point now = Clock::now();
+		if (deadline == Clock::time_point()) deadline = now + period;
+
+		Clock::time_point start = deadline - workEstimate - safetyMargin;
+		if (start > now) {
+			//the OS wakes sleeping threads late by up to a scheduler tick, so sleep short of the start and spin the rest
+			if (start - spinTime > now) std::this_thread::sleep_until(start - spinTime);
+			while (Clock::now() < start) std::this_thread::yield();
+		}
+		frameStart = Clock::now();
+		return std::chrono::duration<double, std::milli>(frameStart - now).count();
+	}
+
+	//the frame is submitted : learn how long frames take, and move on to the deadline of the next one
+	void endFrame() {
+		if (!enabled()) return;
+		Clock::time_point now = Clock::now();
+		Clock::duration work = now - frameStart;
+		//up at once, so that a slower frame doesn't miss its deadline twice, down slowly, so that one fast frame doesn't
+		//make the next ones start too late
+		workEstimate = work > workEstimate ? work : workEstimate + (work - workEstimate) / 20;
+
+		deadline += period;
+		if (deadline < now) deadline = now + period; //late: keep the rate rather than catch up with a burst of frames
+	}
+
+private:
+	const Clock::duration safetyMargin = std::chrono::microseconds(500);
+	const Clock::duration spinTime = std::chrono::milliseconds(2);
+
+	Clock::duration period = Clock::duration::zero();
+	Clock::duration workEstimate = Clock::duration::zero();
+	Clock::time_point deadline; //when the current frame should be done
+	Clock::time_point frameStart;
+};
+
+//InputLatency : time from the input sampled for a frame to the GPU being done with it, when the frame can be presented.
+//A thread waits on the timeline value of each tracked frame, so unlike GpuTimeline::trackLatency the completion is seen
+//when it happens rather than whenever the render loop next queries it. The display adds up to one refresh on top of
+//this when it waits for vblank (vsync, mailbox), and the scanout of the image.
+class InputLatency {
+public:
+	struct Sample {
+		uint64_t frameNumber;
+		float ms;
+	};
+
+	InputLatency(const GpuTimeline& timeline) : timeline(timeline) {}
+
+	~InputLatency() {
+		stop();
+	}
+
+	//the frame that sampled its input at inputTime is done once the timeline reaches value
+	void track(uint64_t frameNumber, uint64_t value, FrameLimiter::Clock::time_point inputTime) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!worker.joinable()) worker = std::thread(&InputLatency::run, this);
+		pending.push_back({ frameNumber, value, inputTime });
+		wakeUp.notify_one();
+	}
+
+	//the samples measured since the last call
+	std::vector<Sample> take() {
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<Sample> taken;
+		taken.swap(samples);
+		return taken;
+	}
+
+	//measures the pending frames the GPU is done with, drops the others. Must be called before the timeline is destroyed.
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			wakeUp.notify_one();
+		}
+		if (worker.joinable()) worker.join();
+	}
+
+private:
+	struct TrackedFrame {
+		uint64_t frameNumber;
+		uint64_t value;
+		FrameLimiter::Clock::time_point inputTime;
+	};
+
+	static const uint64_t WAIT_TIMEOUT_NS = 100 * 1000 * 1000; //how often a wait checks whether to stop
+
+	void run() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			wakeUp.wait(lock, [this]() { return stopping || !pending.empty(); });
+			if (pending.empty()) return;
+			TrackedFrame frame = pending.front();
+			pending.pop_front();
+
+			lock.unlock();
+			bool done;
+			do done = timeline.waitFor(frame.value, WAIT_TIMEOUT_NS); while (!done && !stopping);
+			FrameLimiter::Clock::time_point now = FrameLimiter::Clock::now();
+			lock.lock();
+
+			if (done) samples.push_back({ frame.frameNumber, std::chrono::duration<float, std::milli>(now - frame.inputTime).count() });
+		}
+	}
+
+	const GpuTimeline& timeline;
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	std::deque<TrackedFrame> pending;
+	std::vector<Sample> samples;
+	std::atomic<bool> stopping{ false };
+};
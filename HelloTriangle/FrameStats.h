@@ -0,0 +1,218 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//FrameStats : CPU timings of every frame, cheap enough to always stay on.
+//The render loop is the only writer. Records go into a fixed ring buffer of seqlocked slots published through an atomic
+//counter, so a reader (the periodic report, or another thread) takes a snapshot without ever blocking the frame.
+class FrameStats {
+	typedef std::chrono::high_resolution_clock Clock;
+
+public:
+	enum Phase { Acquire, Update, Submit, Present, NumberOfPhases };
+
+	static const size_t CAPACITY = 4096; //frames kept, about a minute at 60 fps
+	static const int HISTOGRAM_BUCKETS = 50; //1 ms wide, the last one collects everything slower
+
+	struct FrameRecord {
+		uint64_t frameNumber;
+		float phaseMs[NumberOfPhases];
+		float frameMs; //start of this frame to start of the next
+		bool hitch;
+	};
+
+	//a frame is a hitch when it takes hitchFactor times longer than the recent average
+	FrameStats(float hitchFactor = 2.0f) : hitchFactor(hitchFactor) {}
+
+	void beginFrame() {
+		auto now = Clock::now();
+		if (frameStarted) {
+			current.frameMs = std::chrono::duration<float, std::milli>(now - frameStart).count();
+			publish();
+		}
+		frameStarted = true;
+		frameStart = now;
+		current = {};
+		current.frameNumber = frameCount++;
+	}
+
+	//ScopedPhase : adds the time spent in the enclosing block to a phase of the current frame
+	class ScopedPhase {
+	public:
+		ScopedPhase(FrameStats& stats, Phase phase) : stats(stats), phase(phase), start(Clock::now()) {}
+		~ScopedPhase() {
+			stats.current.phaseMs[phase] += std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+		}
+	private:
+		FrameStats& stats;
+		Phase phase;
+		Clock::time_point start;
+	};
+
+	//copy of the recorded frames, oldest first. Safe to call from any thread.
+	std::vector<FrameRecord> snapshot() const {
+		uint64_t end = written.load(std::memory_order_acquire);
+		uint64_t begin = end > CAPACITY ? end - CAPACITY : 0;
+
+		std::vector<FrameRecord> frames;
+		frames.reserve(static_cast<size_t>(end - begin));
+		for (uint64_t i = begin; i < end; i++) {
+			//the writer may be lapping the entries while we copy them: a copy only counts when its slot held frame i from
+			//before to after it. When it didn't, the frames copied so far are older still, drop them too to stay contiguous.
+			const Slot& slot = records[i % CAPACITY];
+			uint64_t expected = 2 * (i + 1);
+			uint64_t words[RECORD_WORDS];
+			bool valid = slot.sequence.load(std::memory_order_acquire) == expected;
+			for (size_t word = 0; valid && word < RECORD_WORDS; word++) words[word] = slot.words[word].load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (!valid || slot.sequence.load(std::memory_order_relaxed) != expected) {
+				frames.clear();
+				continue;
+			}
+
+			FrameRecord frame;
+			memcpy(&frame, words, sizeof(frame));
+			frames.push_back(frame);
+		}
+		return frames;
+	}
+
+	struct Percentiles {
+		float p50 = 0.0f;
+		float p95 = 0.0f;
+		float p99 = 0.0f;
+	};
+
+	//phase == NumberOfPhases stands for the whole frame
+	static Percentiles percentiles(const std::vector<FrameRecord>& frames, int phase) {
+		std::vector<float> values;
+		values.reserve(frames.size());
+		for (const FrameRecord& frame : frames) {
+			values.push_back(phase == NumberOfPhases ? frame.frameMs : frame.phaseMs[phase]);
+		}
+		return percentiles(std::move(values));
+	}
+
+	static Percentiles percentiles(std::vector<float> values) {
+		Percentiles result;
+		if (values.empty()) return result;
+
+		std::sort(values.begin(), values.end());
+		auto at = [&values](size_t percent) { return values[std::min(values.size() - 1, values.size() * percent / 100)]; };
+		result.p50 = at(50);
+		result.p95 = at(95);
+		result.p99 = at(99);
+		return result;
+	}
+
+	static std::array<uint32_t, HISTOGRAM_BUCKETS> histogram(const std::vector<FrameRecord>& frames) {
+		std::array<uint32_t, HISTOGRAM_BUCKETS> buckets = {};
+		for (const FrameRecord& frame : frames) {
+			int bucket = std::min(static_cast<int>(frame.frameMs), HISTOGRAM_BUCKETS - 1);
+			buckets[std::max(bucket, 0)]++;
+		}
+		return buckets;
+	}
+
+	//frame time and per phase percentiles of the frames recorded since the previous report
+	void report(std::ostream& out) {
+		std::vector<FrameRecord> frames = snapshot();
+		frames.erase(std::remove_if(frames.begin(), frames.end(),
+			[this](const FrameRecord& frame) { return frame.frameNumber < reportedFrames; }), frames.end());
+		if (frames.empty()) return;
+		reportedFrames = frames.back().frameNumber + 1;
+
+		static const char* names[] = { "acquire", "update", "submit", "present", "frame" };
+		for (int phase = 0; phase <= NumberOfPhases; phase++) {
+			Percentiles p = percentiles(frames, phase);
+			out << "  " << names[phase] << " : p50 " << p.p50 << " ms, p95 " << p.p95 << " ms, p99 " << p.p99 << " ms" << std::endl;
+		}
+
+		size_t hitches = std::count_if(frames.begin(), frames.end(), [](const FrameRecord& frame) { return frame.hitch; });
+		if (hitches > 0) {
+			out << "  " << hitches << " hitches in " << frames.size() << " frames" << std::endl;
+		}
+	}
+
+	void writeHistogram(std::ostream& out) const {
+		std::array<uint32_t, HISTOGRAM_BUCKETS> buckets = histogram(snapshot());
+		out << "frame_ms,count" << std::endl;
+		for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+			out << i << (i == HISTOGRAM_BUCKETS - 1 ? "+" : "") << "," << buckets[i] << std::endl;
+		}
+	}
+
+	void writeCsv(const std::string& path) const {
+		std::ofstream file(path);
+		if (!file.is_open()) {
+			throw std::runtime_error("failed to open " + path + "!");
+		}
+
+		file << "frame,acquire_ms,update_ms,submit_ms,present_ms,frame_ms,hitch" << std::endl;
+		for (const FrameRecord& frame : snapshot()) {
+			file << frame.frameNumber;
+			for (int phase = 0; phase < NumberOfPhases; phase++) {
+				file << "," << frame.phaseMs[phase];
+			}
+			file << "," << frame.frameMs << "," << (frame.hitch ? 1 : 0) << std::endl;
+		}
+	}
+
+	uint64_t hitchCount() const {
+		return hitches;
+	}
+
+private:
+	void publish() {
+		//exponential moving average of the frame time. A hitch only counts for hitchFactor times the average: a single one
+		//barely moves it, but after a lasting step in frame time (a resize, a heavier scene) it catches up in a few dozen
+		//frames, and the new frame time stops counting as hitches.
+		if (averageFrameMs > 0.0f && current.frameMs > hitchFactor * averageFrameMs) {
+			current.hitch = true;
+			hitches++;
+		}
+		float contribution = averageFrameMs > 0.0f ? std::min(current.frameMs, hitchFactor * averageFrameMs) : current.frameMs;
+		averageFrameMs = averageFrameMs > 0.0f ? averageFrameMs * 0.95f + contribution * 0.05f : contribution;
+
+		//seqlock: the sequence of the slot is odd while it is written, 2 * (index + 1) once it holds frame index
+		uint64_t index = written.load(std::memory_order_relaxed);
+		Slot& slot = records[index % CAPACITY];
+		uint64_t words[RECORD_WORDS] = {};
+		memcpy(words, &current, sizeof(current));
+		slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for (size_t word = 0; word < RECORD_WORDS; word++) slot.words[word].store(words[word], std::memory_order_relaxed);
+		slot.sequence.store(2 * (index + 1), std::memory_order_release);
+		written.store(index + 1, std::memory_order_release);
+	}
+
+	//a FrameRecord as atomic words, so that a reader racing with the writer reads a stale or torn copy, and not undefined
+	//behaviour, which the sequence then tells it to drop
+	static const size_t RECORD_WORDS = (sizeof(FrameRecord) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+	struct Slot {
+		std::atomic<uint64_t> sequence{ 0 };
+		std::atomic<uint64_t> words[RECORD_WORDS];
+	};
+
+	float hitchFactor;
+	float averageFrameMs = 0.0f;
+	uint64_t hitches = 0;
+
+	bool frameStarted = false;
+	Clock::time_point frameStart;
+	FrameRecord current = {};
+	uint64_t frameCount = 0;
+	uint64_t reportedFrames = 0;
+
+	std::array<Slot, CAPACITY> records;
+	std::atomic<uint64_t> written{ 0 };
+};
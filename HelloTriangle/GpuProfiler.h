@@ -0,0 +1,222 @@
+#pragma once
+#include "VulkanHelpers.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+//GpuProfiler : timestamp queries around the scopes of a frame, plus CPU scopes on the same time line.
+//Each frame in flight owns a range of the query pool. Its results are read back when the slot comes around again,
+//when the frame that wrote them is known to be complete, so reading them never stalls.
+//Only the frame's command buffer on the graphics queue is timed: uploads submitted to the transfer queue are not.
+class GpuProfiler {
+public:
+	static const uint32_t MAX_SCOPES_PER_FRAME = 16;
+	static const size_t MAX_SAMPLES = 512; //per scope, for the percentiles
+	static const size_t MAX_TRACE_EVENTS = 200000; //~ a few minutes of frames, recording stops afterwards
+
+	GpuProfiler(const VDeleter<VkDevice>& device) : device(device), queryPool{ device, vkDestroyQueryPool } {
+		startTime = std::chrono::high_resolution_clock::now();
+	}
+
+	//nothing is recorded, not even the CPU scopes, until create is called
+	void create(VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t framesInFlight) {
+		enabled = true;
+
+		uint32_t queueFamilyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+		uint32_t validBits = queueFamilies[queueFamily].timestampValidBits;
+		if (validBits == 0) return; //no timestamps on this queue: only the CPU scopes are recorded
+		timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		timestampPeriod = properties.limits.timestampPeriod;
+
+		VkQueryPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		poolInfo.queryCount = framesInFlight * MAX_SCOPES_PER_FRAME * 2;
+
+		if (vkCreateQueryPool(device, &poolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create timestamp query pool!");
+		}
+		frames.resize(framesInFlight);
+	}
+
+	bool gpuTimingSupported() const {
+		return !frames.empty();
+	}
+
+	//read back what the previous frame of this slot measured. The caller guarantees that frame has completed.
+	void resolveFrame(size_t slot) {
+		if (!gpuTimingSupported()) return;
+		FrameQueries& frame = frames[slot];
+		if (frame.scopes.empty()) return;
+
+		uint32_t queryCount = static_cast<uint32_t>(frame.scopes.size()) * 2;
+		std::vector<uint64_t> timestamps(queryCount);
+		VkResult result = vkGetQueryPoolResults(device, queryPool, firstQuery(slot), queryCount,
+			timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+		if (result == VK_SUCCESS) {
+			//GPU and CPU clocks are not calibrated against each other: the first timestamp of the frame is put at its submit time
+			//differences are masked too, the counter may wrap around within the frame
+			uint64_t origin = timestamps[0];
+			for (size_t i = 0; i < frame.scopes.size(); i++) {
+				uint64_t begin = timestamps[2 * i];
+				uint64_t end = timestamps[2 * i + 1];
+				double startUs = frame.submitTimeUs + ticksToUs((begin - origin) & timestampMask);
+				addSample(frame.scopes[i], GpuTrack, startUs, ticksToUs((end - begin) & timestampMask));
+			}
+		}
+		frame.scopes.clear();
+	}
+
+	//must be recorded before any scope of the frame
+	void beginFrame(VkCommandBuffer commandBuffer, size_t slot) {
+		currentSlot = slot;
+		if (!gpuTimingSupported()) return;
+		frames[slot].scopes.clear();
+		vkCmdResetQueryPool(commandBuffer, queryPool, firstQuery(slot), MAX_SCOPES_PER_FRAME * 2);
+	}
+
+	//returns the scope to pass to endGpuScope, or UINT32_MAX when the scope is not measured
+	uint32_t beginGpuScope(VkCommandBuffer commandBuffer, const char* name) {
+		if (!gpuTimingSupported()) return UINT32_MAX;
+		FrameQueries& frame = frames[currentSlot];
+		if (frame.scopes.size() >= MAX_SCOPES_PER_FRAME) return UINT32_MAX;
+
+		uint32_t scope = static_cast<uint32_t>(frame.scopes.size());
+		frame.scopes.push_back(name);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, firstQuery(currentSlot) + 2 * scope);
+		return scope;
+	}
+
+	void endGpuScope(VkCommandBuffer commandBuffer, uint32_t scope) {
+		if (scope == UINT32_MAX) return;
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, firstQuery(currentSlot) + 2 * scope + 1);
+	}
+
+	//call right after submitting the frame's command buffer
+	void markSubmit() {
+		if (!gpuTimingSupported()) return;
+		frames[currentSlot].submitTimeUs = nowUs();
+	}
+
+	//CpuScope : measures the enclosing block on the CPU track
+	class CpuScope {
+	public:
+		CpuScope(GpuProfiler& profiler, const char* name) : profiler(profiler), name(name), startUs(profiler.nowUs()) {}
+		~CpuScope() {
+			profiler.addSample(name, CpuTrack, startUs, profiler.nowUs() - startUs);
+		}
+	private:
+		GpuProfiler& profiler;
+		const char* name;
+		double startUs;
+	};
+
+	//min/avg/p99 of every scope over its last MAX_SAMPLES samples, in milliseconds
+	void report(std::ostream& out) const {
+		for (auto& entry : scopes) {
+			const ScopeStats& stats = entry.second;
+			if (stats.samples.empty()) continue;
+
+			std::vector<double> sorted = stats.samples;
+			std::sort(sorted.begin(), sorted.end());
+			double sum = 0.0;
+			for (double sample : sorted) sum += sample;
+			size_t p99 = std::min(sorted.size() - 1, (sorted.size() * 99) / 100);
+
+			out << "  " << (entry.first.first == GpuTrack ? "gpu " : "cpu ") << entry.first.second
+				<< " : min " << sorted.front() / 1000.0 << " ms"
+				<< ", avg " << sum / sorted.size() / 1000.0 << " ms"
+				<< ", p99 " << sorted[p99] / 1000.0 << " ms" << std::endl;
+		}
+		if (gpuTimingSupported()) out << "  (gpu : the frame's command buffer only, transfer queue uploads are not timed)" << std::endl;
+	}
+
+	//everything recorded so far, in the Chrome trace event format (chrome://tracing, ui.perfetto.dev)
+	void writeChromeTrace(const std::string& path) const {
+		std::ofstream file(path);
+		if (!file.is_open()) {
+			throw std::runtime_error("failed to open " + path + "!");
+		}
+
+		file << "{\"traceEvents\":[" << std::endl;
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << CpuTrack << ",\"args\":{\"name\":\"CPU\"}}," << std::endl;
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << GpuTrack << ",\"args\":{\"name\":\"GPU (graphics queue, transfer uploads not timed)\"}}";
+		for (const TraceEvent& event : traceEvents) {
+			file << "," << std::endl << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.track
+				<< ",\"ts\":" << event.startUs << ",\"dur\":" << event.durationUs << "}";
+		}
+		file << std::endl << "]}" << std::endl;
+	}
+
+private:
+	enum Track { CpuTrack = 0, GpuTrack = 1 };
+
+	struct FrameQueries {
+		std::vector<const char*> scopes; //names of the scopes recorded in the frame, in query order
+		double submitTimeUs = 0.0;
+	};
+
+	struct ScopeStats {
+		std::vector<double> samples; //ring buffer of durations in microseconds
+		size_t next = 0;
+	};
+
+	struct TraceEvent {
+		const char* name;
+		Track track;
+		double startUs;
+		double durationUs;
+	};
+
+	uint32_t firstQuery(size_t slot) const {
+		return static_cast<uint32_t>(slot) * MAX_SCOPES_PER_FRAME * 2;
+	}
+
+	double ticksToUs(uint64_t ticks) const {
+		return ticks * static_cast<double>(timestampPeriod) / 1000.0; //timestampPeriod is in ns per tick
+	}
+
+	double nowUs() const {
+		return std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - startTime).count();
+	}
+
+	void addSample(const char* name, Track track, double startUs, double durationUs) {
+		if (!enabled) return;
+		ScopeStats& stats = scopes[std::make_pair(track, std::string(name))];
+		if (stats.samples.size() < MAX_SAMPLES) {
+			stats.samples.push_back(durationUs);
+		}
+		else {
+			stats.samples[stats.next] = durationUs;
+			stats.next = (stats.next + 1) % MAX_SAMPLES;
+		}
+
+		if (traceEvents.size() < MAX_TRACE_EVENTS) {
+			traceEvents.push_back({ name, track, startUs, durationUs });
+		}
+	}
+
+	const VDeleter<VkDevice>& device;
+	bool enabled = false;
+	VDeleter<VkQueryPool> queryPool;
+	float timestampPeriod = 1.0f;
+	uint64_t timestampMask = ~0ull;
+	std::vector<FrameQueries> frames;
+	size_t currentSlot = 0;
+
+	std::chrono::high_resolution_clock::time_point startTime;
+	std::map<std::pair<Track, std::string>, ScopeStats> scopes;
+	std::vector<TraceEvent> traceEvents; //scope names must be string literals, only the pointer is kept
+};
@@ -0,0 +1,213 @@
+#pragma once
+#include "VulkanHelpers.h"
+
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+
+//GpuTimeline : wrapper around a VK_KHR_timeline_semaphore whose value only ever increases.
+//Every submission that signals it gets the next value, so "how far the GPU got" is a single uint64_t
+//that the CPU can query without fences, and that other submissions can wait on.
+class GpuTimeline {
+public:
+	GpuTimeline(const VDeleter<VkDevice>& device) : device(device), semaphore{ device, vkDestroySemaphore } {}
+
+	void create() {
+		VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+		typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+		typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+		typeInfo.initialValue = 0;
+
+		VkSemaphoreCreateInfo semaphoreInfo = {};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphoreInfo.pNext = &typeInfo;
+
+		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create timeline semaphore!");
+		}
+
+		//extension entry points are not exported by the loader, and looking them up on every query would not be cheap
+		getCounterValue = (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR");
+		waitSemaphores = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR");
+		if (getCounterValue == nullptr || waitSemaphores == nullptr) {
+			throw std::runtime_error("failed to load VK_KHR_timeline_semaphore functions!");
+		}
+	}
+
+	operator VkSemaphore() const {
+		return semaphore;
+	}
+
+	//reserve the value the next submission will signal
+	uint64_t nextValue() {
+		return ++signaledValue;
+	}
+
+	//value of the last submission made so far. Anything in use right now is done once the GPU reaches it.
+	uint64_t lastSignaledValue() const {
+		return signaledValue;
+	}
+
+	uint64_t completedValue() {
+		if (completed < signaledValue) {
+			uint64_t value = completed;
+			getCounterValue(device, semaphore, &value);
+			onCompleted(value);
+		}
+		return completed;
+	}
+
+	bool isComplete(uint64_t value) {
+		return value <= completed || value <= completedValue();
+	}
+
+	//block the CPU until the GPU reaches value
+	void wait(uint64_t value) {
+		if (isComplete(value)) return;
+
+		VkSemaphore semaphores[] = { semaphore };
+		VkSemaphoreWaitInfoKHR waitInfo = {};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = semaphores;
+		waitInfo.pValues = &value;
+
+		if (waitSemaphores(device, &waitInfo, std::numeric_limits<uint64_t>::max()) != VK_SUCCESS) {
+			throw std::runtime_error("failed to wait for timeline semaphore!");
+		}
+		onCompleted(value);
+	}
+
+	//blocks until the GPU reaches value or timeoutNs have passed, true when it was reached. Touches none of the state of
+	//the timeline, so another thread than the one submitting may call it.
+	bool waitFor(uint64_t value, uint64_t timeoutNs) const {
+		VkSemaphore semaphores[] = { semaphore };
+		VkSemaphoreWaitInfoKHR waitInfo = {};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = semaphores;
+		waitInfo.pValues = &value;
+
+		VkResult result = waitSemaphores(device, &waitInfo, timeoutNs);
+		if (result != VK_SUCCESS && result != VK_TIMEOUT) {
+			throw std::runtime_error("failed to wait for timeline semaphore!");
+		}
+		return result == VK_SUCCESS;
+	}
+
+	//latency instrumentation: remember when a frame was submitted, and measure how long the GPU took to get past it
+	void trackLatency(uint64_t value) {
+		trackedSubmits.push_back({ value, std::chrono::high_resolution_clock::now() });
+	}
+
+	double lastLatencyMs() const { return lastLatency; }
+	double maxLatencyMs() const { return maxLatency; }
+	double averageLatencyMs() const { return latencySamples ? latencySum / latencySamples : 0.0; }
+
+	void resetLatencyStats() {
+		maxLatency = 0.0;
+		latencySum = 0.0;
+		latencySamples = 0;
+	}
+
+private:
+	struct TrackedSubmit {
+		uint64_t value;
+		std::chrono::high_resolution_clock::time_point submitTime;
+	};
+
+	void onCompleted(uint64_t value) {
+		if (value <= completed) return;
+		completed = value;
+
+		//completion is only observed when we query or wait, so these latencies are upper bounds
+		auto now = std::chrono::high_resolution_clock::now();
+		while (!trackedSubmits.empty() && trackedSubmits.front().value <= completed) {
+			lastLatency = std::chrono::duration<double, std::milli>(now - trackedSubmits.front().submitTime).count();
+			maxLatency = std::max(maxLatency, lastLatency);
+			latencySum += lastLatency;
+			latencySamples++;
+			trackedSubmits.pop_front();
+		}
+	}
+
+	const VDeleter<VkDevice>& device;
+	VDeleter<VkSemaphore> semaphore;
+	PFN_vkGetSemaphoreCounterValueKHR getCounterValue = nullptr;
+	PFN_vkWaitSemaphoresKHR waitSemaphores = nullptr;
+
+	uint64_t signaledValue = 0;
+	uint64_t completed = 0;
+
+	std::deque<TrackedSubmit> trackedSubmits;
+	double lastLatency = 0.0;
+	double maxLatency = 0.0;
+	double latencySum = 0.0;
+	uint64_t latencySamples = 0;
+};
+
+//SubmitBatch : gathers everything a single vkQueueSubmit waits on and signals.
+//Binary semaphores (swap chain) and timeline values can be mixed, the binary ones simply get a dummy value.
+class SubmitBatch {
+public:
+	void addCommandBuffer(VkCommandBuffer commandBuffer) {
+		commandBuffers.push_back(commandBuffer);
+	}
+
+	void waitBinary(VkSemaphore semaphore, VkPipelineStageFlags stage) {
+		waitSemaphores.push_back(semaphore);
+		waitValues.push_back(0);
+		waitStages.push_back(stage);
+	}
+
+	void wait(GpuTimeline& timeline, uint64_t value, VkPipelineStageFlags stage) {
+		//a value the CPU already saw complete is still waited on: the semaphore wait is what makes the writes visible to this queue
+		if (value == 0) return; //nothing to wait for
+		waitSemaphores.push_back(timeline);
+		waitValues.push_back(value);
+		waitStages.push_back(stage);
+	}
+
+	void signalBinary(VkSemaphore semaphore) {
+		signalSemaphores.push_back(semaphore);
+		signalValues.push_back(0);
+	}
+
+	//submit the batch, signaling the next value of the timeline. Returns that value.
+	uint64_t submit(VkQueue queue, GpuTimeline& timeline) {
+		uint64_t value = timeline.nextValue();
+		signalSemaphores.push_back(timeline);
+		signalValues.push_back(value);
+
+		VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+		timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+		timelineInfo.pWaitSemaphoreValues = waitValues.data();
+		timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+		timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = &timelineInfo;
+		submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+		submitInfo.pWaitSemaphores = waitSemaphores.data();
+		submitInfo.pWaitDstStageMask = waitStages.data();
+		submitInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+		submitInfo.pCommandBuffers = commandBuffers.data();
+		submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+		submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+		if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+			throw std::runtime_error("failed to submit command buffer!");
+		}
+		return value;
+	}
+
+private:
+	std::vector<VkCommandBuffer> commandBuffers;
+	std::vector<VkSemaphore> waitSemaphores;
+	std::vector<uint64_t> waitValues;
+	std::vector<VkPipelineStageFlags> waitStages;
+	std::vector<VkSemaphore> signalSemaphores;
+	std::vector<uint64_t> signalValues;
+};
@@ -0,0 +1,181 @@
+#pragma once
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ostream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+//SSE is always there on x64, AVX only when the compiler may use it (/arch:AVX, -mavx)
+#if defined(__AVX__)
+#include <immintrin.h>
+#define MATRIX_BATCH_AVX
+#define MATRIX_BATCH_SSE
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define MATRIX_BATCH_SSE
+#endif
+
+//MatrixBatch : out[i] = left * right[i] for many 4x4 matrices at once, e.g. the view-projection times every object's model.
+//The SIMD kernels keep left in registers and compute each column of the result as a linear combination of its
+//columns, glm's column-major layout being what they load and store directly.
+class MatrixBatch {
+public:
+	enum Kernel {
+		Scalar, //glm
+		Sse,
+		Avx //two columns per instruction
+	};
+
+	static const char* kernelName(Kernel kernel) {
+		switch (kernel) {
+		case Sse: return "sse";
+		case Avx: return "avx";
+		default: return "scalar";
+		}
+	}
+
+	static bool kernelAvailable(Kernel kernel) {
+		switch (kernel) {
+#ifdef MATRIX_BATCH_SSE
+		case Sse: return true;
+#endif
+#ifdef MATRIX_BATCH_AVX
+		case Avx: return true;
+#endif
+		case Scalar: return true;
+		default: return false;
+		}
+	}
+
+	static Kernel bestKernel() {
+		return kernelAvailable(Avx) ? Avx : kernelAvailable(Sse) ? Sse : Scalar;
+	}
+
+	static void multiply(const glm::mat4& left, const glm::mat4* right, glm::mat4* out, size_t count, Kernel kernel = bestKernel()) {
+		switch (kernel) {
+#ifdef MATRIX_BATCH_AVX
+		case Avx: multiplyAvx(left, right, out, count); return;
+#endif
+#ifdef MATRIX_BATCH_SSE
+		case Sse: multiplySse(left, right, out, count); return;
+#endif
+		default:
+			for (size_t i = 0; i < count; i++) out[i] = left * right[i];
+		}
+	}
+
+	//--matrix-benchmark : time every kernel on count random matrices, and check them against a double precision reference
+	static void benchmark(size_t count, std::ostream& out) {
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> value(-10.0f, 10.0f);
+		auto randomMatrix = [&]() {
+			glm::mat4 m;
+			for (int c = 0; c < 4; c++) for (int r = 0; r < 4; r++) m[c][r] = value(random);
+			return m;
+		};
+		glm::mat4 left = randomMatrix();
+		std::vector<glm::mat4> right(count), result(count);
+		for (glm::mat4& m : right) m = randomMatrix();
+
+		//enough repetitions for ~100M multiplies, so that the timings are not noise
+		size_t repeat = std::max<size_t>(1, 100000000 / (count * 64));
+		bool accurate = true;
+		for (Kernel kernel : { Scalar, Sse, Avx }) {
+			if (!kernelAvailable(kernel)) continue;
+
+			auto start = std::chrono::high_resolution_clock::now();
+			for (size_t i = 0; i < repeat; i++) {
+				multiply(left, right.data(), result.data(), count, kernel);
+			}
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / repeat;
+
+			double error = maxRelativeError(left, right, result);
+			bool ok = error < MAX_RELATIVE_ERROR;
+			accurate = accurate && ok;
+			out << kernelName(kernel) << " : " << count << " matrices in " << ms << " ms, " << ms * 1e6 / count << " ns each, "
+				<< "max relative error " << error << (ok ? "" : " (too large)") << std::endl;
+		}
+		if (!accurate) {
+			throw std::runtime_error("matrix batch kernels are not accurate enough!");
+		}
+	}
+
+private:
+	static constexpr double MAX_RELATIVE_ERROR = 1e-5;
+
+	//largest error of an element, relative to the largest element of the reference product, so that cancellations do not count
+	static double maxRelativeError(const glm::mat4& left, const std::vector<glm::mat4>& right, const std::vector<glm::mat4>& result) {
+		double error = 0.0;
+		for (size_t i = 0; i < right.size(); i++) {
+			double reference[4][4] = {};
+			double scale = 0.0;
+			for (int c = 0; c < 4; c++) for (int r = 0; r < 4; r++) {
+				for (int k = 0; k < 4; k++) reference[c][r] += double(left[k][r]) * double(right[i][c][k]);
+				scale = std::max(scale, std::abs(reference[c][r]));
+			}
+			for (int c = 0; c < 4; c++) for (int r = 0; r < 4; r++) {
+				error = std::max(error, std::abs(result[i][c][r] - reference[c][r]) / std::max(scale, 1e-30));
+			}
+		}
+		return error;
+	}
+
+#ifdef MATRIX_BATCH_SSE
+	static void multiplySse(const glm::mat4& left, const glm::mat4* right, glm::mat4* out, size_t count) {
+		const float* l = glm::value_ptr(left);
+		__m128 l0 = _mm_loadu_ps(l);
+		__m128 l1 = _mm_loadu_ps(l + 4);
+		__m128 l2 = _mm_loadu_ps(l + 8);
+		__m128 l3 = _mm_loadu_ps(l + 12);
+		for (size_t i = 0; i < count; i++) {
+			const float* in = glm::value_ptr(right[i]);
+			float* o = glm::value_ptr(out[i]);
+			for (int c = 0; c < 4; c++) {
+				__m128 column = _mm_loadu_ps(in + 4 * c);
+				__m128 r = _mm_mul_ps(l0, _mm_shuffle_ps(column, column, _MM_SHUFFLE(0, 0, 0, 0)));
+				r = _mm_add_ps(r, _mm_mul_ps(l1, _mm_shuffle_ps(column, column, _MM_SHUFFLE(1, 1, 1, 1))));
+				r = _mm_add_ps(r, _mm_mul_ps(l2, _mm_shuffle_ps(column, column, _MM_SHUFFLE(2, 2, 2, 2))));
+				r = _mm_add_ps(r, _mm_mul_ps(l3, _mm_shuffle_ps(column, column, _MM_SHUFFLE(3, 3, 3, 3))));
+				_mm_storeu_ps(o + 4 * c, r);
+			}
+		}
+	}
+#endif
+
+#ifdef MATRIX_BATCH_AVX
+	//left's columns in both 128 bit lanes, and two columns of right[i] per register: the in-lane permute broadcasts
+	//element k of each column to its lane
+	static void multiplyAvx(const glm::mat4& left, const glm::mat4* right, glm::mat4* out, size_t count) {
+		const float* l = glm::value_ptr(left);
+		__m256 l0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(l));
+		__m256 l1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(l + 4));
+		__m256 l2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(l + 8));
+		__m256 l3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(l + 12));
+		for (size_t i = 0; i < count; i++) {
+			const float* in = glm::value_ptr(right[i]);
+			float* o = glm::value_ptr(out[i]);
+			for (int c = 0; c < 4; c += 2) {
+				__m256 columns = _mm256_loadu_ps(in + 4 * c);
+#if defined(__FMA__) || (defined(_MSC_VER) && defined(__AVX2__)) //MSVC has no __FMA__, /arch:AVX2 implies it. GCC and Clang can have -mavx2 without -mfma
+				__m256 r = _mm256_mul_ps(l0, _mm256_permute_ps(columns, 0x00));
+				r = _mm256_fmadd_ps(l1, _mm256_permute_ps(columns, 0x55), r);
+				r = _mm256_fmadd_ps(l2, _mm256_permute_ps(columns, 0xaa), r);
+				r = _mm256_fmadd_ps(l3, _mm256_permute_ps(columns, 0xff), r);
+#else
+				__m256 r = _mm256_mul_ps(l0, _mm256_permute_ps(columns, 0x00));
+				r = _mm256_add_ps(r, _mm256_mul_ps(l1, _mm256_permute_ps(columns, 0x55)));
+				r = _mm256_add_ps(r, _mm256_mul_ps(l2, _mm256_permute_ps(columns, 0xaa)));
+				r = _mm256_add_ps(r, _mm256_mul_ps(l3, _mm256_permute_ps(columns, 0xff)));
+#endif
+				_mm256_storeu_ps(o + 4 * c, r);
+			}
+		}
+	}
+#endif
+};
@@ -0,0 +1,121 @@
+#pragma once
+#include "VulkanHelpers.h"
+
+#include <chrono>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+//MeshCodec : compact encoding of the vertex and index streams of the asset pack, decoded when the mesh is read.
+//A stream is a sequence of 32-bit words in elements of stride words (1 for indices, the floats of a Vertex for vertices).
+//Each word is stored as its difference with the same word of the previous element, zigzag mapped so that small negative
+//differences stay small, then as a varint : 7 bits per byte, low bits first, the high bit set when more bytes follow.
+//Neighbouring indices and the attributes of neighbouring vertices are close, so most words take one or two bytes.
+//Byte aligned rather than a bit level entropy coder: decoding is a short loop without tables, and runs at GB/s.
+class MeshCodec {
+public:
+	static const size_t VERTEX_STRIDE = sizeof(Vertex) / sizeof(uint32_t);
+
+	static std::vector<uint8_t> encode(const uint32_t* words, size_t count, size_t stride) {
+		std::vector<uint8_t> data;
+		data.reserve(count * 2);
+		for (size_t i = 0; i < count; i++) {
+			uint32_t delta = words[i] - (i >= stride ? words[i - stride] : 0);
+			uint32_t value = (delta << 1) ^ (0u - (delta >> 31)); //zigzag: 0, -1, 1, -2... become 0, 1, 2, 3...
+			while (value >= 0x80) {
+				data.push_back(static_cast<uint8_t>(value | 0x80));
+				value >>= 7;
+			}
+			data.push_back(static_cast<uint8_t>(value));
+		}
+		return data;
+	}
+
+	//throws when size bytes do not hold exactly count words
+	static void decode(const uint8_t* data, size_t size, uint32_t* words, size_t count, size_t stride) {
+		const uint8_t* in = data;
+		const uint8_t* end = data + size;
+		for (size_t i = 0; i < count; i++) {
+			uint32_t value;
+			if (end - in >= 5) { //room for the longest varint: no bounds check per byte
+				value = *in++;
+				if (value >= 0x80) {
+					value &= 0x7f;
+					uint32_t byte;
+					int shift = 7;
+					do {
+						byte = *in++;
+						value |= (byte & 0x7f) << shift;
+						shift += 7;
+					} while (byte >= 0x80 && shift < 35);
+					if (byte >= 0x80) throw std::runtime_error("corrupted mesh stream!");
+				}
+			}
+			else {
+				value = 0;
+				uint32_t byte = 0x80;
+				for (int shift = 0; byte >= 0x80; shift += 7) {
+					if (in == end || shift >= 35) throw std::runtime_error("corrupted mesh stream!");
+					byte = *in++;
+					value |= (byte & 0x7f) << shift;
+				}
+			}
+			uint32_t delta = (value >> 1) ^ (0u - (value & 1));
+			words[i] = delta + (i >= stride ? words[i - stride] : 0);
+		}
+		if (in != end) throw std::runtime_error("corrupted mesh stream!");
+	}
+
+	static std::vector<uint8_t> encodeVertices(const std::vector<Vertex>& vertices) {
+		static_assert(sizeof(Vertex) % sizeof(uint32_t) == 0, "vertices are encoded as 32-bit words");
+		return encode(reinterpret_cast<const uint32_t*>(vertices.data()), vertices.size() * VERTEX_STRIDE, VERTEX_STRIDE);
+	}
+
+	static void decodeVertices(const uint8_t* data, size_t size, std::vector<Vertex>& vertices) {
+		decode(data, size, reinterpret_cast<uint32_t*>(vertices.data()), vertices.size() * VERTEX_STRIDE, VERTEX_STRIDE);
+	}
+
+	static std::vector<uint8_t> encodeIndices(const std::vector<uint32_t>& indices) {
+		return encode(indices.data(), indices.size(), 1);
+	}
+
+	static void decodeIndices(const uint8_t* data, size_t size, std::vector<uint32_t>& indices) {
+		decode(data, size, indices.data(), indices.size(), 1);
+	}
+
+	//--codec-benchmark : encoded sizes of the streams of a mesh, and their decode throughput in GB/s of decoded data.
+	//Checks that both streams decode back to the same bits.
+	static void benchmark(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, std::ostream& out) {
+		std::vector<uint8_t> encodedVertices = encodeVertices(vertices);
+		std::vector<uint8_t> encodedIndices = encodeIndices(indices);
+		std::vector<Vertex> decodedVertices(vertices.size());
+		std::vector<uint32_t> decodedIndices(indices.size());
+
+		//enough repetitions for ~1 GB decoded per stream, so that the timings are not noise
+		size_t repeat = std::max<size_t>(1, (1u << 30) / std::max<size_t>(1, vertices.size() * sizeof(Vertex) + indices.size() * sizeof(uint32_t)));
+		double vertexMs = 0.0, indexMs = 0.0;
+		for (size_t i = 0; i < repeat; i++) {
+			auto start = std::chrono::high_resolution_clock::now();
+			decodeVertices(encodedVertices.data(), encodedVertices.size(), decodedVertices);
+			vertexMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+			start = std::chrono::high_resolution_clock::now();
+			decodeIndices(encodedIndices.data(), encodedIndices.size(), decodedIndices);
+			indexMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		}
+
+		report("vertices", vertices.size() * sizeof(Vertex), encodedVertices.size(), vertexMs / repeat, out);
+		report("indices", indices.size() * sizeof(uint32_t), encodedIndices.size(), indexMs / repeat, out);
+		if (memcmp(decodedVertices.data(), vertices.data(), vertices.size() * sizeof(Vertex)) != 0 || decodedIndices != indices) {
+			throw std::runtime_error("mesh streams do not decode to what was encoded!");
+		}
+	}
+
+private:
+	static void report(const char* name, size_t rawBytes, size_t encodedBytes, double decodeMs, std::ostream& out) {
+		out << name << " : " << rawBytes / 1024 << " KB encoded in " << encodedBytes / 1024 << " KB ("
+			<< (rawBytes == 0 ? 0.0 : 100.0 * encodedBytes / rawBytes) << " %), decoded in " << decodeMs << " ms, "
+			<< (decodeMs == 0.0 ? 0.0 : rawBytes / (decodeMs * 1e6)) << " GB/s" << std::endl;
+	}
+};
@@ -0,0 +1,321 @@
+#pragma once
+#include "VulkanHelpers.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+//MeshLod : range of the index buffer that draws a mesh at one level of detail. All the levels of a mesh index the same vertices.
+struct MeshLod {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error; //how far the simplified surface may be from the full one, in mesh units
+};
+
+//Submesh : part of a mesh drawn on its own, e.g. one shape and material of an obj file. Its levels of detail are
+//lodCount consecutive MeshLods of the mesh, all ranges of the shared index buffer.
+struct Submesh {
+	glm::vec3 center; //bounding sphere of the full level
+	float radius;
+	uint32_t material; //in the materials of the mesh
+	uint32_t firstLod;
+	uint32_t lodCount;
+	uint32_t reserved;
+};
+
+//MeshSimplifier : quadric error metric simplification (Garland & Heckbert), by half-edge collapses so that the simplified
+//meshes only reference existing vertices and the levels can share one vertex buffer.
+//The vertices of the obj loader are not shared between triangles: they are welded by attributes into wedges, and
+//wedges by position. A position with several wedges lies on a UV seam: it only collapses when every one of its wedges
+//has a counterpart across the collapsed edge, so the seam keeps its UVs on both sides. Borders (edges with a single
+//triangle) and non-manifold edges never move.
+class MeshSimplifier {
+public:
+	MeshSimplifier(const std::vector<Vertex>& vertices) : vertices(vertices) {
+		std::unordered_map<Key, uint32_t, KeyHash> wedgeIds, positionIds;
+		wedgeOfVertex.resize(vertices.size());
+		for (uint32_t v = 0; v < vertices.size(); v++) {
+			auto wedge = wedgeIds.insert({ Key{ &vertices[v], sizeof(Vertex) }, static_cast<uint32_t>(wedgeVertex.size()) });
+			if (wedge.second) {
+				auto position = positionIds.insert({ Key{ &vertices[v].pos, sizeof(glm::vec3) }, static_cast<uint32_t>(positions.size()) });
+				if (position.second) positions.push_back(vertices[v].pos);
+				wedgeVertex.push_back(v);
+				wedgePosition.push_back(position.first->second);
+			}
+			wedgeOfVertex[v] = wedge.first->second;
+		}
+	}
+
+	//indices of about targetIndexCount indices, or more when the mesh cannot be simplified that far.
+	//error gets the largest distance estimate of the collapses that were made.
+	std::vector<uint32_t> simplify(const uint32_t* indices, size_t indexCount, size_t targetIndexCount, float& error) const {
+		std::vector<uint32_t> corners(indexCount); //wedges, updated in place by the collapses
+		for (size_t i = 0; i < indexCount; i++) corners[i] = wedgeOfVertex[indices[i]];
+		size_t triangleCount = indexCount / 3;
+		std::vector<bool> alive(triangleCount, true);
+
+		std::vector<Quadric> quadrics(positions.size());
+		for (size_t t = 0; t < triangleCount; t++) {
+			const glm::vec3& p0 = positions[wedgePosition[corners[3 * t]]];
+			const glm::vec3& p1 = positions[wedgePosition[corners[3 * t + 1]]];
+			const glm::vec3& p2 = positions[wedgePosition[corners[3 * t + 2]]];
+			Quadric plane = Quadric::plane(p0, p1, p2);
+			for (int c = 0; c < 3; c++) quadrics[wedgePosition[corners[3 * t + c]]].add(plane);
+		}
+		std::vector<bool> locked = lockedPositions(corners);
+
+		double maxError = 0.0;
+		size_t aliveCount = triangleCount;
+		std::vector<uint32_t> tris, triOffsets, candidates; //reused by the passes
+		std::vector<Collapse> collapses;
+		std::vector<bool> touched(positions.size());
+		std::vector<std::pair<uint32_t, uint32_t>> wedgeMap;
+
+		//each pass collapses the cheapest edges first, without touching a position twice: costs and adjacency stay valid
+		while (aliveCount * 3 > targetIndexCount) {
+			buildAdjacency(corners, alive, tris, triOffsets);
+			collapses.clear();
+			for (size_t t = 0; t < triangleCount; t++) {
+				if (!alive[t]) continue;
+				for (int c = 0; c < 3; c++) {
+					uint32_t a = wedgePosition[corners[3 * t + c]], b = wedgePosition[corners[3 * t + (c + 1) % 3]];
+					if (a > b) continue; //each edge once (twice on manifold edges, the duplicate fails to apply)
+					double cost = quadrics[a].combined(quadrics[b]).error(positions[b]);
+					double reverseCost = quadrics[a].combined(quadrics[b]).error(positions[a]);
+					if (!locked[a] && (locked[b] || cost <= reverseCost)) collapses.push_back({ a, b, cost });
+					else if (!locked[b]) collapses.push_back({ b, a, reverseCost });
+				}
+			}
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+			std::fill(touched.begin(), touched.end(), false);
+			size_t applied = 0;
+			for (const Collapse& collapse : collapses) {
+				if (aliveCount * 3 <= targetIndexCount) break;
+				if (touched[collapse.from] || touched[collapse.to]) continue;
+				if (!canCollapse(collapse, corners, alive, tris, triOffsets, wedgeMap)) continue;
+
+				for (uint32_t i = triOffsets[collapse.from]; i < triOffsets[collapse.from + 1]; i++) {
+					uint32_t t = tris[i];
+					if (!alive[t]) continue;
+					bool hasTo = false;
+					for (int c = 0; c < 3; c++) hasTo = hasTo || wedgePosition[corners[3 * t + c]] == collapse.to;
+					if (hasTo) {
+						alive[t] = false; //the collapsed edge was one of its sides
+						aliveCount--;
+						continue;
+					}
+					for (int c = 0; c < 3; c++) {
+						uint32_t& corner = corners[3 * t + c];
+						for (const auto& mapping : wedgeMap) {
+							if (corner == mapping.first) {
+								corner = mapping.second;
+								break;
+							}
+						}
+					}
+				}
+				const Quadric& merged = quadrics[collapse.to].combined(quadrics[collapse.from]);
+				quadrics[collapse.to] = merged;
+				maxError = std::max(maxError, merged.distanceSquared(positions[collapse.to]));
+				touched[collapse.from] = touched[collapse.to] = true;
+				applied++;
+			}
+			if (applied == 0) break; //everything left is locked or would fold over
+		}
+
+		std::vector<uint32_t> result;
+		result.reserve(aliveCount * 3);
+		for (size_t t = 0; t < triangleCount; t++) {
+			if (!alive[t]) continue;
+			for (int c = 0; c < 3; c++) result.push_back(wedgeVertex[corners[3 * t + c]]);
+		}
+		error = static_cast<float>(std::sqrt(maxError));
+		return result;
+	}
+
+	//the full range then levels of about ratio times fewer triangles each, appended to indices. Stops early when a level
+	//would barely be simpler than the previous one, or smaller than minTriangles. The errors add up from level to level.
+	//One simplifier serves every range of the mesh, e.g. its submeshes.
+	static std::vector<MeshLod> buildLods(const MeshSimplifier& simplifier, std::vector<uint32_t>& indices, MeshLod full, uint32_t maxLevels,
+		float ratio = 0.5f, size_t minTriangles = 64) {
+		std::vector<MeshLod> lods;
+		lods.push_back(full);
+		while (lods.size() < maxLevels) {
+			MeshLod previous = lods.back();
+			size_t targetTriangles = static_cast<size_t>(previous.indexCount / 3 * ratio);
+			if (targetTriangles < minTriangles) break;
+
+			float error = 0.0f;
+			std::vector<uint32_t> lod = simplifier.simplify(&indices[previous.firstIndex], previous.indexCount, targetTriangles * 3, error);
+			if (lod.size() > previous.indexCount * 0.9) break;
+
+			lods.push_back({ static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(lod.size()), previous.error + error });
+			indices.insert(indices.end(), lod.begin(), lod.end());
+		}
+		return lods;
+	}
+
+private:
+	//symmetric 4x4 matrix of the squared distance to a set of planes, weighted by the area of their triangles
+	struct Quadric {
+		double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+		double weight = 0;
+
+		static Quadric plane(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2) {
+			Quadric q;
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			double length = glm::length(normal);
+			if (length == 0.0) return q;
+			double a = normal.x / length, b = normal.y / length, c = normal.z / length;
+			double d = -(a * p0.x + b * p0.y + c * p0.z);
+			double area = length * 0.5;
+			q.a2 = area * a * a; q.ab = area * a * b; q.ac = area * a * c; q.ad = area * a * d;
+			q.b2 = area * b * b; q.bc = area * b * c; q.bd = area * b * d;
+			q.c2 = area * c * c; q.cd = area * c * d;
+			q.d2 = area * d * d;
+			q.weight = area;
+			return q;
+		}
+
+		void add(const Quadric& q) {
+			a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2; bc += q.bc; bd += q.bd; c2 += q.c2; cd += q.cd; d2 += q.d2;
+			weight += q.weight;
+		}
+
+		Quadric combined(const Quadric& q) const {
+			Quadric sum = *this;
+			sum.add(q);
+			return sum;
+		}
+
+		double error(const glm::vec3& p) const {
+			double x = p.x, y = p.y, z = p.z;
+			return a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x + b2 * y * y + 2 * bc * y * z + 2 * bd * y +
+				c2 * z * z + 2 * cd * z + d2;
+		}
+
+		//mean squared distance to the planes
+		double distanceSquared(const glm::vec3& p) const {
+			return weight > 0 ? std::max(0.0, error(p)) / weight : 0.0;
+		}
+	};
+
+	struct Collapse {
+		uint32_t from; //position that disappears
+		uint32_t to;
+		double cost;
+	};
+
+	struct Key {
+		const void* data;
+		size_t size;
+
+		bool operator==(const Key& other) const {
+			return size == other.size && memcmp(data, other.data, size) == 0;
+		}
+	};
+
+	struct KeyHash {
+		size_t operator()(const Key& key) const {
+			uint64_t h = 14695981039346656037ull;
+			const uint8_t* bytes = static_cast<const uint8_t*>(key.data);
+			for (size_t i = 0; i < key.size; i++) {
+				h ^= bytes[i];
+				h *= 1099511628211ull;
+			}
+			return static_cast<size_t>(h);
+		}
+	};
+
+	const std::vector<Vertex>& vertices;
+	std::vector<uint32_t> wedgeOfVertex;
+	std::vector<uint32_t> wedgeVertex; //first vertex of each wedge, what the simplified indices point to
+	std::vector<uint32_t> wedgePosition;
+	std::vector<glm::vec3> positions;
+
+	//positions on an edge that does not have exactly two triangles
+	std::vector<bool> lockedPositions(const std::vector<uint32_t>& corners) const {
+		std::unordered_map<uint64_t, uint32_t> edgeTriangles;
+		for (size_t i = 0; i < corners.size(); i += 3) {
+			for (int c = 0; c < 3; c++) {
+				uint64_t a = wedgePosition[corners[i + c]], b = wedgePosition[corners[i + (c + 1) % 3]];
+				edgeTriangles[std::min(a, b) << 32 | std::max(a, b)]++;
+			}
+		}
+		std::vector<bool> locked(positions.size(), false);
+		for (const auto& edge : edgeTriangles) {
+			if (edge.second == 2) continue;
+			locked[edge.first >> 32] = true;
+			locked[edge.first & 0xffffffff] = true;
+		}
+		return locked;
+	}
+
+	//triangles around each position, as offsets into tris
+	void buildAdjacency(const std::vector<uint32_t>& corners, const std::vector<bool>& alive, std::vector<uint32_t>& tris,
+		std::vector<uint32_t>& triOffsets) const {
+		triOffsets.assign(positions.size() + 1, 0);
+		for (size_t t = 0; t < alive.size(); t++) {
+			if (!alive[t]) continue;
+			for (int c = 0; c < 3; c++) triOffsets[wedgePosition[corners[3 * t + c]] + 1]++;
+		}
+		for (size_t p = 0; p < positions.size(); p++) triOffsets[p + 1] += triOffsets[p];
+		tris.resize(triOffsets.back());
+		std::vector<uint32_t> fill(triOffsets.begin(), triOffsets.end() - 1);
+		for (size_t t = 0; t < alive.size(); t++) {
+			if (!alive[t]) continue;
+			for (int c = 0; c < 3; c++) tris[fill[wedgePosition[corners[3 * t + c]]]++] = static_cast<uint32_t>(t);
+		}
+	}
+
+	//every wedge of from must map to a wedge of to through a triangle sharing the edge, and no triangle may fold over
+	bool canCollapse(const Collapse& collapse, const std::vector<uint32_t>& corners, const std::vector<bool>& alive,
+		const std::vector<uint32_t>& tris, const std::vector<uint32_t>& triOffsets, std::vector<std::pair<uint32_t, uint32_t>>& wedgeMap) const {
+		wedgeMap.clear();
+		bool sharesEdge = false;
+		for (uint32_t i = triOffsets[collapse.from]; i < triOffsets[collapse.from + 1]; i++) {
+			uint32_t t = tris[i];
+			if (!alive[t]) continue;
+			uint32_t fromWedge = 0, toWedge = UINT32_MAX;
+			for (int c = 0; c < 3; c++) {
+				uint32_t wedge = corners[3 * t + c];
+				if (wedgePosition[wedge] == collapse.from) fromWedge = wedge;
+				if (wedgePosition[wedge] == collapse.to) toWedge = wedge;
+			}
+			if (toWedge == UINT32_MAX) continue;
+			sharesEdge = true;
+			for (const auto& mapping : wedgeMap) {
+				if (mapping.first == fromWedge && mapping.second != toWedge) return false; //the seam does not follow the edge
+			}
+			wedgeMap.push_back({ fromWedge, toWedge });
+		}
+		if (!sharesEdge) return false; //stale: the edge disappeared earlier in the pass
+
+		const glm::vec3& target = positions[collapse.to];
+		for (uint32_t i = triOffsets[collapse.from]; i < triOffsets[collapse.from + 1]; i++) {
+			uint32_t t = tris[i];
+			if (!alive[t]) continue;
+			glm::vec3 before[3], after[3];
+			bool hasTo = false, mapped = true;
+			for (int c = 0; c < 3; c++) {
+				uint32_t wedge = corners[3 * t + c];
+				before[c] = after[c] = positions[wedgePosition[wedge]];
+				if (wedgePosition[wedge] == collapse.to) hasTo = true;
+				if (wedgePosition[wedge] == collapse.from) {
+					after[c] = target;
+					mapped = std::any_of(wedgeMap.begin(), wedgeMap.end(), [wedge](const std::pair<uint32_t, uint32_t>& m) { return m.first == wedge; });
+				}
+			}
+			if (hasTo) continue; //removed by the collapse
+			if (!mapped) return false; //a wedge on the other side of a seam would lose its UVs
+			glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+			glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+			if (glm::dot(normalBefore, normalAfter) <= 0.2f * glm::length(normalBefore) * glm::length(normalAfter)) return false;
+		}
+		return true;
+	}
+};
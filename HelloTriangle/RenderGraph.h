@@ -0,0 +1,684 @@
+#pragma once
+#include "VulkanHelpers.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//RenderGraph : the passes of a frame, each declaring the buffers and images (or mip levels of images) it reads and
+//writes, and how. compile() walks the passes in order and works out the barriers from the declarations alone:
+//- a barrier only where there is a hazard : read after write, write after read or write, or a layout change. Reads
+//  after a write that was already made visible to their stages and accesses need none.
+//- write after read only waits for the readers, the write they read was already made available
+//- the barriers before a pass go into a single vkCmdPipelineBarrier, and adjacent mip levels into a single range
+//- passes that neither have side effects (e.g. presenting) nor contribute to an exported resource are culled
+//- transient images whose passes do not overlap share memory, see aliasSlot()
+//Nothing here touches the device until execute(), so the compiled barriers can be checked on the CPU, see describe()
+//and test().
+class RenderGraph {
+public:
+	typedef uint32_t Resource;
+
+	static const uint32_t ALL_LEVELS = ~0u;
+
+	static const VkAccessFlags WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+	//how a pass uses a resource, or in which state the resource is before and after the graph
+	struct Access {
+		VkPipelineStageFlags stages;
+		VkAccessFlags access;
+		VkImageLayout layout; //images only
+	};
+
+	struct Barrier {
+		Resource resource;
+		uint32_t baseLevel; //images only
+		uint32_t levelCount;
+		VkPipelineStageFlags srcStages;
+		VkAccessFlags srcAccess;
+		VkPipelineStageFlags dstStages;
+		VkAccessFlags dstAccess;
+		VkImageLayout oldLayout;
+		VkImageLayout newLayout;
+	};
+
+	class PassBuilder {
+	public:
+		PassBuilder& read(Resource resource, Access access, uint32_t baseLevel = 0, uint32_t levelCount = ALL_LEVELS) {
+			return use(resource, access, baseLevel, levelCount, false);
+		}
+
+		PassBuilder& write(Resource resource, Access access, uint32_t baseLevel = 0, uint32_t levelCount = ALL_LEVELS) {
+			return use(resource, access, baseLevel, levelCount, true);
+		}
+
+		//never culled, e.g. the pass rendering into the swap chain image
+		PassBuilder& sideEffects() {
+			graph.passes[pass].sideEffects = true;
+			return *this;
+		}
+
+	private:
+		friend class RenderGraph;
+		RenderGraph& graph;
+		size_t pass;
+
+		PassBuilder(RenderGraph& graph, size_t pass) : graph(graph), pass(pass) {}
+
+		PassBuilder& use(Resource resource, Access access, uint32_t baseLevel, uint32_t levelCount, bool write) {
+			const ResourceInfo& info = graph.resources.at(resource);
+			if (levelCount == ALL_LEVELS) levelCount = info.levelCount - baseLevel;
+			if (baseLevel + levelCount > info.levelCount) {
+				throw std::invalid_argument("render graph pass " + graph.passes[pass].name + " uses levels that " + info.name + " does not have!");
+			}
+			graph.passes[pass].uses.push_back({ resource, access, baseLevel, levelCount, write });
+			return *this;
+		}
+	};
+
+	//the usual access to an image in a layout, for one-off transitions
+	static Access layoutAccess(VkImageLayout layout) {
+		switch (layout) {
+		case VK_IMAGE_LAYOUT_PREINITIALIZED: return { VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_WRITE_BIT, layout };
+		case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL: return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, layout };
+		case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL: return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, layout };
+		case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL: return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, layout };
+		case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+			return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, layout };
+		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+			return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, layout };
+		case VK_IMAGE_LAYOUT_UNDEFINED: return { VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, layout };
+		default: return { VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT, layout };
+		}
+	}
+
+	//an image that outlives the graph, currently in the state left by its last use. synchronized : a barrier already made
+	//the image available and visible in that state (e.g. the final barrier of the previous frame's graph), so uses within
+	//its stages and accesses, writes included, need no other.
+	Resource importImage(const std::string& name, VkImage image, VkImageAspectFlags aspects, uint32_t levelCount, Access current,
+		bool synchronized = false) {
+		ResourceInfo info = {};
+		info.name = name;
+		info.image = image;
+		info.aspects = aspects;
+		info.levelCount = levelCount;
+		info.initial = current;
+		info.synchronized = synchronized;
+		return addResource(info);
+	}
+
+	Resource importBuffer(const std::string& name, VkBuffer buffer, Access current) {
+		ResourceInfo info = {};
+		info.name = name;
+		info.buffer = buffer;
+		info.levelCount = 1;
+		info.initial = current;
+		info.initial.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		return addResource(info);
+	}
+
+	//an image only used within the graph, with undefined contents at its first use. size is what its memory requirements
+	//ask for : after compile(), images with the same aliasSlot() can be bound to the same memory, and setImage() gives
+	//the graph the image to put in the barriers.
+	Resource createTransientImage(const std::string& name, VkImageAspectFlags aspects, uint32_t levelCount, VkDeviceSize size) {
+		ResourceInfo info = {};
+		info.name = name;
+		info.aspects = aspects;
+		info.levelCount = levelCount;
+		info.initial = layoutAccess(VK_IMAGE_LAYOUT_UNDEFINED);
+		info.transient = true;
+		info.size = size;
+		return addResource(info);
+	}
+
+	void setImage(Resource resource, VkImage image) {
+		resources.at(resource).image = image;
+	}
+
+	//the resource is an output of the graph, left in the final state after the last pass
+	void exportResource(Resource resource, Access final) {
+		ResourceInfo& info = resources.at(resource);
+		info.exported = true;
+		info.final = final;
+		if (info.buffer != VK_NULL_HANDLE) info.final.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	}
+
+	//record runs in execute(), after the barriers the pass needs
+	PassBuilder addPass(const std::string& name, std::function<void(VkCommandBuffer)> record) {
+		Pass pass;
+		pass.name = name;
+		pass.record = record;
+		passes.push_back(pass);
+		compiled = false;
+		return PassBuilder(*this, passes.size() - 1);
+	}
+
+	void compile() {
+		cullPasses();
+		planAliasing();
+		computeBarriers();
+		compiled = true;
+	}
+
+	void execute(VkCommandBuffer commandBuffer) const {
+		if (!compiled) throw std::logic_error("render graph executed before compile!");
+		for (const Pass& pass : passes) {
+			if (pass.culled) continue;
+			recordBarriers(commandBuffer, pass.barriers);
+			pass.record(commandBuffer);
+		}
+		recordBarriers(commandBuffer, finalBarriers);
+	}
+
+	size_t passCount() const {
+		return passes.size();
+	}
+
+	const std::string& passName(size_t pass) const {
+		return passes.at(pass).name;
+	}
+
+	bool culled(size_t pass) const {
+		return passes.at(pass).culled;
+	}
+
+	//recorded before the pass, in one vkCmdPipelineBarrier
+	const std::vector<Barrier>& barriersBefore(size_t pass) const {
+		return passes.at(pass).barriers;
+	}
+
+	//recorded after the last pass, to leave the exported resources in their final state
+	const std::vector<Barrier>& barriersAfter() const {
+		return finalBarriers;
+	}
+
+	//barriers, and vkCmdPipelineBarrier calls recording them
+	size_t barrierCount() const {
+		size_t count = finalBarriers.size();
+		for (const Pass& pass : passes) count += pass.barriers.size();
+		return count;
+	}
+
+	size_t batchCount() const {
+		size_t count = finalBarriers.empty() ? 0 : 1;
+		for (const Pass& pass : passes) count += pass.barriers.empty() ? 0 : 1;
+		return count;
+	}
+
+	size_t culledCount() const {
+		return std::count_if(passes.begin(), passes.end(), [](const Pass& pass) { return pass.culled; });
+	}
+
+	//the memory slot of a transient image, UINT32_MAX when no pass uses it
+	uint32_t aliasSlot(Resource resource) const {
+		return resources.at(resource).aliasSlot;
+	}
+
+	//bytes of each memory slot, the largest of the images sharing it
+	const std::vector<VkDeviceSize>& aliasSlotSizes() const {
+		return slotSizes;
+	}
+
+	const std::string& resourceName(Resource resource) const {
+		return resources.at(resource).name;
+	}
+
+	//one line per pass and barrier
+	void describe(std::ostream& out) const {
+		for (size_t i = 0; i < passes.size(); i++) {
+			out << (passes[i].culled ? "  culled pass " : "  pass ") << passes[i].name << std::endl;
+			for (const Barrier& barrier : passes[i].barriers) describeBarrier(out, barrier);
+		}
+		if (!finalBarriers.empty()) out << "  after the last pass" << std::endl;
+		for (const Barrier& barrier : finalBarriers) describeBarrier(out, barrier);
+		for (size_t slot = 0; slot < slotSizes.size(); slot++) {
+			out << "  transient memory " << slot << " : " << slotSizes[slot] / 1024 << " KB,";
+			for (const ResourceInfo& info : resources) {
+				if (info.transient && info.aliasSlot == slot) out << " " << info.name;
+			}
+			out << std::endl;
+		}
+	}
+
+	//--render-graph-test : compiles small graphs with fake handles and checks the barriers, culling and aliasing they get
+	static void test(std::ostream& out) {
+		size_t checks = 0;
+		auto expect = [&checks](bool condition, const std::string& what) {
+			if (!condition) throw std::runtime_error("render graph test failed: " + what + "!");
+			checks++;
+		};
+		auto barrierIs = [](const std::vector<Barrier>& barriers, VkPipelineStageFlags srcStages, VkAccessFlags srcAccess,
+			VkPipelineStageFlags dstStages, VkAccessFlags dstAccess) {
+			return barriers.size() == 1 && barriers[0].srcStages == srcStages && barriers[0].srcAccess == srcAccess &&
+				barriers[0].dstStages == dstStages && barriers[0].dstAccess == dstAccess;
+		};
+		auto levelsAre = [](const std::vector<Barrier>& barriers, uint32_t baseLevel, uint32_t levelCount, VkImageLayout oldLayout, VkImageLayout newLayout) {
+			return barriers.size() == 1 && barriers[0].baseLevel == baseLevel && barriers[0].levelCount == levelCount &&
+				barriers[0].oldLayout == oldLayout && barriers[0].newLayout == newLayout;
+		};
+		const std::function<void(VkCommandBuffer)> record = [](VkCommandBuffer) {};
+		const VkPipelineStageFlags TRANSFER = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		const VkPipelineStageFlags VERTEX = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+		const Access transferWrite = { TRANSFER, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED };
+		const Access uniformRead = { VERTEX, VK_ACCESS_UNIFORM_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED };
+		const Access computeWrite = { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL };
+		const Access sampled = layoutAccess(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+		//hazards on a buffer
+		{
+			RenderGraph graph;
+			Resource buffer = graph.importBuffer("buffer", fakeHandle<VkBuffer>(1), uniformRead);
+			graph.exportResource(buffer, uniformRead);
+			graph.addPass("write", record).write(buffer, transferWrite);
+			graph.addPass("read", record).read(buffer, uniformRead).sideEffects();
+			graph.addPass("read again", record).read(buffer, uniformRead).sideEffects();
+			graph.addPass("write after read", record).write(buffer, transferWrite);
+			graph.addPass("write after write", record).write(buffer, transferWrite);
+			graph.compile();
+			out << "hazards:" << std::endl;
+			graph.describe(out);
+			expect(barrierIs(graph.barriersBefore(0), VERTEX, 0, TRANSFER, VK_ACCESS_TRANSFER_WRITE_BIT), "a write after the reads before the graph waits for them");
+			expect(barrierIs(graph.barriersBefore(1), TRANSFER, VK_ACCESS_TRANSFER_WRITE_BIT, VERTEX, VK_ACCESS_UNIFORM_READ_BIT), "a read after a write waits for it and makes it visible");
+			expect(graph.barriersBefore(2).empty(), "a second read of the same kind needs no barrier");
+			expect(barrierIs(graph.barriersBefore(3), VERTEX, 0, TRANSFER, VK_ACCESS_TRANSFER_WRITE_BIT), "a write after reads only waits for them");
+			expect(barrierIs(graph.barriersBefore(4), TRANSFER, VK_ACCESS_TRANSFER_WRITE_BIT, TRANSFER, VK_ACCESS_TRANSFER_WRITE_BIT), "a write after a write waits for it");
+			expect(barrierIs(graph.barriersAfter(), TRANSFER, VK_ACCESS_TRANSFER_WRITE_BIT, VERTEX, VK_ACCESS_UNIFORM_READ_BIT), "the export waits for the last write");
+		}
+
+		//layout transitions, batched over adjacent levels
+		{
+			RenderGraph graph;
+			Resource image = graph.importImage("image", fakeHandle<VkImage>(2), VK_IMAGE_ASPECT_COLOR_BIT, 4, layoutAccess(VK_IMAGE_LAYOUT_UNDEFINED));
+			graph.exportResource(image, sampled);
+			graph.addPass("fill", record).write(image, layoutAccess(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL));
+			graph.addPass("sample", record).read(image, sampled).sideEffects();
+			graph.addPass("write level 2", record).write(image, computeWrite, 2, 1);
+			graph.compile();
+			out << "layouts:" << std::endl;
+			graph.describe(out);
+			expect(levelsAre(graph.barriersBefore(0), 0, 4, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL), "the levels are transitioned in one barrier");
+			expect(levelsAre(graph.barriersBefore(1), 0, 4, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL), "the levels are transitioned for sampling in one barrier");
+			expect(levelsAre(graph.barriersBefore(2), 2, 1, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL), "only the written level is transitioned");
+			expect(levelsAre(graph.barriersAfter(), 2, 1, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL), "only the written level goes back to the export layout");
+		}
+
+		//an image imported in the state a barrier left it in : a write within its scope needs no other
+		{
+			const Access attachment = layoutAccess(VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+			RenderGraph graph;
+			Resource depth = graph.importImage("depth", fakeHandle<VkImage>(3), VK_IMAGE_ASPECT_DEPTH_BIT, 1, attachment, true);
+			Resource unsynchronized = graph.importImage("unsynchronized depth", fakeHandle<VkImage>(4), VK_IMAGE_ASPECT_DEPTH_BIT, 1, attachment);
+			graph.addPass("render", record).write(depth, attachment).write(unsynchronized, attachment).sideEffects();
+			graph.compile();
+			out << "synchronized imports:" << std::endl;
+			graph.describe(out);
+			expect(graph.barriersBefore(0).size() == 1 && graph.barriersBefore(0)[0].resource == unsynchronized, "only the unsynchronized import waits for its last write");
+		}
+
+		//culling, and transients sharing memory
+		{
+			RenderGraph graph;
+			Resource output = graph.importImage("output", fakeHandle<VkImage>(5), VK_IMAGE_ASPECT_COLOR_BIT, 1, layoutAccess(VK_IMAGE_LAYOUT_UNDEFINED));
+			Resource first = graph.createTransientImage("first", VK_IMAGE_ASPECT_COLOR_BIT, 1, 1024 * 1024);
+			Resource second = graph.createTransientImage("second", VK_IMAGE_ASPECT_COLOR_BIT, 1, 4 * 1024 * 1024);
+			Resource unused = graph.createTransientImage("unused", VK_IMAGE_ASPECT_COLOR_BIT, 1, 2 * 1024 * 1024);
+			graph.exportResource(output, sampled);
+			graph.addPass("write unused", record).write(unused, computeWrite);
+			graph.addPass("write first", record).write(first, computeWrite);
+			graph.addPass("read first", record).read(first, sampled).write(output, computeWrite);
+			graph.addPass("write second", record).write(second, computeWrite);
+			graph.addPass("read second", record).read(second, sampled).write(output, computeWrite);
+			graph.compile();
+			out << "culling and aliasing:" << std::endl;
+			graph.describe(out);
+			expect(graph.culled(0) && graph.culledCount() == 1, "only the pass nothing reads from is culled");
+			expect(graph.aliasSlot(unused) == UINT32_MAX, "the image of a culled pass gets no memory");
+			expect(graph.aliasSlot(first) == graph.aliasSlot(second) && graph.aliasSlotSizes().size() == 1, "transients with disjoint lifetimes share memory");
+			expect(graph.aliasSlotSizes()[0] == 4 * 1024 * 1024, "the shared memory fits the largest transient");
+			const std::vector<Barrier>& aliasing = graph.barriersBefore(3);
+			expect(aliasing.size() == 1 && aliasing[0].resource == second && (aliasing[0].srcStages & VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT) != 0,
+				"a transient waits for the last use of the memory it takes over");
+		}
+
+		out << "render graph test : " << checks << " checks passed" << std::endl;
+	}
+
+private:
+	struct ResourceInfo {
+		std::string name;
+		VkImage image;
+		VkBuffer buffer;
+		VkImageAspectFlags aspects;
+		uint32_t levelCount;
+		Access initial;
+		bool synchronized;
+		bool exported;
+		Access final;
+		bool transient;
+		VkDeviceSize size;
+		uint32_t aliasSlot;
+		Resource aliasPrevious; //the transient image that used the memory slot before, UINT32_MAX for none
+		size_t firstPass;
+		size_t lastPass;
+	};
+
+	struct Use {
+		Resource resource;
+		Access access;
+		uint32_t baseLevel;
+		uint32_t levelCount;
+		bool write;
+	};
+
+	struct Pass {
+		std::string name;
+		std::function<void(VkCommandBuffer)> record;
+		std::vector<Use> uses;
+		bool sideEffects = false;
+		bool culled = false;
+		std::vector<Barrier> barriers;
+	};
+
+	//of one mip level of a resource, while walking the passes
+	struct State {
+		VkImageLayout layout;
+		VkPipelineStageFlags writeStages; //the last write, or the barrier of the last layout transition
+		VkAccessFlags writeAccess;
+		VkPipelineStageFlags readStages; //since the last write
+		VkPipelineStageFlags visibleStages; //the last write has been made visible to these
+		VkAccessFlags visibleAccess;
+	};
+
+	std::vector<ResourceInfo> resources;
+	std::vector<Pass> passes;
+	std::vector<Barrier> finalBarriers;
+	std::vector<VkDeviceSize> slotSizes;
+	bool compiled = false;
+
+	Resource addResource(ResourceInfo& info) {
+		info.aliasSlot = UINT32_MAX;
+		info.aliasPrevious = UINT32_MAX;
+		resources.push_back(info);
+		compiled = false;
+		return static_cast<Resource>(resources.size() - 1);
+	}
+
+	//backwards from the exported resources : a pass is needed when it has side effects or writes something needed,
+	//and then what it reads is needed too
+	void cullPasses() {
+		std::vector<bool> needed(resources.size());
+		for (size_t i = 0; i < resources.size(); i++) needed[i] = resources[i].exported;
+		for (size_t i = passes.size(); i-- > 0;) {
+			Pass& pass = passes[i];
+			pass.culled = !pass.sideEffects;
+			for (const Use& use : pass.uses) {
+				if (use.write && needed[use.resource]) pass.culled = false;
+			}
+			if (pass.culled) continue;
+			for (const Use& use : pass.uses) {
+				if (!use.write || (use.access.access & ~WRITE_ACCESS) != 0) needed[use.resource] = true;
+			}
+		}
+	}
+
+	//first fit in order of first use : a transient image reuses the slot of one whose last pass is before its first
+	void planAliasing() {
+		slotSizes.clear();
+		std::vector<Resource> transients;
+		for (size_t r = 0; r < resources.size(); r++) {
+			ResourceInfo& info = resources[r];
+			info.aliasSlot = UINT32_MAX;
+			info.aliasPrevious = UINT32_MAX;
+			info.firstPass = SIZE_MAX;
+			info.lastPass = 0;
+			for (size_t i = 0; i < passes.size(); i++) {
+				if (passes[i].culled) continue;
+				for (const Use& use : passes[i].uses) {
+					if (use.resource != r) continue;
+					info.firstPass = std::min(info.firstPass, i);
+					info.lastPass = std::max(info.lastPass, i);
+				}
+			}
+			if (info.transient && info.firstPass != SIZE_MAX) transients.push_back(static_cast<Resource>(r));
+		}
+		std::sort(transients.begin(), transients.end(), [this](Resource a, Resource b) { return resources[a].firstPass < resources[b].firstPass; });
+
+		std::vector<Resource> occupants; //the last image of each slot
+		for (Resource r : transients) {
+			ResourceInfo& info = resources[r];
+			for (uint32_t slot = 0; slot < occupants.size(); slot++) {
+				if (resources[occupants[slot]].lastPass < info.firstPass) {
+					info.aliasSlot = slot;
+					info.aliasPrevious = occupants[slot];
+					break;
+				}
+			}
+			if (info.aliasSlot == UINT32_MAX) {
+				info.aliasSlot = static_cast<uint32_t>(occupants.size());
+				occupants.push_back(r);
+				slotSizes.push_back(0);
+			}
+			occupants[info.aliasSlot] = r;
+			slotSizes[info.aliasSlot] = std::max(slotSizes[info.aliasSlot], info.size);
+		}
+	}
+
+	void computeBarriers() {
+		std::vector<std::vector<State>> states(resources.size());
+		std::vector<bool> used(resources.size());
+		for (size_t r = 0; r < resources.size(); r++) {
+			states[r].resize(resources[r].levelCount, initialState(resources[r].initial, resources[r].synchronized));
+		}
+
+		for (Pass& pass : passes) {
+			pass.barriers.clear();
+			if (pass.culled) continue;
+			for (const Use& use : pass.uses) {
+				const ResourceInfo& info = resources[use.resource];
+				if (!used[use.resource] && info.aliasPrevious != UINT32_MAX) {
+					inheritAliasedMemory(states[use.resource], states[info.aliasPrevious]);
+				}
+				used[use.resource] = true;
+				for (uint32_t level = use.baseLevel; level < use.baseLevel + use.levelCount; level++) {
+					synchronize(use.resource, level, states[use.resource][level], use.access, use.write, pass.barriers);
+				}
+			}
+		}
+
+		finalBarriers.clear();
+		for (size_t r = 0; r < resources.size(); r++) {
+			const ResourceInfo& info = resources[r];
+			if (!info.exported) continue;
+			for (uint32_t level = 0; level < info.levelCount; level++) {
+				synchronize(static_cast<Resource>(r), level, states[r][level], info.final, (info.final.access & WRITE_ACCESS) != 0, finalBarriers);
+			}
+		}
+	}
+
+	//the state left by the last use before the graph counts as a write when it is one, as reads otherwise. Left by a
+	//barrier, nothing is pending : it is only visible to the stages and accesses of the barrier.
+	static State initialState(const Access& access, bool synchronized) {
+		State state = {};
+		state.layout = access.layout;
+		if (synchronized) {
+			state.visibleStages = access.stages;
+			state.visibleAccess = access.access;
+		}
+		else if (access.access & WRITE_ACCESS) {
+			state.writeStages = access.stages;
+			state.writeAccess = access.access & WRITE_ACCESS;
+		}
+		else {
+			state.readStages = access.stages;
+			state.visibleStages = access.stages;
+			state.visibleAccess = access.access;
+		}
+		return state;
+	}
+
+	//the first use of an aliased image waits for the last uses of the previous image in the same memory
+	static void inheritAliasedMemory(std::vector<State>& levels, const std::vector<State>& previous) {
+		VkPipelineStageFlags stages = 0;
+		VkAccessFlags access = 0;
+		for (const State& state : previous) {
+			stages |= state.writeStages | state.readStages;
+			access |= state.writeAccess;
+		}
+		for (State& state : levels) {
+			state.writeStages = stages;
+			state.writeAccess = access;
+			state.readStages = 0;
+		}
+	}
+
+	void synchronize(Resource resource, uint32_t level, State& state, const Access& access, bool write, std::vector<Barrier>& barriers) {
+		bool transition = resources[resource].buffer == VK_NULL_HANDLE && state.layout != access.layout;
+		Barrier barrier = {};
+		barrier.resource = resource;
+		barrier.baseLevel = level;
+		barrier.levelCount = 1;
+		barrier.dstStages = access.stages;
+		barrier.dstAccess = access.access;
+		barrier.oldLayout = state.layout;
+		barrier.newLayout = transition ? access.layout : state.layout;
+
+		if (!write && !transition) {
+			bool covered = (access.stages & ~state.visibleStages) == 0 && (access.access & ~state.visibleAccess) == 0;
+			state.readStages |= access.stages;
+			if (state.writeStages == 0 || covered) return;
+			barrier.srcStages = state.writeStages;
+			barrier.srcAccess = state.writeAccess;
+			state.visibleStages |= access.stages;
+			state.visibleAccess |= access.access;
+		}
+		else {
+			//nothing used it since the barrier that left it in this state, and that barrier covers this use
+			bool covered = !transition && state.writeStages == 0 && state.readStages == 0 &&
+				(access.stages & ~state.visibleStages) == 0 && (access.access & ~state.visibleAccess) == 0;
+
+			//after reads, the write they waited for is already available : only wait for the reads to be done
+			if (state.readStages != 0) {
+				barrier.srcStages = state.readStages;
+			}
+			else {
+				barrier.srcStages = state.writeStages;
+				barrier.srcAccess = state.writeAccess;
+			}
+			if (barrier.srcStages == 0) barrier.srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+
+			State next = {};
+			next.layout = barrier.newLayout;
+			next.writeStages = access.stages;
+			if (write) {
+				next.writeAccess = access.access & WRITE_ACCESS;
+			}
+			else { //the layout transition is done, and visible to this read
+				next.readStages = access.stages;
+				next.visibleStages = access.stages;
+				next.visibleAccess = access.access;
+			}
+			state = next;
+			if (covered) return;
+		}
+		addBarrier(barriers, barrier);
+	}
+
+	//the previous level of the same resource with the same barrier : one range
+	static void addBarrier(std::vector<Barrier>& barriers, const Barrier& barrier) {
+		for (Barrier& other : barriers) {
+			if (other.resource == barrier.resource && other.baseLevel + other.levelCount == barrier.baseLevel &&
+				other.srcStages == barrier.srcStages && other.srcAccess == barrier.srcAccess && other.dstStages == barrier.dstStages &&
+				other.dstAccess == barrier.dstAccess && other.oldLayout == barrier.oldLayout && other.newLayout == barrier.newLayout) {
+				other.levelCount++;
+				return;
+			}
+		}
+		barriers.push_back(barrier);
+	}
+
+	void recordBarriers(VkCommandBuffer commandBuffer, const std::vector<Barrier>& barriers) const {
+		if (barriers.empty()) return;
+
+		VkPipelineStageFlags srcStages = 0;
+		VkPipelineStageFlags dstStages = 0;
+		std::vector<VkBufferMemoryBarrier> bufferBarriers;
+		std::vector<VkImageMemoryBarrier> imageBarriers;
+		for (const Barrier& barrier : barriers) {
+			const ResourceInfo& info = resources[barrier.resource];
+			srcStages |= barrier.srcStages;
+			dstStages |= barrier.dstStages;
+			if (info.buffer != VK_NULL_HANDLE) {
+				VkBufferMemoryBarrier bufferBarrier = {};
+				bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+				bufferBarrier.srcAccessMask = barrier.srcAccess;
+				bufferBarrier.dstAccessMask = barrier.dstAccess;
+				bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				bufferBarrier.buffer = info.buffer;
+				bufferBarrier.size = VK_WHOLE_SIZE;
+				bufferBarriers.push_back(bufferBarrier);
+			}
+			else {
+				VkImageMemoryBarrier imageBarrier = {};
+				imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				imageBarrier.srcAccessMask = barrier.srcAccess;
+				imageBarrier.dstAccessMask = barrier.dstAccess;
+				imageBarrier.oldLayout = barrier.oldLayout;
+				imageBarrier.newLayout = barrier.newLayout;
+				imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				imageBarrier.image = info.image;
+				imageBarrier.subresourceRange = { info.aspects, barrier.baseLevel, barrier.levelCount, 0, 1 };
+				imageBarriers.push_back(imageBarrier);
+			}
+		}
+		vkCmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0, 0, nullptr,
+			static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(), static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+	}
+
+	void describeBarrier(std::ostream& out, const Barrier& barrier) const {
+		const ResourceInfo& info = resources[barrier.resource];
+		out << "    barrier " << info.name;
+		if (info.buffer == VK_NULL_HANDLE && info.levelCount > 1) {
+			if (barrier.levelCount == 1) out << " level " << barrier.baseLevel;
+			else out << " levels " << barrier.baseLevel << "-" << barrier.baseLevel + barrier.levelCount - 1;
+		}
+		out << std::hex << " : stages 0x" << barrier.srcStages << " access 0x" << barrier.srcAccess
+			<< " -> stages 0x" << barrier.dstStages << " access 0x" << barrier.dstAccess << std::dec;
+		if (barrier.oldLayout != barrier.newLayout) {
+			out << ", layout " << layoutName(barrier.oldLayout) << " -> " << layoutName(barrier.newLayout);
+		}
+		out << std::endl;
+	}
+
+	//a handle that is not VK_NULL_HANDLE, for test(). Non-dispatchable handles are pointers or uint64_t, both 64 bits.
+	template<typename Handle>
+	static Handle fakeHandle(uint64_t value) {
+		Handle handle;
+		static_assert(sizeof(handle) == sizeof(value), "non-dispatchable handles are 64 bits");
+		std::memcpy(&handle, &value, sizeof(handle));
+		return handle;
+	}
+
+	static std::string layoutName(VkImageLayout layout) {
+		switch (layout) {
+		case VK_IMAGE_LAYOUT_UNDEFINED: return "undefined";
+		case VK_IMAGE_LAYOUT_GENERAL: return "general";
+		case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL: return "color attachment";
+		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL: return "depth attachment";
+		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL: return "depth read only";
+		case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL: return "shader read only";
+		case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL: return "transfer src";
+		case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL: return "transfer dst";
+		case VK_IMAGE_LAYOUT_PREINITIALIZED: return "preinitialized";
+		case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR: return "present";
+		default: return std::to_string(layout);
+		}
+	}
+};
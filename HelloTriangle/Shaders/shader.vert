@@ -1,11 +1,17 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(binding = 0) uniform UniformBufferObject {
-    mat4 model;
-    mat4 view;
-    mat4 proj;
-} ubo;
+//proj * view * model of the draw, computed once per object on the CPU : pushed before each draw,
+//or in a uniform buffer for the --object-transforms uniform benchmark
+layout(constant_id = 0) const bool MODEL_IN_PUSH_CONSTANTS = true;
+
+layout(push_constant) uniform PushConstants {
+    mat4 mvp;
+} draw;
+
+layout(set = 1, binding = 0) uniform ObjectUniform {
+    mat4 mvp;
+} object;
 
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
@@ -14,15 +20,17 @@ layout(location = 2) in vec2 inTexCoord;
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
 
+//invariant : the depth pre-pass computes the same position in shader_depth.vert
 out gl_PerVertex {
-    vec4 gl_Position;
+    invariant vec4 gl_Position;
 };
  
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+    mat4 mvp = MODEL_IN_PUSH_CONSTANTS ? draw.mvp : object.mvp;
+    gl_Position = mvp * vec4(inPosition, 1.0);
 //	gl_Position = vec4(inPosition, 0.0, 1.0);
     fragColor = inColor;
     fragTexCoord = inTexCoord;
 	
-//    fragColor = vec3((ubo.proj * ubo.view * ubo.model * vec4(inPosition, 0.0, 1.0))[1], 0.0, 0.0);
+//    fragColor = vec3((mvp * vec4(inPosition, 0.0, 1.0))[1], 0.0, 0.0);
 }
@@ -0,0 +1,20 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+
+//every texture of the scene, partially bound: only the slots in use hold a valid image
+layout(binding = 1) uniform sampler2D textures[];
+
+//after the mvp matrix of the vertex stage
+layout(push_constant) uniform PushConstants {
+    layout(offset = 64) uint textureIndex;
+} draw;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    outColor = texture(textures[nonuniformEXT(draw.textureIndex)], fragTexCoord);
+}
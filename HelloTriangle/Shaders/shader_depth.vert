@@ -0,0 +1,25 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+//depth pre-pass : the transform of shader.vert and nothing else. Both declare gl_Position invariant, so that the
+//color pass lands on exactly the depth written here and its EQUAL depth test passes.
+layout(constant_id = 0) const bool MODEL_IN_PUSH_CONSTANTS = true;
+
+layout(push_constant) uniform PushConstants {
+    mat4 mvp;
+} draw;
+
+layout(set = 1, binding = 0) uniform ObjectUniform {
+    mat4 mvp;
+} object;
+
+layout(location = 0) in vec3 inPosition;
+
+out gl_PerVertex {
+    invariant vec4 gl_Position;
+};
+
+void main() {
+    mat4 mvp = MODEL_IN_PUSH_CONSTANTS ? draw.mvp : object.mvp;
+    gl_Position = mvp * vec4(inPosition, 1.0);
+}
@@ -0,0 +1,211 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+//MipChain : RGBA8 texture with all its mip levels, kept in CPU memory so that any range of levels can be (re)uploaded.
+//The pixels are either owned by the chain, or live in memory owned by source (e.g. a mapped asset pack).
+struct MipChain {
+	struct Level {
+		uint32_t width;
+		uint32_t height;
+		size_t offset; //in bytes()
+		size_t size;
+	};
+
+	std::vector<uint8_t> data;
+	std::vector<Level> levels;
+	const uint8_t* external = nullptr;
+	size_t externalSize = 0;
+	std::shared_ptr<const void> source;
+	//reads a range of bytes() from where they are stored (e.g. the file behind a mapping), empty when only memory holds them
+	std::function<void(size_t offset, size_t size, void* dst)> reader;
+
+	//levels laid out one after the other, in memory kept alive by source
+	static MipChain view(const uint8_t* pixels, size_t size, std::vector<Level> levels, std::shared_ptr<const void> source) {
+		MipChain chain;
+		chain.external = pixels;
+		chain.externalSize = size;
+		chain.levels = std::move(levels);
+		chain.source = std::move(source);
+		return chain;
+	}
+
+	const uint8_t* bytes() const {
+		return external != nullptr ? external : data.data();
+	}
+
+	size_t size() const {
+		return external != nullptr ? externalSize : data.size();
+	}
+
+	//box filter down to 1x1. Odd sizes clamp to the last row/column.
+	static MipChain generate(const uint8_t* rgba, uint32_t width, uint32_t height) {
+		MipChain chain;
+		uint32_t levelCount = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+
+		size_t total = 0;
+		uint32_t w = width, h = height;
+		for (uint32_t i = 0; i < levelCount; i++) {
+			chain.levels.push_back({ w, h, total, size_t(w) * h * 4 });
+			total += size_t(w) * h * 4;
+			w = std::max(1u, w / 2);
+			h = std::max(1u, h / 2);
+		}
+		chain.data.resize(total);
+		std::copy(rgba, rgba + chain.levels[0].size, chain.data.begin());
+
+		for (uint32_t i = 1; i < levelCount; i++) {
+			const Level& src = chain.levels[i - 1];
+			const Level& dst = chain.levels[i];
+			const uint8_t* in = &chain.data[src.offset];
+			uint8_t* out = &chain.data[dst.offset];
+			for (uint32_t y = 0; y < dst.height; y++) {
+				uint32_t y0 = std::min(2 * y, src.height - 1), y1 = std::min(2 * y + 1, src.height - 1);
+				for (uint32_t x = 0; x < dst.width; x++) {
+					uint32_t x0 = std::min(2 * x, src.width - 1), x1 = std::min(2 * x + 1, src.width - 1);
+					for (uint32_t c = 0; c < 4; c++) {
+						uint32_t sum = in[(y0 * src.width + x0) * 4 + c] + in[(y0 * src.width + x1) * 4 + c] +
+							in[(y1 * src.width + x0) * 4 + c] + in[(y1 * src.width + x1) * 4 + c];
+						out[(y * dst.width + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+					}
+				}
+			}
+		}
+		return chain;
+	}
+
+	uint32_t levelCount() const {
+		return static_cast<uint32_t>(levels.size());
+	}
+
+	//size of the levels [firstLevel, last], i.e. of an image whose most detailed level is firstLevel
+	size_t bytesFrom(uint32_t firstLevel) const {
+		return size() - levels[firstLevel].offset;
+	}
+
+	//first level that fits in maxSize x maxSize
+	uint32_t levelForSize(uint32_t maxSize) const {
+		for (uint32_t i = 0; i < levelCount(); i++) {
+			if (levels[i].width <= maxSize && levels[i].height <= maxSize) return i;
+		}
+		return levelCount() - 1;
+	}
+};
+
+//TextureStreamer : decides which mip levels of each texture should be resident on the GPU.
+//Every frame the renderer reports the level each texture needs (from its size on screen). The streamer turns that
+//into residency changes, keeping the total under the VRAM budget by dropping the detailed levels of the textures
+//that were used the least recently. Creating, uploading and swapping the images is left to the renderer.
+class TextureStreamer {
+public:
+	struct Change {
+		uint32_t texture;
+		uint32_t firstLevel; //most detailed level the new image should hold
+	};
+
+	explicit TextureStreamer(uint64_t budgetBytes = UINT64_MAX) : budget(budgetBytes) {}
+
+	void setBudget(uint64_t budgetBytes) {
+		budget = budgetBytes;
+	}
+
+	uint64_t getBudget() const {
+		return budget;
+	}
+
+	uint32_t addTexture(std::shared_ptr<const MipChain> mips, uint32_t residentLevel) {
+		Texture texture;
+		texture.mips = mips;
+		texture.residentLevel = residentLevel;
+		texture.wantedLevel = residentLevel;
+		textures.push_back(texture);
+		return static_cast<uint32_t>(textures.size() - 1);
+	}
+
+	const MipChain& mips(uint32_t texture) const {
+		return *textures[texture].mips;
+	}
+
+	uint32_t residentLevel(uint32_t texture) const {
+		return textures[texture].residentLevel;
+	}
+
+	//the texture is drawn this frame and needs level wantedLevel to look sharp
+	void request(uint32_t texture, uint32_t wantedLevel, uint64_t frame) {
+		Texture& t = textures[texture];
+		t.wantedLevel = std::min(wantedLevel, t.mips->levelCount() - 1);
+		t.lastUsedFrame = frame;
+	}
+
+	//level whose texels are about the size of a pixel, for a texture covering screenPixels pixels across
+	static uint32_t levelForScreenSize(const MipChain& mips, float screenPixels) {
+		if (screenPixels <= 1.0f) return mips.levelCount() - 1;
+		float texelsPerPixel = mips.levels[0].width / screenPixels;
+		if (texelsPerPixel <= 1.0f) return 0;
+		return std::min(static_cast<uint32_t>(std::floor(std::log2(texelsPerPixel))), mips.levelCount() - 1);
+	}
+
+	//at most one change per texture in flight: the renderer calls onResident once the new image replaced the old one
+	std::vector<Change> update() {
+		//start from what every texture wants, then evict detail from the least recently used ones until it fits
+		std::vector<uint32_t> target(textures.size());
+		uint64_t total = 0;
+		for (size_t i = 0; i < textures.size(); i++) {
+			target[i] = textures[i].wantedLevel;
+			total += textures[i].mips->bytesFrom(target[i]);
+		}
+
+		std::vector<size_t> lru(textures.size());
+		for (size_t i = 0; i < lru.size(); i++) lru[i] = i;
+		std::sort(lru.begin(), lru.end(), [this](size_t a, size_t b) { return textures[a].lastUsedFrame < textures[b].lastUsedFrame; });
+
+		for (size_t i = 0; total > budget && i < lru.size(); ) {
+			size_t t = lru[i];
+			const MipChain& mips = *textures[t].mips;
+			if (target[t] + 1 >= mips.levelCount()) {
+				i++; //down to 1x1, nothing left to evict here
+				continue;
+			}
+			total -= mips.bytesFrom(target[t]) - mips.bytesFrom(target[t] + 1);
+			target[t]++;
+		}
+
+		std::vector<Change> changes;
+		for (size_t i = 0; i < textures.size(); i++) {
+			Texture& t = textures[i];
+			if (!t.changePending && target[i] != t.residentLevel) {
+				t.changePending = true;
+				changes.push_back({ static_cast<uint32_t>(i), target[i] });
+			}
+		}
+		return changes;
+	}
+
+	void onResident(uint32_t texture, uint32_t firstLevel) {
+		textures[texture].residentLevel = firstLevel;
+		textures[texture].changePending = false;
+	}
+
+	uint64_t residentBytes() const {
+		uint64_t total = 0;
+		for (const Texture& t : textures) total += t.mips->bytesFrom(t.residentLevel);
+		return total;
+	}
+
+private:
+	struct Texture {
+		std::shared_ptr<const MipChain> mips;
+		uint32_t residentLevel = 0;
+		uint32_t wantedLevel = 0;
+		uint64_t lastUsedFrame = 0;
+		bool changePending = false;
+	};
+
+	uint64_t budget;
+	std::vector<Texture> textures;
+};
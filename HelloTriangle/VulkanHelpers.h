@@ -12,6 +12,50 @@
 #include <glm/glm.hpp>//linear algebra related types like vectors and matrices
 #include <glm/gtc/matrix_transform.hpp>
 #include <array>
+#include <deque>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+//DeletionQueue : holds objects that were released while the GPU may still be using them.
+//Each entry is tagged with the frame (or timeline value) it was last used in, and is only destroyed
+//once the GPU has completed that frame.
+class DeletionQueue {
+public:
+	~DeletionQueue() {
+		flush();
+	}
+
+	void push(uint64_t retireValue, std::function<void()> destroy) {
+		//keep the queue sorted so that collect() can stop at the first entry still in use
+		if (!pending.empty() && retireValue < pending.back().retireValue) {
+			retireValue = pending.back().retireValue;
+		}
+		pending.push_back({ retireValue, destroy });
+	}
+
+	void collect(uint64_t completedValue) {
+		while (!pending.empty() && pending.front().retireValue <= completedValue) {
+			pending.front().destroy();
+			pending.pop_front();
+		}
+	}
+
+	//only call this when the device is idle
+	void flush() {
+		collect(UINT64_MAX);
+	}
+
+	size_t size() const { return pending.size(); }
+
+private:
+	struct Entry {
+		uint64_t retireValue;
+		std::function<void()> destroy;
+	};
+	std::deque<Entry> pending;
+};
+
 //VDeleter : wrapper class to make sure we always cleanup VkObject-s
 
 template <typename T>
@@ -47,6 +91,23 @@ public:
 		return object;
 	}
 
+	//give up ownership of the object without destroying it
+	T release() {
+		T obj = object;
+		object = VK_NULL_HANDLE;
+		return obj;
+	}
+
+	//release the object without destroying it: the deletion queue will destroy it once retireValue has been reached
+	void retire(DeletionQueue& queue, uint64_t retireValue) {
+		if (object != VK_NULL_HANDLE) {
+			T obj = object;
+			std::function<void(T)> deletef = deleter;
+			queue.push(retireValue, [obj, deletef]() { deletef(obj); });
+		}
+		object = VK_NULL_HANDLE;
+	}
+
 private:
 	T object;
 	std::function<void(T)> deleter;
@@ -94,6 +155,7 @@ std::string FormatDebugMessage(VkDebugReportFlagsEXT flags, const char* msg) {
 enum QueueFamilyProperty {
 	GraphicsFamily,
 	PresentFamily,
+	TransferFamily,
 	NumberOfProperties
 };
 
@@ -108,22 +170,33 @@ struct QueueFamilyIndices {
 
 		for (const auto& queueFamily : queueFamilies) {
 			int i = int(&queueFamily - &*queueFamilies.begin());
+			if (queueFamily.queueCount == 0) continue;
 
-			if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+			if (index[GraphicsFamily] == -1 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
 				index[GraphicsFamily] = i;
 			}
 			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-			if (queueFamily.queueCount > 0 && presentSupport) {
+			if (surface == VK_NULL_HANDLE) {
+				presentSupport = index[GraphicsFamily] == i; //offscreen rendering: nothing is presented
+			}
+			else {
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+			}
+			if (index[PresentFamily] == -1 && presentSupport) {
 				index[PresentFamily] = i;
 			}
 
-			//to do add another queue family used specifically for memory transfers. 
-			//Until then, Vulkan will use the family with VK_QUEUE_GRAPHICS_BIT as it implicitly supports transfers
-			if (isComplete()) {
-				break;
+			//a family that can only do transfers usually maps to a dedicated DMA engine, which lets uploads run alongside rendering
+			if (index[TransferFamily] == -1 && (queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+				!(queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+				index[TransferFamily] = i;
 			}
 		}
+
+		//no dedicated family (integrated GPUs, lavapipe...): the graphics family implicitly supports transfers
+		if (index[TransferFamily] == -1) {
+			index[TransferFamily] = index[GraphicsFamily];
+		}
 	}
 
 	int operator[](int i) { return index[i]; }
@@ -131,6 +204,10 @@ struct QueueFamilyIndices {
 	bool isComplete() {
 		return std::all_of(index.begin(), index.end(), [](int i) { return i != -1; });
 	}
+	//uploads need queue family ownership transfers only when they run on another family than rendering
+	bool hasDedicatedTransfer() {
+		return index[TransferFamily] != index[GraphicsFamily];
+	}
 
 	std::vector<uint32_t> index = std::vector<uint32_t>(NumberOfProperties, -1);
 };
@@ -156,6 +233,21 @@ static std::vector<char> loadFile(const std::string& filename) {
 	return buffer;
 }
 
+//value of an environment variable, empty when it is not set
+static std::string getEnvironmentVariable(const char* name) {
+#ifdef _WIN32
+	char* value = nullptr; //getenv is deprecated by the SDL checks
+	size_t size = 0;
+	if (_dupenv_s(&value, &size, name) != 0 || value == nullptr) return "";
+	std::string result = value;
+	free(value);
+	return result;
+#else
+	const char* value = std::getenv(name);
+	return value != nullptr ? value : "";
+#endif
+}
+
 template<class T>
 void setData(uint32_t &count, T *&data, const std::vector<T> &vec) //todo
 {
@@ -202,8 +294,39 @@ struct Vertex {
 	}
 };
 
+//camera of the frame. Draws do not read it: they get their whole transform in DrawPushConstants::mvp.
 struct UniformBufferObject {
-	glm::mat4 model;
-	glm::mat4 view;
-	glm::mat4 proj;
+	glm::mat4 viewProj;
+};
+
+//per draw data, matches the PushConstants blocks of the shaders
+struct DrawPushConstants {
+	glm::mat4 mvp; //vertex stage, proj * view * model
+	uint32_t textureIndex; //fragment stage, bindless only
+};
+
+//per object input of the culling pass, matches CullObject in cull.comp
+struct CullObject {
+	glm::vec4 sphere; //bounding sphere, center in view space with z pointing forward
+	uint32_t firstIndex; //of the level of detail to draw
+	uint32_t indexCount;
+	uint32_t padding[2];
+};
+
+//matches the Cull block of cull.comp
+struct CullPushConstants {
+	glm::vec4 frustum;
+	glm::vec2 projection;
+	glm::vec2 depthTransform;
+	glm::vec2 nearFar;
+	glm::vec2 depthSize;
+	uint32_t objectCount;
+	uint32_t levelCount;
+};
+
+//counters of the culling pass, read back once its frame has completed
+struct CullStats {
+	uint32_t visible;
+	uint32_t frustumCulled;
+	uint32_t occlusionCulled;
 };
@@ -4,11 +4,28 @@
 #include <GLFW/glfw3.h>
 
 #include "VulkanHelpers.h"
+#include "GpuTimeline.h"
+#include "GpuProfiler.h"
+#include "FrameStats.h"
+#include "Benchmark.h"
+#include "TextureStreamer.h"
+#include "AssetPack.h"
+#include "AsyncFileReader.h"
+#include "DescriptorAllocator.h"
+#include "MatrixBatch.h"
+#include "MeshSimplifier.h"
+#include "RenderGraph.h"
+#include "DrawSort.h"
+#include "MeshCodec.h"
+#include "FramePacing.h"
 
 #include <iostream>
 #include <stdexcept>
 #include <functional>
 #include <chrono>
+#include <future>
+#include <map>
+#include <memory>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h> //single-file image reading library
 #define TINYOBJLOADER_IMPLEMENTATION
@@ -17,14 +34,28 @@
 const int WINDOW_WIDTH = 1000;
 const int WINDOW_HEIGHT = 1000;
 
+//number of frames the CPU is allowed to record/submit ahead of the GPU
+const int MAX_FRAMES_IN_FLIGHT = 2;
+
 const std::string MODEL_PATH = "models/chalet.obj";
-#define TEXTURE_PATH "textures/chalet.jpg"
+const std::string TEXTURE_PATH = "textures/chalet.jpg";
+const std::string VERTEX_SHADER_PATH = "shaders/vert.spv";
+const std::string DEPTH_VERTEX_SHADER_PATH = "shaders/vert_depth.spv"; //from Shaders/shader_depth.vert
+const std::string FRAGMENT_SHADER_PATH = "shaders/frag.spv";
+const std::string BINDLESS_FRAGMENT_SHADER_PATH = "shaders/frag_bindless.spv"; //from Shaders/shader_bindless.frag
+const std::string HIZ_SHADER_PATH = "shaders/hiz_downsample.spv"; //from Shaders/hiz_downsample.comp
+const std::string CULL_SHADER_PATH = "shaders/cull.spv"; //from Shaders/cull.comp
 
 const std::vector<const char*> validationLayers = {
 	"VK_LAYER_LUNARG_standard_validation"
 };
+//enabled when the device supports them
+const std::vector<const char*> optionalDeviceExtensions = {
+	VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME //staging straight from the mapped asset pack
+};
 const std::vector<const char*> deviceExtensions = {
-	VK_KHR_SWAPCHAIN_EXTENSION_NAME
+	VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+	VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME //all GPU/CPU synchronization goes through a single timeline semaphore
 };
 #ifdef NDEBUG
 const bool enableValidationLayers = false;
@@ -39,15 +70,34 @@ const bool enableValidationLayers = true;
 */
 const bool fixYAxis = true;
 
+//device to run on, by its index in the enumeration order or a part of its name, instead of the best scored suitable one
+const char* const DEVICE_OVERRIDE_ENV = "HELLOTRIANGLE_DEVICE";
+
 //const VkDebugReportFlagsEXT debugFlags = VK_DEBUG_REPORT_FLAG_BITS_MAX_ENUM_EXT;
 const VkDebugReportFlagsEXT debugFlags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
 
-//vertices of the mesh
-//#define HEART
-#ifdef HEART
-#undef TEXTURE_PATH 
-#define TEXTURE_PATH "textures/bebe2.jpg"
-const std::vector<Vertex> vertices = {
+//bindless textures (VK_EXT_descriptor_indexing) : binding 1 is a large partially bound array holding every texture, and
+//draws pick theirs with a push constant index, so textured objects are drawn without switching descriptor sets.
+//Off, or when the device lacks the extension, binding 1 is a single texture and shader.frag is used.
+const bool enableBindless = true;
+const uint32_t MAX_BINDLESS_TEXTURES = 4096;
+
+//textures start with their levels up to this size resident, and stream in detail when it is seen on screen
+const uint32_t STREAMING_INITIAL_SIZE = 128;
+//share of the largest device local heap the textures may use, unless --texture-budget is given
+const double TEXTURE_BUDGET_FRACTION = 0.5;
+
+//levels of detail generated for the scene mesh, the full one included, each with about half the triangles of the previous
+const uint32_t MESH_LOD_LEVELS = 5;
+//objects are drawn with their coarsest level whose error stays under this size on screen, unless --lod forces one
+const float LOD_ERROR_PIXELS = 1.0f;
+
+//the state the frame graph leaves the depth buffer and the depth pyramid in, and expects them in
+const RenderGraph::Access DEPTH_ATTACHMENT = RenderGraph::layoutAccess(VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+const RenderGraph::Access DEPTH_PYRAMID_READ = { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL };
+
+//vertices of the built-in scenes. The chalet is loaded from MODEL_PATH.
+const std::vector<Vertex> heartVertices = {
 	{ {  0.0f, -0.1f,  0.0f } , {  1.0f,  1.0f,  1.0f } , {  0.5f,  0.5f } },
 	{ {  0.0f,  0.6f,  0.0f } , {  1.0f,  0.0f,  0.3f } , {  0.5f,  1.0f } },
 	{ { -0.8f, -0.2f,  0.0f } , {  1.0f,  0.0f,  0.2f } , {  0.0f,  0.4f } },
@@ -56,11 +106,12 @@ const std::vector<Vertex> vertices = {
 	{ {  0.4f, -0.6f,  0.0f } , {  1.0f,  0.0f,  0.0f } , {  0.8f,  0.0f } },
 	{ {  0.8f, -0.2f,  0.0f } , {  1.0f,  0.0f,  0.2f } , {  1.0f,  0.4f } }
 };
-const std::vector<uint16_t> indices = {
+const std::vector<uint32_t> heartIndices = {
 0, 1, 2, 0, 2, 3, 0, 3, 4, 0, 4, 5, 0, 5, 6, 0, 6, 1
 };
-#else
-const std::vector<Vertex> vertices = {
+const std::string HEART_TEXTURE_PATH = "textures/bebe2.jpg";
+
+const std::vector<Vertex> cubeVertices = {
 	{ { -0.5f, -0.5f, 0.0f },{ 1.0f, 0.0f, 0.0f },{ 0.0f, 0.0f } },
 	{ { 0.5f, -0.5f, 0.0f },{ 0.0f, 1.0f, 0.0f },{ 1.0f, 0.0f } },
 	{ { 0.5f, 0.5f, 0.0f },{ 0.0f, 0.0f, 1.0f },{ 1.0f, 1.0f } },
@@ -73,22 +124,115 @@ const std::vector<Vertex> vertices = {
 };
 
 //indices to take advantage of redudancy between vertices in adjacent triangles
-const std::vector<uint16_t> indices = {
+const std::vector<uint32_t> cubeIndices = {
 	0, 1, 2, 2, 3, 0,
 	4, 5, 6, 6, 7, 4
 };
-#endif
+
+//a copy submitted on the transfer queue, and the barriers the graphics queue must execute before using its results
+struct PendingUpload {
+	uint64_t transferValue = 0;
+	std::vector<VkBufferMemoryBarrier> bufferAcquires;
+	std::vector<VkImageMemoryBarrier> imageAcquires;
+	VkPipelineStageFlags dstStages = 0;
+};
+
+//ranges of the index buffer drawn with their own model matrix, one per level of detail
+struct SceneObject {
+	std::vector<MeshLod> lods; //the full object first
+	glm::vec3 center; //the object spins around it
+	float radius;
+	uint32_t material; //of the scene, drawn with the texture materialTextures gives it
+};
+
+struct TextureData {
+	std::shared_ptr<MipChain> mips;
+	double decodeMs = 0.0;
+};
+
+//CPU side results of the startup tasks that run on worker threads, with the time they took
+struct SceneData {
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices; //every level of detail of every submesh
+	std::vector<MeshLod> lods; //the levels of the submeshes, see Submesh::firstLod
+	std::vector<Submesh> submeshes;
+	std::vector<std::string> materials; //texture path of each material, empty for the texture of the scene
+	std::map<std::string, TextureData> materialTextures; //by path, each decoded once however many materials use it
+	double loadMs = 0.0;
+	double lodMs = 0.0; //simplification, part of loadMs. Only when the mesh comes from loose files.
+};
+
+//how the bytes of an asset reached the staging memory, for the copy report
+struct UploadStats {
+	uint64_t uploadedBytes = 0;
+	uint64_t copiedBytes = 0; //copied by the CPU on the way, intermediate copies included
+	const char* path = "";
+};
+
+//a texture of the streamer on the GPU : the image holding its resident levels, and the next one while it uploads
+struct StreamedImage {
+	StreamedImage(const VDeleter<VkDevice>& device) : image{ device, vkDestroyImage }, memory{ device, vkFreeMemory },
+		view{ device, vkDestroyImageView }, pendingImage{ device, vkDestroyImage }, pendingMemory{ device, vkFreeMemory },
+		pendingView{ device, vkDestroyImageView } {}
+
+	VDeleter<VkImage> image; //unlike swap chain images, creation and deletion are handled by us
+	VDeleter<VkDeviceMemory> memory;
+	VDeleter<VkImageView> view;
+	VDeleter<VkImage> pendingImage; //uploading on the transfer queue
+	VDeleter<VkDeviceMemory> pendingMemory;
+	VDeleter<VkImageView> pendingView;
+	uint32_t pendingLevel = 0;
+	uint64_t pendingValue = 0; //transferTimeline value of its upload, 0 when there is none
+};
 
 class HelloTriangleApplication {
 public:
+	HelloTriangleApplication(const AppOptions& options) : options(options) {
+		startTime = std::chrono::high_resolution_clock::now();
+	}
+
 	void run() {
+		if (!options.packPath.empty()) {
+			writeAssetPack();
+			return;
+		}
+		if (options.ioBenchmark) {
+			runIoBenchmark();
+			return;
+		}
+		if (options.matrixBenchmark) {
+			MatrixBatch::benchmark(options.matrixBenchmarkCount, std::cout);
+			return;
+		}
+		if (options.sortBenchmark) {
+			DrawSort::benchmark(options.sortBenchmarkCount, std::cout);
+			return;
+		}
+		if (options.codecBenchmark) {
+			runCodecBenchmark();
+			return;
+		}
+		if (options.renderGraphTest) {
+			RenderGraph::test(std::cout);
+			return;
+		}
+		startLoadingTasks();
+		startup.begin("window");
 		initWindow();
 		initVulkan();
+		startup.end();
 		mainLoop();
+		if (options.cullTest) {
+			checkCullTest();
+		}
+		else if (options.benchmark) {
+			writeBenchmarkResults();
+		}
 	}
 
 private:
 	void initWindow() {
+		if (options.headless) return;
 		glfwInit();
 
 		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -100,31 +244,174 @@ private:
 		glfwSetWindowSizeCallback(window, HelloTriangleApplication::onWindowResized);
 	}
 
+	//file I/O and decoding do not need the device: start them first, and let them overlap with the Vulkan object creation
+	void startLoadingTasks() {
+		if (!options.assetsPath.empty()) {
+			//only the header and the index are read here, the workers fault in the payloads
+			startup.begin("map asset pack");
+			assets = AssetPack::open(options.assetsPath);
+		}
+
+		//files are read by the async reader and decoded on its I/O threads, the other tasks run with std::async.
+		//Serial startup defers the reads and the tasks to when their result is needed, inside the timed phases that wait for
+		//them, i.e. the old sequential startup.
+		if (options.parallelStartup) fileReader.reset(new AsyncFileReader(AsyncFileReader::defaultBackend()));
+		std::launch policy = options.parallelStartup ? std::launch::async : std::launch::deferred;
+
+		//the scene and its texture are on screen in the first frame, the shaders are only needed once the device exists
+		Scene scene = options.scene;
+		uint32_t syntheticInstances = options.syntheticInstances;
+		std::shared_ptr<AssetPack> pack = assets;
+		if (!pack && options.parallelStartup) {
+			prefetchFile(VERTEX_SHADER_PATH, AsyncFileReader::Nearby);
+			prefetchFile(enableBindless ? BINDLESS_FRAGMENT_SHADER_PATH : FRAGMENT_SHADER_PATH, AsyncFileReader::Nearby); //the likely one
+		}
+
+		if (!pack && scene == Scene::Chalet) {
+			sceneTask = readAndDecode<SceneData>(MODEL_PATH, AsyncFileReader::Visible, [](const std::vector<char>& file) {
+				SceneData data;
+				std::istringstream obj(std::string(file.begin(), file.end()));
+				loadModel(obj, MODEL_PATH, data);
+				buildSceneLods(Scene::Chalet, data);
+				loadMaterialTextures(data, nullptr);
+				return data;
+			}, &SceneData::loadMs);
+		}
+		else sceneTask = std::async(policy, [scene, syntheticInstances, pack]() {
+			auto start = std::chrono::high_resolution_clock::now();
+			SceneData data;
+			if (pack) {
+				pack->readMesh(sceneAssetName(scene, syntheticInstances), data.vertices, data.indices, data.lods, data.submeshes, data.materials);
+			}
+			else {
+				loadScene(scene, syntheticInstances, data);
+				buildSceneLods(scene, data);
+			}
+			loadMaterialTextures(data, pack);
+			data.loadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			return data;
+		});
+
+		std::string path = texturePath();
+		if (!pack) {
+			textureTask = readAndDecode<TextureData>(path, AsyncFileReader::Visible, [](const std::vector<char>& file) {
+				return decodeTexture(file);
+			}, &TextureData::decodeMs);
+		}
+		else textureTask = std::async(policy, [path, pack]() {
+			auto start = std::chrono::high_resolution_clock::now();
+			TextureData data;
+			data.mips = std::make_shared<MipChain>(AssetPack::mapTexture(pack, path)); //mips were generated by the packer
+			data.decodeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			return data;
+		});
+	}
+
+	//reads a file with the async reader, then decodes it on the I/O thread. ms receives the time from the request to the decoded result.
+	//Serial startup reads and decodes on the main thread, once the result is waited for.
+	template <typename T>
+	std::future<T> readAndDecode(const std::string& path, int priority, std::function<T(const std::vector<char>&)> decode, double T::* ms) {
+		if (!fileReader) {
+			return std::async(std::launch::deferred, [path, decode, ms]() {
+				auto start = std::chrono::high_resolution_clock::now();
+				T data = decode(loadFile(path));
+				data.*ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+				return data;
+			});
+		}
+
+		std::shared_ptr<std::promise<T>> promise = std::make_shared<std::promise<T>>();
+		auto start = std::chrono::high_resolution_clock::now();
+
+		AsyncFileReader::Request request;
+		request.path = path;
+		request.priority = priority;
+		request.onComplete = [promise, decode, ms, start](AsyncFileReader::Result& result) {
+			try {
+				if (!result.error.empty()) throw std::runtime_error(result.error);
+				T data = decode(result.data);
+				data.*ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+				promise->set_value(std::move(data));
+			}
+			catch (...) {
+				promise->set_exception(std::current_exception()); //rethrown by get() on the main thread
+			}
+		};
+		std::future<T> future = promise->get_future();
+		fileReader->read(std::move(request));
+		return future;
+	}
+
+	void prefetchFile(const std::string& path, int priority) {
+		std::shared_ptr<std::promise<std::vector<char>>> promise = std::make_shared<std::promise<std::vector<char>>>();
+		prefetchedFiles[path] = promise->get_future().share();
+
+		AsyncFileReader::Request request;
+		request.path = path;
+		request.priority = priority;
+		request.onComplete = [promise](AsyncFileReader::Result& result) {
+			if (result.error.empty()) promise->set_value(std::move(result.data));
+			else promise->set_exception(std::make_exception_ptr(std::runtime_error(result.error)));
+		};
+		fileReader->read(std::move(request));
+	}
+
+	//prefetched content when there is some, a blocking read otherwise
+	std::vector<char> readFile(const std::string& path) {
+		auto prefetched = prefetchedFiles.find(path);
+		return prefetched != prefetchedFiles.end() ? prefetched->second.get() : loadFile(path);
+	}
+
 	void initVulkan() {
+		startup.begin("instance");
 		createInstance();
 		setupDebugCallback();
 		createSurface();
+		startup.begin("device");
 		pickUpPhysicalDevice();
 		createLogicalDevice();
+		startup.begin("swap chain");
 		createSwapChain();
 		createImageViews();
+		startup.begin("pipeline");
 		createRenderPass();
 		createDescriptorSetLayout();
 		createGraphicsPipeline();
+		createCullingPipelines();
+		startup.begin("framebuffers");
 		createCommandPool();
 		createDepthResources();
+		createDepthPyramid();
 		createFramebuffers();
-		createTextureImage();
-		createTextureImageView();
+
+		//the time spent in the "wait" phases is what the workers did not manage to hide
+		startup.begin("wait texture decode");
+		TextureData texture = textureTask.get();
+		startup.record("texture decode (task)", texture.decodeMs);
+		startup.begin("texture");
+		createTextureImage(texture);
 		createTextureSampler();
-		loadModel(); 
+
+		startup.begin("wait scene load");
+		SceneData scene = sceneTask.get();
+		startup.record("scene load (task)", scene.loadMs);
+		if (!assets) startup.record("scene lods (task)", scene.lodMs);
+		vertices = std::move(scene.vertices);
+		indices = std::move(scene.indices);
+		sceneLods = std::move(scene.lods);
+		sceneSubmeshes = std::move(scene.submeshes);
+		createMaterialTextures(scene);
+		createSceneObjects();
+		startup.begin("upload");
 		createVertexBuffer();
 		createIndexBuffer();
+		finishUploads();
+		startup.begin("frame resources");
 		createUniformBuffer();
-		createDescriptorPool();
-		createDescriptorSet();
+		createCullingBuffers();
+		createDescriptorAllocator();
 		createCommandBuffers();
-		createSemaphores();
+		createSyncObjects();
 	}
 
 	static void onWindowResized(GLFWwindow* window, int width, int height) {
@@ -135,14 +422,44 @@ private:
 	}
 
 	void recreateSwapChain() {
-		vkDeviceWaitIdle(device);
+		//no vkDeviceWaitIdle here: objects that in-flight frames may still use go to the deletion queue instead
+		retireSwapChainResources();
 
 		createSwapChain();
 		createImageViews();
 		createRenderPass();
 		createGraphicsPipeline();
+		createDepthResources();
+		createDepthPyramid();
 		createFramebuffers();
-		createCommandBuffers();
+	}
+
+	void retireSwapChainResources() {
+		for (auto& framebuffer : swapChainFramebuffers) {
+			retire(framebuffer);
+		}
+		retire(graphicsPipeline);
+		retire(depthPrepassPipeline);
+		retire(pipelineLayout);
+		retire(renderPass);
+		for (auto& imageView : swapChainImageViews) {
+			retire(imageView);
+		}
+		retire(depthImageView);
+		retire(depthImage);
+		retire(depthImageMemory);
+		for (auto& levelView : depthPyramidLevelViews) {
+			retire(levelView);
+		}
+		retire(depthPyramidView);
+		retire(depthPyramid);
+		retire(depthPyramidMemory);
+	}
+
+	//the object is destroyed once every frame submitted so far has completed on the GPU
+	template <typename T>
+	void retire(VDeleter<T>& object) {
+		object.retire(deletionQueue, timeline.lastSignaledValue());
 	}
 
 	bool checkValidationLayerSupport() {
@@ -169,10 +486,12 @@ private:
 
 	void setRequiredExtensions() {
 		if (requiredExtensions.empty()) {
-			//required glfw extensions
+			//required glfw extensions (surface support), nothing when rendering offscreen
 			unsigned int glfwExtensionCount = 0;
-			const char** glfwExtensions;
-			glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+			const char** glfwExtensions = nullptr;
+			if (!options.headless) {
+				glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+			}
 
 			if (glfwExtensionCount) {
 				requiredExtensions.insert(requiredExtensions.end(), glfwExtensions, glfwExtensions + glfwExtensionCount);
@@ -217,7 +536,7 @@ private:
 		appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 		appInfo.pEngineName = "No Engine";
 		appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-		appInfo.apiVersion = VK_API_VERSION_1_0;
+		appInfo.apiVersion = VK_API_VERSION_1_1; //for vkGetPhysicalDeviceFeatures2
 
 		VkInstanceCreateInfo createInfo = {};
 		createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -268,57 +587,191 @@ private:
 	}
 
 	void createSurface() {
+		if (options.headless) return; //surface stays VK_NULL_HANDLE, QueueFamilyIndices then skips presentation
 		if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create window surface!");
 		}
 	}
 
-	bool checkDeviceSupport(VkPhysicalDevice device) {
-		//check the device properties and features
-		VkPhysicalDeviceProperties deviceProperties;
-		vkGetPhysicalDeviceProperties(device, &deviceProperties);
-		VkPhysicalDeviceFeatures deviceFeatures;
-		vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
-
-		return deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU &&
-			deviceFeatures.geometryShader;
-	}
-
-	bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
+	//the required extensions the device lacks
+	std::set<std::string> missingDeviceExtensions(VkPhysicalDevice device) {
 		uint32_t extensionCount;
 		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
 
 		std::vector<VkExtensionProperties> availableExtensions(extensionCount);
 		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
-		std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+		std::vector<const char*> extensions = getDeviceExtensions();
+		std::set<std::string> requiredExtensions(extensions.begin(), extensions.end());
 
 		for (const auto& extension : availableExtensions) {
 			requiredExtensions.erase(extension.extensionName);
 		}
 
-		return requiredExtensions.empty();
+		return requiredExtensions;
+	}
+
+	static bool supportsFormat(VkPhysicalDevice device, VkFormat format, VkFormatFeatureFlags features) {
+		VkFormatProperties props;
+		vkGetPhysicalDeviceFormatProperties(device, format, &props);
+		return (props.optimalTilingFeatures & features) == features;
+	}
+
+	bool supportsDeviceExtension(VkPhysicalDevice device, const char* name) {
+		uint32_t extensionCount;
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+		std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+		return std::any_of(availableExtensions.begin(), availableExtensions.end(),
+			[name](const VkExtensionProperties& extension) { return strcmp(extension.extensionName, name) == 0; });
+	}
+
+	//without a swap chain, VK_KHR_swapchain is not needed
+	std::vector<const char*> getDeviceExtensions() {
+		std::vector<const char*> extensions;
+		for (const char* extension : deviceExtensions) {
+			if (options.headless && strcmp(extension, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0) continue;
+			extensions.push_back(extension);
+		}
+		return extensions;
+	}
+
+	bool checkTimelineSemaphoreSupport(VkPhysicalDevice device) {
+		VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+		timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+
+		VkPhysicalDeviceFeatures2 deviceFeatures = {};
+		deviceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		deviceFeatures.pNext = &timelineFeatures;
+		vkGetPhysicalDeviceFeatures2(device, &deviceFeatures);
+
+		return timelineFeatures.timelineSemaphore == VK_TRUE;
 	}
 
-	bool isDeviceSuitable(VkPhysicalDevice device) {
+	//what the bindless texture array needs, on top of the extension
+	bool checkDescriptorIndexingSupport(VkPhysicalDevice device) {
+		VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+		indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
 
-		bool devicePropertiesSuitable = checkDeviceSupport(device);
+		VkPhysicalDeviceFeatures2 deviceFeatures = {};
+		deviceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		deviceFeatures.pNext = &indexingFeatures;
+		vkGetPhysicalDeviceFeatures2(device, &deviceFeatures);
+
+		return indexingFeatures.shaderSampledImageArrayNonUniformIndexing == VK_TRUE &&
+			indexingFeatures.descriptorBindingPartiallyBound == VK_TRUE &&
+			indexingFeatures.runtimeDescriptorArray == VK_TRUE;
+	}
+
+	//why the device cannot run the application, empty when it can. Any device type qualifies: integrated GPUs, and
+	//software ICDs such as lavapipe which report a CPU device, run it too, only slower.
+	std::vector<std::string> deviceRejections(VkPhysicalDevice device) {
+		std::vector<std::string> reasons;
 
 		//check the queue families for required operations support
-		QueueFamilyIndices indices(device,surface);
-		bool queueFamiliesSupported = indices.isComplete();
+		QueueFamilyIndices indices(device, surface);
+		if (indices[GraphicsFamily] == -1) reasons.push_back("no graphics queue");
+		if (indices[PresentFamily] == -1) reasons.push_back("cannot present to the window surface");
+		if (options.culling && indices[GraphicsFamily] != -1) {
+			uint32_t queueFamilyCount = 0;
+			vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+			std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+			vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+			if (!(queueFamilies[indices[GraphicsFamily]].queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+				reasons.push_back("graphics queue cannot run the culling compute passes");
+			}
+		}
 
-		bool deviceExtensionsSupported = checkDeviceExtensionSupport(device);
+		std::set<std::string> missingExtensions = missingDeviceExtensions(device);
+		for (const std::string& extension : missingExtensions) reasons.push_back("no " + extension);
 
-		bool swapChainAdequate = false;
-		if (deviceExtensionsSupported) {
+		if (missingExtensions.empty() && !options.headless) {
 			SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
-			swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
+			if (swapChainSupport.formats.empty() || swapChainSupport.presentModes.empty()) reasons.push_back("no surface format or present mode");
+		}
+
+		//the extension being listed does not mean the feature is there
+		if (missingExtensions.empty() && !checkTimelineSemaphoreSupport(device)) reasons.push_back("no timeline semaphores");
+
+		//formats of the images the renderer creates
+		if (!supportsFormat(device, VK_FORMAT_D32_SFLOAT, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) &&
+			!supportsFormat(device, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) &&
+			!supportsFormat(device, VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+			reasons.push_back("no sampled depth format");
+		}
+		if (!supportsFormat(device, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+			reasons.push_back("cannot sample R8G8B8A8_UNORM textures");
+		}
+		if (options.culling && !supportsFormat(device, VK_FORMAT_R32_SFLOAT, VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+			reasons.push_back("no R32_SFLOAT storage image for the depth pyramid");
+		}
+		if (options.headless && !supportsFormat(device, VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT)) {
+			reasons.push_back("cannot render to B8G8R8A8_UNORM offscreen images");
+		}
+		return reasons;
+	}
+
+	//how fast a suitable device is expected to run the application. Its type dominates, then the size of its largest device
+	//local heap (a 16 GB integrated GPU sharing system memory still loses to any discrete one), then what makes the renderer
+	//faster on it: a dedicated transfer queue, bindless textures, host memory import, anisotropic filtering, a depth format
+	//without stencil.
+	uint64_t scoreDevice(VkPhysicalDevice device) {
+		VkPhysicalDeviceProperties deviceProperties;
+		vkGetPhysicalDeviceProperties(device, &deviceProperties);
+		VkPhysicalDeviceFeatures deviceFeatures;
+		vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+		VkPhysicalDeviceMemoryProperties memProperties;
+		vkGetPhysicalDeviceMemoryProperties(device, &memProperties);
+
+		uint64_t score = 0;
+		switch (deviceProperties.deviceType) {
+		case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: score = 1000000; break;
+		case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score = 100000; break;
+		case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: score = 50000; break;
+		case VK_PHYSICAL_DEVICE_TYPE_OTHER: score = 10000; break;
+		default: break; //CPU
 		}
 
-		return devicePropertiesSuitable && queueFamiliesSupported && deviceExtensionsSupported && swapChainAdequate;
+		VkDeviceSize largestHeap = 0;
+		for (uint32_t i = 0; i < memProperties.memoryHeapCount; i++) {
+			if (memProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+				largestHeap = std::max(largestHeap, memProperties.memoryHeaps[i].size);
+			}
+		}
+		score += std::min<uint64_t>(largestHeap / (1024 * 1024), 65536); //MB, up to 64 GB
+
+		QueueFamilyIndices indices(device, surface);
+		if (indices.hasDedicatedTransfer()) score += 500;
+		if (enableBindless && supportsDeviceExtension(device, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) && checkDescriptorIndexingSupport(device)) score += 500;
+		if (supportsDeviceExtension(device, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME)) score += 200;
+		if (deviceFeatures.samplerAnisotropy) score += 200;
+		if (supportsFormat(device, VK_FORMAT_D32_SFLOAT, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) score += 100;
+		return score;
+	}
+
+	static const char* deviceTypeName(VkPhysicalDeviceType type) {
+		switch (type) {
+		case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete";
+		case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+		case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual";
+		case VK_PHYSICAL_DEVICE_TYPE_CPU: return "cpu";
+		default: return "other";
+		}
+	}
+
+	static const char* presentModeName(VkPresentModeKHR mode) {
+		switch (mode) {
+		case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+		case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+		case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+		case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo_relaxed";
+		default: return "other";
+		}
 	}
 
+	//the best scored suitable device, or the one DEVICE_OVERRIDE_ENV names. Every device is logged with its score, or
+	//with why it was rejected.
 	void pickUpPhysicalDevice() {
 		uint32_t deviceCount = 0;
 		vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
@@ -330,13 +783,40 @@ private:
 		std::vector<VkPhysicalDevice> devices(deviceCount);
 		vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
-		for (const auto& device : devices) {
-			if (isDeviceSuitable(device)) {
-				physicalDevice = device;
-				break;
+		std::string forced = getEnvironmentVariable(DEVICE_OVERRIDE_ENV);
+		uint64_t bestScore = 0;
+		bool forcedFound = false;
+		for (uint32_t i = 0; i < deviceCount; i++) {
+			VkPhysicalDeviceProperties deviceProperties;
+			vkGetPhysicalDeviceProperties(devices[i], &deviceProperties);
+			std::string name = deviceProperties.deviceName;
+			bool isForced = !forced.empty() && (forced == std::to_string(i) || name.find(forced) != std::string::npos);
+			if (isForced && forcedFound) isForced = false; //the first match only
+
+			std::cerr << "device " << i << " : " << name << " (" << deviceTypeName(deviceProperties.deviceType) << ")";
+			std::vector<std::string> reasons = deviceRejections(devices[i]);
+			if (!reasons.empty()) {
+				std::cerr << " rejected :";
+				for (const std::string& reason : reasons) std::cerr << " " << reason << (&reason == &reasons.back() ? "" : ",");
+				std::cerr << std::endl;
+				if (isForced) {
+					throw std::runtime_error(name + " given by " + DEVICE_OVERRIDE_ENV + " cannot run the application!");
+				}
+				continue;
+			}
+
+			uint64_t score = scoreDevice(devices[i]);
+			std::cerr << " score " << score << (isForced ? ", forced by " + std::string(DEVICE_OVERRIDE_ENV) : "") << std::endl;
+			if (!forcedFound && (isForced || physicalDevice == VK_NULL_HANDLE || score > bestScore)) {
+				physicalDevice = devices[i];
+				bestScore = score;
 			}
+			forcedFound = forcedFound || isForced;
 		}
 
+		if (!forced.empty() && !forcedFound) {
+			throw std::runtime_error("no device matches " + forced + " given by " + DEVICE_OVERRIDE_ENV + "!");
+		}
 		if (physicalDevice == VK_NULL_HANDLE) {
 			throw std::runtime_error("failed to find a suitable GPU!");
 		}
@@ -347,28 +827,57 @@ private:
 		QueueFamilyIndices indices(physicalDevice,surface);
 		std::set<int> uniqueQueueFamilies = indices.uniqueQueueFamilies();
 		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+		float queuePriority = 1.0f; //must outlive vkCreateDevice
 		for (auto& queueFamily : uniqueQueueFamilies) {
 			VkDeviceQueueCreateInfo queueCreateInfo = {};
 			queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
 			queueCreateInfo.queueFamilyIndex = queueFamily;
 			queueCreateInfo.queueCount = 1;
-			float queuePriority = 1.0f;
 			queueCreateInfo.pQueuePriorities = &queuePriority;
 			queueCreateInfos.push_back(queueCreateInfo);
 		}
 
+		//optional features, the renderer does without them
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
 		VkPhysicalDeviceFeatures deviceFeatures = {};
+		deviceFeatures.samplerAnisotropy = supportedFeatures.samplerAnisotropy;
+		samplerAnisotropy = supportedFeatures.samplerAnisotropy == VK_TRUE;
+
+		VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+		timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+		timelineFeatures.timelineSemaphore = VK_TRUE;
+
+		bindless = enableBindless && supportsDeviceExtension(physicalDevice, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) &&
+			checkDescriptorIndexingSupport(physicalDevice);
+		VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+		indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+		indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+		indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+		indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+		if (bindless) {
+			timelineFeatures.pNext = &indexingFeatures;
+		}
 
 		VkDeviceCreateInfo createInfo = {};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		createInfo.pNext = &timelineFeatures;
 
 		createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 		createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
 		createInfo.pEnabledFeatures = &deviceFeatures;
 
-		createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-		createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+		std::vector<const char*> extensions = getDeviceExtensions();
+		hostMemoryImport = supportsDeviceExtension(physicalDevice, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+		for (const char* extension : optionalDeviceExtensions) {
+			if (supportsDeviceExtension(physicalDevice, extension)) extensions.push_back(extension);
+		}
+		if (bindless) {
+			extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+		}
+		createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+		createInfo.ppEnabledExtensionNames = extensions.data();
 
 		if (enableValidationLayers) {
 			createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -384,6 +893,36 @@ private:
 
 		vkGetDeviceQueue(device, indices[GraphicsFamily], 0, &graphicsQueue);
 		vkGetDeviceQueue(device, indices[PresentFamily], 0, &presentQueue);
+		vkGetDeviceQueue(device, indices[TransferFamily], 0, &transferQueue); //same queue as graphicsQueue when there is no dedicated family
+		graphicsFamily = indices[GraphicsFamily];
+		transferFamily = indices[TransferFamily];
+
+		if (hostMemoryImport) {
+			getMemoryHostPointerProperties = (PFN_vkGetMemoryHostPointerPropertiesEXT)vkGetDeviceProcAddr(device, "vkGetMemoryHostPointerPropertiesEXT");
+
+			VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties = {};
+			hostProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+			VkPhysicalDeviceProperties2 properties = {};
+			properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+			properties.pNext = &hostProperties;
+			vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+			hostPointerAlignment = hostProperties.minImportedHostPointerAlignment;
+		}
+
+		if (bindless) {
+			//a combined image sampler counts as both a sampler and a sampled image
+			VkPhysicalDeviceProperties properties;
+			vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+			const VkPhysicalDeviceLimits& limits = properties.limits;
+			bindlessTextureCapacity = std::min({ MAX_BINDLESS_TEXTURES, limits.maxDescriptorSetSampledImages, limits.maxDescriptorSetSamplers,
+				limits.maxPerStageDescriptorSampledImages, limits.maxPerStageDescriptorSamplers });
+		}
+
+		timeline.create();
+		transferTimeline.create();
+		if (!options.profilePath.empty()) {
+			profiler.create(physicalDevice, graphicsFamily, MAX_FRAMES_IN_FLIGHT);
+		}
 	}
 	
 	SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device) {
@@ -433,13 +972,20 @@ private:
 	images that are already queued are simply replaced with the newer ones. This mode can be used to implement triple buffering, which allows 
 	you to avoid tearing with significantly less latency issues than standard vertical sync that uses double buffering.
 		*/
-		for (const auto& availablePresentMode : availablePresentModes) {
-			if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-				return availablePresentMode;
+		std::vector<VkPresentModeKHR> preferred;
+		switch (options.latencyMode) {
+		case LatencyMode::Immediate: preferred = { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR }; break;
+		case LatencyMode::Mailbox: preferred = { VK_PRESENT_MODE_MAILBOX_KHR }; break;
+		case LatencyMode::Vsync: break;
+		case LatencyMode::Relaxed: preferred = { VK_PRESENT_MODE_FIFO_RELAXED_KHR }; break;
+		}
+		for (VkPresentModeKHR mode : preferred) {
+			if (std::find(availablePresentModes.begin(), availablePresentModes.end(), mode) != availablePresentModes.end()) {
+				return mode;
 			}
 		}
 
-		return VK_PRESENT_MODE_FIFO_KHR;
+		return VK_PRESENT_MODE_FIFO_KHR; //the only mode every surface supports
 	}
 
 	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
@@ -456,19 +1002,42 @@ private:
 		}
 	}
 	
+	//fewer images means fewer frames queued up for the display under FIFO, and less latency, but the CPU waits for the
+	//display sooner. Mailbox needs at least one more than the minimum to always have an image to render into.
 	uint32_t chooseSwapChainImageCount(const VkSurfaceCapabilitiesKHR& capabilities) {
-		uint32_t imageCount = capabilities.minImageCount + 1;
+		uint32_t imageCount = options.swapchainImages == 0 ? capabilities.minImageCount + 1 : std::max(options.swapchainImages, capabilities.minImageCount);
 		if (capabilities.maxImageCount > 0 && imageCount > capabilities.maxImageCount) {
 			imageCount = capabilities.maxImageCount;
 		}
 		return imageCount;
 	}
 
+	//headless replacement of the swap chain : one color image per frame in flight, left in TRANSFER_SRC for a possible readback
+	void createOffscreenImages() {
+		swapChainImageFormat = VK_FORMAT_B8G8R8A8_UNORM;
+		swapChainExtent = { WINDOW_WIDTH, WINDOW_HEIGHT };
+
+		offscreenImages.resize(MAX_FRAMES_IN_FLIGHT, VDeleter<VkImage>{ device, vkDestroyImage });
+		offscreenImageMemories.resize(MAX_FRAMES_IN_FLIGHT, VDeleter<VkDeviceMemory>{ device, vkFreeMemory });
+		swapChainImages.resize(MAX_FRAMES_IN_FLIGHT);
+		for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			createImage(swapChainExtent.width, swapChainExtent.height, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+				VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				offscreenImages[i], offscreenImageMemories[i]);
+			swapChainImages[i] = offscreenImages[i];
+		}
+	}
+
 	void createSwapChain() {
+		if (options.headless) {
+			createOffscreenImages();
+			return;
+		}
+
 		SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
 
 		VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
-		VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
+		presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
 		VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
 		uint32_t imageCount = chooseSwapChainImageCount(swapChainSupport.capabilities);
 
@@ -485,10 +1054,11 @@ private:
 
 		QueueFamilyIndices indices(physicalDevice,surface);
 
+		uint32_t queueFamilyIndices[] = { static_cast<uint32_t>(indices[GraphicsFamily]), static_cast<uint32_t>(indices[PresentFamily]) };
 		if (indices[GraphicsFamily] != indices[PresentFamily]) {
 			createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-			createInfo.queueFamilyIndexCount = static_cast<uint32_t>(indices.index.size());
-			createInfo.pQueueFamilyIndices = indices.index.data();
+			createInfo.queueFamilyIndexCount = 2;
+			createInfo.pQueueFamilyIndices = queueFamilyIndices;
 		}
 		else {
 			createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE; //use same image across different queues still possible but requires explicit ownership transfer
@@ -508,12 +1078,10 @@ private:
 			throw std::runtime_error("failed to create swap chain!");
 		}
 
+		//the old swap chain may still be used by in-flight frames
+		retire(swapChain);
 		*&swapChain = newSwapChain;
 
-		if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create swap chain!");
-		}
-
 		vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr); //we only specified the minImageCount. The implementation is free to create more.
 		swapChainImages.resize(imageCount);
 		vkGetSwapchainImagesKHR(device, swapChain, &imageCount, swapChainImages.data());
@@ -522,15 +1090,16 @@ private:
 		swapChainExtent = extent;
 	}
 
-	void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VDeleter<VkImageView>& imageView) {
+	void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VDeleter<VkImageView>& imageView, uint32_t levelCount = 1,
+		uint32_t baseLevel = 0) {
 		VkImageViewCreateInfo viewInfo = {};
 		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 		viewInfo.image = image;
 		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
 		viewInfo.format = format;
 		viewInfo.subresourceRange.aspectMask = aspectFlags;
-		viewInfo.subresourceRange.baseMipLevel = 0;
-		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.baseMipLevel = baseLevel;
+		viewInfo.subresourceRange.levelCount = levelCount;
 		viewInfo.subresourceRange.baseArrayLayer = 0;
 		viewInfo.subresourceRange.layerCount = 1;
 
@@ -546,11 +1115,23 @@ private:
 		}
 	}
 	
-	void createShaderModule(const std::vector<char>& code, VDeleter<VkShaderModule>& shaderModule) {
+	//from the asset pack when there is one, no copy. From the loose .spv file otherwise.
+	void createShaderModule(const std::string& path, VDeleter<VkShaderModule>& shaderModule) {
+		if (assets) {
+			std::pair<const uint32_t*, size_t> code = assets->shader(path);
+			createShaderModule(code.first, code.second, shaderModule);
+		}
+		else {
+			std::vector<char> code = readFile(path);
+			createShaderModule((const uint32_t*)code.data(), code.size(), shaderModule);
+		}
+	}
+
+	void createShaderModule(const uint32_t* code, size_t codeSize, VDeleter<VkShaderModule>& shaderModule) {
 		VkShaderModuleCreateInfo createInfo = {};
 		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		createInfo.codeSize = code.size();
-		createInfo.pCode = (uint32_t*)code.data();
+		createInfo.codeSize = codeSize;
+		createInfo.pCode = code;
 
 		if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create shader module!");
@@ -570,6 +1151,9 @@ private:
 
 		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; //we don't care where the image comes from
 		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; //we want the image layout to be ready for presentation using the swap chain
+		if (options.headless) {
+			colorAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL; //nothing presents it
+		}
 
 		VkAttachmentReference colorAttachmentRef = {};
 		colorAttachmentRef.attachment = 0; //index in the attachment description array below.
@@ -579,7 +1163,7 @@ private:
 		depthAttachment.format = findDepthFormat();
 		depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
 		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.storeOp = options.culling ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE; //the depth pyramid is built from it
 		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
@@ -589,31 +1173,59 @@ private:
 		depthAttachmentRef.attachment = 1;
 		depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL; 
 		
+		//--depth-prepass : a first subpass only writes depth, so that the color subpass shades each pixel once
+		VkSubpassDescription depthSubPass = {};
+		depthSubPass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		depthSubPass.pDepthStencilAttachment = &depthAttachmentRef;
+
 		VkSubpassDescription subPass = {};
 		subPass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 		subPass.colorAttachmentCount = 1;
 		subPass.pColorAttachments = &colorAttachmentRef;
 		subPass.pDepthStencilAttachment = &depthAttachmentRef;
+		std::vector<VkSubpassDescription> subPasses = { subPass };
+		if (options.depthPrepass) subPasses.insert(subPasses.begin(), depthSubPass);
+		uint32_t colorSubPass = static_cast<uint32_t>(subPasses.size() - 1);
 
 		//override default dependencies
 		VkSubpassDependency dependency = {};
 		dependency.srcSubpass = VK_SUBPASS_EXTERNAL; //refers to the implicit subpass before the render pass.
-		dependency.dstSubpass = 0; //subpass index (0, the only one)
+		dependency.dstSubpass = colorSubPass; //subpass index (the last one)
 		dependency.srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
 		dependency.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
 		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 
+		//the color subpass tests against the depth of the pre-pass, pixel by pixel
+		VkSubpassDependency prepassDependency = {};
+		prepassDependency.srcSubpass = 0;
+		prepassDependency.dstSubpass = colorSubPass;
+		prepassDependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		prepassDependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		prepassDependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		prepassDependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+		prepassDependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+		//the depth clear waits for the depth tests of the previous frame, the render graph relies on it: see buildFrameGraph
+		VkSubpassDependency depthDependency = {};
+		depthDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+		depthDependency.dstSubpass = 0; //the first subpass using the depth buffer, the pre-pass or the color subpass
+		depthDependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		depthDependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		depthDependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		depthDependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		std::vector<VkSubpassDependency> dependencies = { dependency, depthDependency };
+		if (options.depthPrepass) dependencies.push_back(prepassDependency);
+
 		std::array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
 
 		VkRenderPassCreateInfo renderPassInfo = {};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
 		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
 		renderPassInfo.pAttachments = attachments.data();
-		renderPassInfo.subpassCount = 1;
-		renderPassInfo.pSubpasses = &subPass;
-		renderPassInfo.dependencyCount = 1;
-		renderPassInfo.pDependencies = &dependency;
+		renderPassInfo.subpassCount = static_cast<uint32_t>(subPasses.size());
+		renderPassInfo.pSubpasses = subPasses.data();
+		renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+		renderPassInfo.pDependencies = dependencies.data();
 
 		if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create render pass!");
@@ -630,7 +1242,7 @@ private:
 
 		VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
 		samplerLayoutBinding.binding = 1;
-		samplerLayoutBinding.descriptorCount = 1;
+		samplerLayoutBinding.descriptorCount = bindless ? bindlessTextureCapacity : 1;
 		samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 		samplerLayoutBinding.pImmutableSamplers = nullptr;
 		//we want to use the texture sampler in the fragment shader
@@ -644,19 +1256,43 @@ private:
 		layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
 		layoutInfo.pBindings = bindings.data();
 
+		//bindless : the array only holds the textures loaded so far. A set is never written once bound, a new one replaces it
+		//when the textures change (see DescriptorAllocator::getPersistent), so it needs no update after bind.
+		std::array<VkDescriptorBindingFlagsEXT, 2> bindingFlags = { 0, VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT };
+		VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+		bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+		bindingFlagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+		bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+		if (bindless) {
+			layoutInfo.pNext = &bindingFlagsInfo;
+		}
+
 		if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create descriptor set layout!");
 		}
+
+		//set 1 : the mvp matrix of an object, for --object-transforms uniform
+		VkDescriptorSetLayoutBinding objectLayoutBinding = {};
+		objectLayoutBinding.binding = 0;
+		objectLayoutBinding.descriptorCount = 1;
+		objectLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		objectLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+		VkDescriptorSetLayoutCreateInfo objectLayoutInfo = {};
+		objectLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		objectLayoutInfo.bindingCount = 1;
+		objectLayoutInfo.pBindings = &objectLayoutBinding;
+
+		if (vkCreateDescriptorSetLayout(device, &objectLayoutInfo, nullptr, &objectSetLayout) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create descriptor set layout!");
+		}
 	}
 
 	void createGraphicsPipeline() {
-		auto vertShaderCode = loadFile("shaders/vert.spv");
-		auto fragShaderCode = loadFile("shaders/frag.spv");
-
 		VDeleter<VkShaderModule> vertShaderModule{ device, vkDestroyShaderModule };
 		VDeleter<VkShaderModule> fragShaderModule{ device, vkDestroyShaderModule };
-		createShaderModule(vertShaderCode, vertShaderModule);
-		createShaderModule(fragShaderCode, fragShaderModule);
+		createShaderModule(VERTEX_SHADER_PATH, vertShaderModule);
+		createShaderModule(bindless ? BINDLESS_FRAGMENT_SHADER_PATH : FRAGMENT_SHADER_PATH, fragShaderModule);
 
 		VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
 		vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -664,6 +1300,16 @@ private:
 		vertShaderStageInfo.module = vertShaderModule;
 		vertShaderStageInfo.pName = "main";
 
+		//MODEL_IN_PUSH_CONSTANTS, so that the shader does not branch on it
+		VkBool32 modelInPushConstants = options.objectTransforms == ObjectTransforms::PushConstants;
+		VkSpecializationMapEntry specializationEntry = { 0, 0, sizeof(VkBool32) };
+		VkSpecializationInfo specializationInfo = {};
+		specializationInfo.mapEntryCount = 1;
+		specializationInfo.pMapEntries = &specializationEntry;
+		specializationInfo.dataSize = sizeof(modelInPushConstants);
+		specializationInfo.pData = &modelInPushConstants;
+		vertShaderStageInfo.pSpecializationInfo = &specializationInfo;
+
 		VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
 		fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 		fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
@@ -762,12 +1408,23 @@ private:
 		dynamicState.dynamicStateCount = 2;
 		dynamicState.pDynamicStates = dynamicStates;
 
-		VkDescriptorSetLayout setLayouts[] = { descriptorSetLayout };
+		VkDescriptorSetLayout setLayouts[] = { descriptorSetLayout, objectSetLayout };
 		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
 		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.setLayoutCount = 2;
 		pipelineLayoutInfo.pSetLayouts = setLayouts;
 
+		//DrawPushConstants : the mvp matrix for the vertex stage, and with bindless the index of the texture the draw samples
+		std::array<VkPushConstantRange, 2> pushConstantRanges = {};
+		pushConstantRanges[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		pushConstantRanges[0].offset = offsetof(DrawPushConstants, mvp);
+		pushConstantRanges[0].size = sizeof(glm::mat4);
+		pushConstantRanges[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		pushConstantRanges[1].offset = offsetof(DrawPushConstants, textureIndex);
+		pushConstantRanges[1].size = sizeof(uint32_t);
+		pipelineLayoutInfo.pushConstantRangeCount = bindless ? 2 : 1;
+		pipelineLayoutInfo.pPushConstantRanges = pushConstantRanges.data();
+
 		if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr,
 			&pipelineLayout) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create pipeline layout!");
@@ -776,8 +1433,8 @@ private:
 		VkPipelineDepthStencilStateCreateInfo depthStencil = {};
 		depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
 		depthStencil.depthTestEnable = VK_TRUE;
-		depthStencil.depthWriteEnable = VK_TRUE;
-		depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+		depthStencil.depthWriteEnable = options.depthPrepass ? VK_FALSE : VK_TRUE; //after a pre-pass the depth is final
+		depthStencil.depthCompareOp = options.depthPrepass ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS; //only the visible fragment of each pixel
 		depthStencil.depthBoundsTestEnable = VK_FALSE;
 		depthStencil.minDepthBounds = 0.0f; // Optional
 		depthStencil.maxDepthBounds = 1.0f; // Optional
@@ -802,7 +1459,7 @@ private:
 
 		pipelineInfo.layout = pipelineLayout;
 		pipelineInfo.renderPass = renderPass;
-		pipelineInfo.subpass = 0;
+		pipelineInfo.subpass = options.depthPrepass ? 1 : 0;
 
 		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; //this is to create derivative pipelines
 		pipelineInfo.basePipelineIndex = -1; // Optional
@@ -811,6 +1468,118 @@ private:
 			throw std::runtime_error("failed to create graphics pipeline!");
 		}
 
+		if (!options.depthPrepass) return;
+
+		//depth pre-pass variant : positions only and no fragment shader, so the GPU only runs the depth test and writes
+		VDeleter<VkShaderModule> depthShaderModule{ device, vkDestroyShaderModule };
+		createShaderModule(DEPTH_VERTEX_SHADER_PATH, depthShaderModule);
+		VkPipelineShaderStageCreateInfo depthShaderStageInfo = vertShaderStageInfo;
+		depthShaderStageInfo.module = depthShaderModule;
+
+		VkPipelineVertexInputStateCreateInfo positionInputInfo = vertexInputInfo;
+		positionInputInfo.vertexAttributeDescriptionCount = 1; //inPosition, location 0
+		VkPipelineColorBlendStateCreateInfo noColorBlending = colorBlending;
+		noColorBlending.attachmentCount = 0;
+		VkPipelineDepthStencilStateCreateInfo depthWrite = depthStencil;
+		depthWrite.depthWriteEnable = VK_TRUE;
+		depthWrite.depthCompareOp = VK_COMPARE_OP_LESS;
+
+		pipelineInfo.stageCount = 1;
+		pipelineInfo.pStages = &depthShaderStageInfo;
+		pipelineInfo.pVertexInputState = &positionInputInfo;
+		pipelineInfo.pColorBlendState = &noColorBlending;
+		pipelineInfo.pDepthStencilState = &depthWrite;
+		pipelineInfo.subpass = 0;
+
+		if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &depthPrepassPipeline) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create depth pre-pass pipeline!");
+		}
+	}
+
+	//the depth pyramid downsample, and the culling pass that reads it. Neither depends on the swap chain.
+	void createCullingPipelines() {
+		if (!options.culling) return;
+
+		VkDescriptorSetLayoutBinding hiZBindings[2] = {};
+		hiZBindings[0].binding = 0;
+		hiZBindings[0].descriptorCount = 1;
+		hiZBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		hiZBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		hiZBindings[1].binding = 1;
+		hiZBindings[1].descriptorCount = 1;
+		hiZBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		hiZBindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		createComputeSetLayout(hiZBindings, 2, hiZSetLayout);
+
+		VkDescriptorSetLayoutBinding cullBindings[4] = {};
+		for (uint32_t i = 0; i < 4; i++) {
+			cullBindings[i].binding = i;
+			cullBindings[i].descriptorCount = 1;
+			cullBindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			cullBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+		createComputeSetLayout(cullBindings, 4, cullSetLayout);
+
+		createComputePipeline(HIZ_SHADER_PATH, hiZSetLayout, 4 * sizeof(int32_t), hiZPipelineLayout, hiZPipeline);
+		createComputePipeline(CULL_SHADER_PATH, cullSetLayout, sizeof(CullPushConstants), cullPipelineLayout, cullPipeline);
+
+		//texelFetch only, but sampled images need a sampler
+		VkSamplerCreateInfo samplerInfo = {};
+		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerInfo.magFilter = VK_FILTER_NEAREST;
+		samplerInfo.minFilter = VK_FILTER_NEAREST;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.maxLod = 16.0f;
+		if (vkCreateSampler(device, &samplerInfo, nullptr, &depthPyramidSampler) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create depth pyramid sampler!");
+		}
+	}
+
+	void createComputeSetLayout(const VkDescriptorSetLayoutBinding* bindings, uint32_t bindingCount, VDeleter<VkDescriptorSetLayout>& setLayout) {
+		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = bindingCount;
+		layoutInfo.pBindings = bindings;
+
+		if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create descriptor set layout!");
+		}
+	}
+
+	void createComputePipeline(const std::string& path, VkDescriptorSetLayout setLayout, uint32_t pushConstantsSize,
+		VDeleter<VkPipelineLayout>& layout, VDeleter<VkPipeline>& pipeline) {
+		VDeleter<VkShaderModule> shaderModule{ device, vkDestroyShaderModule };
+		createShaderModule(path, shaderModule);
+
+		VkPushConstantRange pushConstantRange = {};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushConstantRange.size = pushConstantsSize;
+
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &setLayout;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+		if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &layout) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create pipeline layout!");
+		}
+
+		VkComputePipelineCreateInfo pipelineInfo = {};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = shaderModule;
+		pipelineInfo.stage.pName = "main";
+		pipelineInfo.layout = layout;
+
+		if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create compute pipeline!");
+		}
 	}
 
 	void createFramebuffers() {
@@ -842,11 +1611,19 @@ private:
 		VkCommandPoolCreateInfo poolInfo = {};
 		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 		poolInfo.queueFamilyIndex = queueFamilyIndices[GraphicsFamily];
-		poolInfo.flags = 0; // Optional. See these flags if you need to change the command buffers regularly
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; //the frame command buffers are recorded again every frame
 
 		if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create command pool!");
 		}
+
+		//uploads record short-lived command buffers for the transfer queue
+		poolInfo.queueFamilyIndex = queueFamilyIndices[TransferFamily];
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+		if (vkCreateCommandPool(device, &poolInfo, nullptr, &transferCommandPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create transfer command pool!");
+		}
 	}
 
 	VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
@@ -868,14 +1645,52 @@ private:
 		return findSupportedFormat(
 			{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT }, 
 			VK_IMAGE_TILING_OPTIMAL, 
-			VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+			VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
 	}
 
+	//barriers on a depth format with stencil must include both aspects
+	VkImageAspectFlags depthAspectMask() {
+		return findDepthFormat() == VK_FORMAT_D32_SFLOAT ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+	}
+
+	//without culling nothing reads the depth after the render pass (storeOp DONT_CARE): it is a transient attachment, which a
+	//tile based GPU keeps in tile memory, so its lazily allocated memory may never be backed at all
 	void createDepthResources() {
 		VkFormat depthFormat = findDepthFormat();
-		createImage(swapChainExtent.width, swapChainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
+		depthTransient = !options.culling;
+		VkImageUsageFlags depthUsage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (depthTransient ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : VK_IMAGE_USAGE_SAMPLED_BIT);
+		VkMemoryPropertyFlags depthProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | (depthTransient ? VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT : 0);
+		createImage(swapChainExtent.width, swapChainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, depthUsage, depthProperties, depthImage, depthImageMemory);
+
+		VkMemoryRequirements depthRequirements;
+		vkGetImageMemoryRequirements(device, depthImage, &depthRequirements);
+		depthMemoryBytes = depthRequirements.size;
+		depthLazilyAllocated = depthTransient && hasMemoryType(depthRequirements.memoryTypeBits, depthProperties);
 		createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, depthImageView);
-		transitionImageLayout(depthImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+		transitionImageLayout(depthImage, depthAspectMask(), 1, RenderGraph::layoutAccess(VK_IMAGE_LAYOUT_UNDEFINED), DEPTH_ATTACHMENT);
+	}
+
+	//Hi-Z : level 0 at half the resolution of the depth buffer, rounded up, then halved down to 1x1. Each texel holds the
+	//farthest depth of the pixels it covers. It stays in the general layout, written and read by compute shaders only.
+	void createDepthPyramid() {
+		if (!options.culling) return;
+
+		uint32_t width = (swapChainExtent.width + 1) / 2;
+		uint32_t height = (swapChainExtent.height + 1) / 2;
+		depthPyramidLevels = 1;
+		while ((std::max(width, height) >> depthPyramidLevels) > 0) depthPyramidLevels++;
+
+		createImage(width, height, VK_FORMAT_R32_SFLOAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthPyramid, depthPyramidMemory, depthPyramidLevels);
+		createImageView(depthPyramid, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, depthPyramidView, depthPyramidLevels);
+		depthPyramidLevelViews.resize(depthPyramidLevels, VDeleter<VkImageView>{ device, vkDestroyImageView });
+		for (uint32_t level = 0; level < depthPyramidLevels; level++) {
+			createImageView(depthPyramid, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, depthPyramidLevelViews[level], 1, level);
+		}
+
+		transitionImageLayout(depthPyramid, VK_IMAGE_ASPECT_COLOR_BIT, depthPyramidLevels, RenderGraph::layoutAccess(VK_IMAGE_LAYOUT_UNDEFINED), DEPTH_PYRAMID_READ);
+
+		depthPyramidReady = false; //until a frame has rendered into the new depth buffer
 	}
 
 	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
@@ -889,6 +1704,17 @@ private:
 		throw std::runtime_error("failed to find suitable memory type!");
 	}
 
+	bool hasMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+		VkPhysicalDeviceMemoryProperties memProperties;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+		for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+			if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+				return true;
+			}
+		}
+		return false;
+	}
+
 	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VDeleter<VkBuffer>& buffer, VDeleter<VkDeviceMemory>& bufferMemory) {
 		VkBufferCreateInfo bufferInfo = {};
 		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -914,6 +1740,7 @@ private:
 		if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
 			throw std::runtime_error("failed to allocate buffer memory!");
 		}
+		allocatedDeviceMemory += allocInfo.allocationSize;
 
 		vkBindBufferMemory(device, buffer, bufferMemory, 0);
 	}
@@ -937,18 +1764,28 @@ private:
 		return commandBuffer;
 	}
 
-	void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+	//submit without blocking: returns the timeline value to wait on. The command buffer is freed once the GPU gets past it.
+	uint64_t submitSingleTimeCommands(VkCommandBuffer commandBuffer, SubmitBatch& batch) {
 		vkEndCommandBuffer(commandBuffer);
 
-		VkSubmitInfo submitInfo = {};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffer;
+		batch.addCommandBuffer(commandBuffer);
+		uint64_t value = batch.submit(graphicsQueue, timeline);
+
+		deletionQueue.push(value, [this, commandBuffer]() {
+			if (commandPool != VK_NULL_HANDLE) {
+				vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+			}
+		});
+		return value;
+	}
 
-		vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-		vkQueueWaitIdle(graphicsQueue);
+	void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+		SubmitBatch batch;
+		uint64_t value = submitSingleTimeCommands(commandBuffer, batch);
 
-		vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer); //free the allocated command buffers
+		//only wait for this submission, not for the whole queue to go idle
+		timeline.wait(value);
+		deletionQueue.collect(timeline.completedValue());
 	}
 
 	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
@@ -963,14 +1800,14 @@ private:
 		endSingleTimeCommands(commandBuffer);
 	}
 
-	void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VDeleter<VkImage>& image, VDeleter<VkDeviceMemory>& imageMemory) {
+	void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VDeleter<VkImage>& image, VDeleter<VkDeviceMemory>& imageMemory, uint32_t mipLevels = 1) {
 		VkImageCreateInfo imageInfo = {};
 		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 		imageInfo.imageType = VK_IMAGE_TYPE_2D;
 		imageInfo.extent.width = width;
 		imageInfo.extent.height = height;
 		imageInfo.extent.depth = 1;
-		imageInfo.mipLevels = 1;
+		imageInfo.mipLevels = mipLevels;
 		imageInfo.arrayLayers = 1;
 		imageInfo.format = format;
 		imageInfo.tiling = tiling;
@@ -986,6 +1823,11 @@ private:
 		VkMemoryRequirements memRequirements;
 		vkGetImageMemoryRequirements(device, image, &memRequirements);
 
+		//lazily allocated memory only exists on some devices (tile based GPUs), elsewhere the image gets plain device local memory
+		if ((properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) && !hasMemoryType(memRequirements.memoryTypeBits, properties)) {
+			properties &= ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+		}
+
 		VkMemoryAllocateInfo allocInfo = {};
 		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 		allocInfo.allocationSize = memRequirements.size;
@@ -994,111 +1836,452 @@ private:
 		if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
 			throw std::runtime_error("failed to allocate image memory!");
 		}
+		if (!(properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)) { //only backed when the device needs it, see reportDepthMemory
+			allocatedDeviceMemory += allocInfo.allocationSize;
+		}
 
 		vkBindImageMemory(device, image, imageMemory, 0);
 	}
 
-	void transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout) {
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-		VkImageMemoryBarrier barrier = {};
-		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		barrier.oldLayout = oldLayout;
-		barrier.newLayout = newLayout;
-		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED; //if you want to use the barrier to switch the queue family
-		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		barrier.image = image;
-		if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
-			barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-		}
-		else {
-			barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		}
-		barrier.subresourceRange.baseMipLevel = 0;
-		barrier.subresourceRange.levelCount = 1;
-		barrier.subresourceRange.baseArrayLayer = 0;
-		barrier.subresourceRange.layerCount = 1;
-		if (oldLayout == VK_IMAGE_LAYOUT_PREINITIALIZED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
-			barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
-			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		}
-		else if (oldLayout == VK_IMAGE_LAYOUT_PREINITIALIZED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-			barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
-			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		}
-		else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-		}
-		else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
-			barrier.srcAccessMask = 0;
-			barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-		}
-		else {
-			throw std::invalid_argument("unsupported layout transition!");
-		}
-		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-		
-		endSingleTimeCommands(commandBuffer);
-	}
+	//a one-off layout transition, e.g. of a new image : the graph works out the barrier from the accesses before and after
+	void transitionImageLayout(VkImage image, VkImageAspectFlags aspects, uint32_t levelCount, RenderGraph::Access from, RenderGraph::Access to) {
+		RenderGraph graph;
+		graph.exportResource(graph.importImage("image", image, aspects, levelCount, from), to);
+		graph.compile();
 
-	void copyImage(VkImage srcImage, VkImage dstImage, uint32_t width, uint32_t height) {
 		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-		VkImageSubresourceLayers subResource = {};
-		subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		subResource.baseArrayLayer = 0;
-		subResource.mipLevel = 0;
-		subResource.layerCount = 1;
-
-		VkImageCopy region = {};
-		region.srcSubresource = subResource;
-		region.dstSubresource = subResource;
-		region.srcOffset = { 0, 0, 0 };
-		region.dstOffset = { 0, 0, 0 };
-		region.extent.width = width;
-		region.extent.height = height;
-		region.extent.depth = 1;
-
-		vkCmdCopyImage(
-			commandBuffer,
-			srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			1, &region
-		);
-
+		graph.execute(commandBuffer);
 		endSingleTimeCommands(commandBuffer);
 	}
 
-	void createTextureImage() {
-		int texWidth, texHeight, texChannels;
-		//texture needs to be square. todo: understand why.
-		stbi_uc* pixels = stbi_load(TEXTURE_PATH, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-		VkDeviceSize imageSize = texWidth * texHeight * 4;
+	VkCommandBuffer beginTransferCommands() {
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = transferCommandPool;
+		allocInfo.commandBufferCount = 1;
 
-		if (!pixels) {
-			throw std::runtime_error("failed to load texture image!");
+		VkCommandBuffer commandBuffer;
+		if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate transfer command buffer!");
 		}
 
-		createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_LINEAR, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingImage, stagingImageMemory);
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-		void* data;
-		vkMapMemory(device, stagingImageMemory, 0, imageSize, 0, &data);
-		memcpy(data, pixels, (size_t)imageSize);
-		vkUnmapMemory(device, stagingImageMemory);
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
-		stbi_image_free(pixels);
+		return commandBuffer;
+	}
+
+	//submit an upload on the transfer queue. The acquire barriers of the upload are recorded on the graphics queue
+	//by acquireCompletedUploads() once the copy is done, so rendering never waits for a copy still in progress.
+	uint64_t submitTransferCommands(VkCommandBuffer commandBuffer, PendingUpload& upload) {
+		vkEndCommandBuffer(commandBuffer);
+
+		SubmitBatch batch;
+		batch.addCommandBuffer(commandBuffer);
+		upload.transferValue = batch.submit(transferQueue, transferTimeline);
+
+		transferDeletionQueue.push(upload.transferValue, [this, commandBuffer]() {
+			if (transferCommandPool != VK_NULL_HANDLE) {
+				vkFreeCommandBuffers(device, transferCommandPool, 1, &commandBuffer);
+			}
+		});
+		pendingUploads.push_back(upload);
+		return upload.transferValue;
+	}
+
+	//make the written range visible to the graphics queue: a release/acquire pair when the copy ran on another
+	//queue family, a plain barrier at the end of the copy otherwise
+	void releaseBuffer(VkCommandBuffer commandBuffer, PendingUpload& upload, VkBuffer buffer, VkDeviceSize size, VkAccessFlags dstAccess, VkPipelineStageFlags dstStage) {
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.buffer = buffer;
+		barrier.offset = 0;
+		barrier.size = size;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		if (transferFamily != graphicsFamily) {
+			barrier.srcQueueFamilyIndex = transferFamily;
+			barrier.dstQueueFamilyIndex = graphicsFamily;
+			barrier.dstAccessMask = 0; //ignored for the release half
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+			barrier.srcAccessMask = 0; //ignored for the acquire half
+			barrier.dstAccessMask = dstAccess;
+			upload.bufferAcquires.push_back(barrier);
+			upload.dstStages |= dstStage;
+		}
+		else {
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstAccessMask = dstAccess;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+		}
+	}
+
+	void releaseImage(VkCommandBuffer commandBuffer, PendingUpload& upload, VkImage image, uint32_t levelCount, VkImageLayout newLayout, VkAccessFlags dstAccess, VkPipelineStageFlags dstStage) {
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = newLayout; //the layout transition happens once, between the release and the acquire
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = levelCount;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		if (transferFamily != graphicsFamily) {
+			barrier.srcQueueFamilyIndex = transferFamily;
+			barrier.dstQueueFamilyIndex = graphicsFamily;
+			barrier.dstAccessMask = 0;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = dstAccess;
+			upload.imageAcquires.push_back(barrier);
+			upload.dstStages |= dstStage;
+		}
+		else {
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstAccessMask = dstAccess;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		}
+	}
+
+	//copy a staging buffer into a device local buffer on the transfer queue
+	uint64_t uploadBuffer(VDeleter<VkBuffer>& stagingBuffer, VDeleter<VkDeviceMemory>& stagingBufferMemory, VkBuffer dstBuffer, VkDeviceSize size, VkAccessFlags dstAccess, VkPipelineStageFlags dstStage) {
+		VkCommandBuffer commandBuffer = beginTransferCommands();
+
+		VkBufferCopy copyRegion = {};
+		copyRegion.size = size;
+		vkCmdCopyBuffer(commandBuffer, stagingBuffer, dstBuffer, 1, &copyRegion);
+
+		PendingUpload upload;
+		releaseBuffer(commandBuffer, upload, dstBuffer, size, dstAccess, dstStage);
+		uint64_t value = submitTransferCommands(commandBuffer, upload);
+
+		//the staging memory has to live until the copy is done
+		stagingBuffer.retire(transferDeletionQueue, value);
+		stagingBufferMemory.retire(transferDeletionQueue, value);
+		return value;
+	}
+
+	//copy a staging buffer into the mip levels of an image (one region per level), and leave it ready to be sampled
+	uint64_t uploadImage(VDeleter<VkBuffer>& stagingBuffer, VDeleter<VkDeviceMemory>& stagingBufferMemory, VkImage dstImage, const std::vector<VkBufferImageCopy>& regions) {
+		uint32_t levelCount = static_cast<uint32_t>(regions.size());
+		VkCommandBuffer commandBuffer = beginTransferCommands();
+
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED; //previous contents are discarded
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = dstImage;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = levelCount;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, levelCount, regions.data());
+
+		PendingUpload upload;
+		releaseImage(commandBuffer, upload, dstImage, levelCount, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+		uint64_t value = submitTransferCommands(commandBuffer, upload);
+
+		stagingBuffer.retire(transferDeletionQueue, value);
+		stagingBufferMemory.retire(transferDeletionQueue, value);
+		return value;
+	}
+
+	//hand the finished uploads over to the graphics queue. Uploads still in progress are left alone
+	//unless wait is set, so a large upload never holds back the frames submitted meanwhile.
+	void acquireCompletedUploads(bool wait) {
+		transferDeletionQueue.collect(transferTimeline.completedValue());
+
+		std::vector<VkBufferMemoryBarrier> bufferBarriers;
+		std::vector<VkImageMemoryBarrier> imageBarriers;
+		VkPipelineStageFlags dstStages = 0;
+		uint64_t transferValue = 0;
+
+		while (!pendingUploads.empty()) {
+			PendingUpload& upload = pendingUploads.front();
+			if (!wait && !transferTimeline.isComplete(upload.transferValue)) {
+				break; //uploads complete in submission order
+			}
+			bufferBarriers.insert(bufferBarriers.end(), upload.bufferAcquires.begin(), upload.bufferAcquires.end());
+			imageBarriers.insert(imageBarriers.end(), upload.imageAcquires.begin(), upload.imageAcquires.end());
+			dstStages |= upload.dstStages;
+			transferValue = upload.transferValue;
+			pendingUploads.pop_front();
+		}
+		if (transferValue != 0) {
+			acquiredTransferValue = transferValue; //frames submitted from now on may use everything up to here
+		}
+
+		if (bufferBarriers.empty() && imageBarriers.empty()) return; //nothing to acquire (same queue family, or nothing done yet)
+
+		//all acquire barriers are batched in one command buffer, ordered before every later frame on the graphics queue
+		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStages, 0, 0, nullptr,
+			static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+			static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+
+		SubmitBatch batch;
+		batch.wait(transferTimeline, transferValue, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+		submitSingleTimeCommands(commandBuffer, batch);
+	}
+
+	//used at startup, when the first frame needs everything
+	void finishUploads() {
+		acquireCompletedUploads(true);
+	}
+
+	//pure CPU work, runs on a worker thread
+	static TextureData decodeTexture(const std::string& texturePath) {
+		return decodeTexture(loadFile(texturePath));
+	}
+
+	static TextureData decodeTexture(const std::vector<char>& file) {
+		TextureData texture;
+		int texChannels;
+		//texture needs to be square. todo: understand why.
+		int width, height;
+		stbi_uc* pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(file.data()), static_cast<int>(file.size()), &width, &height, &texChannels, STBI_rgb_alpha);
+
+		if (!pixels) {
+			throw std::runtime_error("failed to load texture image!");
+		}
+		//the whole chain is kept in memory, the streamer uploads the levels it needs when it needs them
+		texture.mips = std::make_shared<MipChain>(MipChain::generate(pixels, width, height));
+		stbi_image_free(pixels);
+		return texture;
+	}
+
+	void createTextureImage(const TextureData& texture) {
+		textureStreamer.setBudget(textureBudget());
+		sceneTextureId = addStreamedTexture(texture);
+	}
+
+	//the texture of each material of the scene, sharing the images of the materials using the same file. Materials without
+	//a texture use the one of the scene, and so do all of them without bindless: only a single texture can be bound then.
+	void createMaterialTextures(const SceneData& scene) {
+		std::map<std::string, uint32_t> textureIds;
+		materialTextures.clear();
+		for (const std::string& path : scene.materials) {
+			auto texture = scene.materialTextures.find(path);
+			if (!bindless || texture == scene.materialTextures.end()) {
+				materialTextures.push_back(sceneTextureId);
+				continue;
+			}
+			auto id = textureIds.find(path);
+			if (id == textureIds.end()) {
+				if (textureImages.size() >= bindlessTextureCapacity) {
+					throw std::runtime_error("too many textures for the bindless texture array!");
+				}
+				id = textureIds.insert({ path, addStreamedTexture(texture->second) }).first;
+			}
+			materialTextures.push_back(id->second);
+		}
+	}
+
+	//only the small levels at startup: the first frame does not wait for the full resolution upload
+	uint32_t addStreamedTexture(const TextureData& texture) {
+		uint32_t initialLevel = texture.mips->levelForSize(STREAMING_INITIAL_SIZE);
+		uint32_t id = textureStreamer.addTexture(texture.mips, initialLevel);
+		textureImages.emplace_back(new StreamedImage(device));
+		StreamedImage& streamed = *textureImages.back();
+		createStreamedImage(id, initialLevel, streamed.image, streamed.memory, streamed.view);
+		return id;
+	}
+
+	VkDeviceSize textureBudget() {
+		if (options.textureBudgetMB > 0) {
+			return VkDeviceSize(options.textureBudgetMB) * 1024 * 1024;
+		}
 
-		createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory	);
+		VkPhysicalDeviceMemoryProperties memProperties;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+		VkDeviceSize largestHeap = 0;
+		for (uint32_t i = 0; i < memProperties.memoryHeapCount; i++) {
+			if (memProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+				largestHeap = std::max(largestHeap, memProperties.memoryHeaps[i].size);
+			}
+		}
+		return static_cast<VkDeviceSize>(largestHeap * TEXTURE_BUDGET_FRACTION);
+	}
 
-		transitionImageLayout(stagingImage, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-		transitionImageLayout(textureImage, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-		copyImage(stagingImage, textureImage, texWidth, texHeight);
-		transitionImageLayout(textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	//image holding the levels [firstLevel, last] of a streamed texture. The upload runs on the transfer queue, the returned
+	//value tells when it is done. Level firstLevel of the texture becomes level 0 of the image: sampling uses normalized coordinates.
+	uint64_t createStreamedImage(uint32_t texture, uint32_t firstLevel, VDeleter<VkImage>& image, VDeleter<VkDeviceMemory>& imageMemory, VDeleter<VkImageView>& imageView) {
+		const MipChain& mips = textureStreamer.mips(texture);
+		uint32_t levelCount = mips.levelCount() - firstLevel;
+		VkDeviceSize imageSize = mips.bytesFrom(firstLevel);
+		size_t firstOffset = mips.levels[firstLevel].offset;
+
+		//a staging buffer rather than a linear image: the transfer queue copies it straight into the optimal tiled image
+		VDeleter<VkBuffer> stagingBuffer{ device, vkDestroyBuffer };
+		VDeleter<VkDeviceMemory> stagingBufferMemory{ device, vkFreeMemory };
+		VkDeviceSize stagingOffset = 0;
+		UploadStats& stats = uploadStats["texture"];
+		stats.uploadedBytes += imageSize;
+
+		//mips.external is set when the levels live in the mapped asset pack: the mapping itself can then be the staging buffer
+		if (options.stagingIo == StagingIo::Import && mips.external != nullptr &&
+			importHostMemory(mips.bytes() + firstOffset, imageSize, stagingBuffer, stagingBufferMemory, stagingOffset)) {
+			stats.path = "import";
+		}
+		else {
+			createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+			void* data;
+			vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
+			if (options.stagingIo != StagingIo::Copy && mips.reader) {
+				mips.reader(firstOffset, (size_t)imageSize, data); //the kernel fills the staging memory, no copy on our side
+				stats.path = "read";
+			}
+			else {
+				memcpy(data, mips.bytes() + firstOffset, (size_t)imageSize);
+				stats.copiedBytes += imageSize;
+				stats.path = "copy";
+			}
+			vkUnmapMemory(device, stagingBufferMemory);
+		}
+
+		std::vector<VkBufferImageCopy> regions(levelCount);
+		for (uint32_t i = 0; i < levelCount; i++) {
+			const MipChain::Level& level = mips.levels[firstLevel + i];
+			regions[i].bufferOffset = stagingOffset + level.offset - firstOffset;
+			regions[i].bufferRowLength = 0; //tightly packed
+			regions[i].bufferImageHeight = 0;
+			regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			regions[i].imageSubresource.mipLevel = i;
+			regions[i].imageSubresource.baseArrayLayer = 0;
+			regions[i].imageSubresource.layerCount = 1;
+			regions[i].imageOffset = { 0, 0, 0 };
+			regions[i].imageExtent = { level.width, level.height, 1 };
+		}
+
+		const MipChain::Level& top = mips.levels[firstLevel];
+		createImage(top.width, top.height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory, levelCount);
+		createImageView(image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, imageView, levelCount); //format can be different from swap chain image
+
+		return uploadImage(stagingBuffer, stagingBufferMemory, image, regions);
 	}
 
-	void createTextureImageView() {
-		createImageView(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, textureImageView); //format can be different from swap chain image
+	//wraps host memory in a transfer source buffer without copying it (VK_EXT_external_memory_host). The import has to cover
+	//whole aligned blocks, so offset tells where pointer is in the buffer. Returns false when the driver refuses the memory,
+	//e.g. some only accept anonymous allocations and not file mappings: the caller then copies as usual.
+	bool importHostMemory(const void* pointer, VkDeviceSize size, VDeleter<VkBuffer>& buffer, VDeleter<VkDeviceMemory>& bufferMemory, VkDeviceSize& offset) {
+		//the aligned block must not go past the mapped pages: only alignments up to the page size are safe
+		if (!hostMemoryImport || hostPointerAlignment == 0 || hostPointerAlignment > AssetPack::PAGE_ALIGNMENT) return false;
+
+		uintptr_t address = reinterpret_cast<uintptr_t>(pointer);
+		uintptr_t alignedAddress = address & ~static_cast<uintptr_t>(hostPointerAlignment - 1);
+		VkDeviceSize alignedSize = (address - alignedAddress + size + hostPointerAlignment - 1) & ~(hostPointerAlignment - 1);
+		void* alignedPointer = reinterpret_cast<void*>(alignedAddress);
+
+		VkMemoryHostPointerPropertiesEXT pointerProperties = {};
+		pointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+		if (getMemoryHostPointerProperties(device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, alignedPointer, &pointerProperties) != VK_SUCCESS) {
+			return false;
+		}
+
+		VkExternalMemoryBufferCreateInfo externalInfo = {};
+		externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+		externalInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.pNext = &externalInfo;
+		bufferInfo.size = alignedSize;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+			return false;
+		}
+
+		VkMemoryRequirements memRequirements;
+		vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+		uint32_t typeBits = memRequirements.memoryTypeBits & pointerProperties.memoryTypeBits;
+		if (typeBits == 0) {
+			return false; //buffer is destroyed when the caller creates its regular staging buffer in its place
+		}
+
+		VkImportMemoryHostPointerInfoEXT importInfo = {};
+		importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+		importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+		importInfo.pHostPointer = alignedPointer;
+
+		VkMemoryAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.pNext = &importInfo;
+		allocInfo.allocationSize = alignedSize;
+		allocInfo.memoryTypeIndex = 0;
+		while (!(typeBits & (1u << allocInfo.memoryTypeIndex))) allocInfo.memoryTypeIndex++;
+
+		if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
+			return false;
+		}
+		vkBindBufferMemory(device, buffer, bufferMemory, 0);
+		offset = address - alignedAddress;
+		return true;
+	}
+
+	//once a frame : swap in the images that finished uploading, then start the next residency changes. The streamer has
+	//at most one change in flight per texture, so each texture has at most one new image in flight.
+	void streamTextures() {
+		for (uint32_t texture = 0; texture < textureImages.size(); texture++) {
+			StreamedImage& streamed = *textureImages[texture];
+			if (streamed.pendingValue == 0 || streamed.pendingValue > acquiredTransferValue) continue;
+
+			//frames in flight still sample the old image: it goes through the deletion queue
+			retire(streamed.view);
+			retire(streamed.image);
+			retire(streamed.memory);
+			*&streamed.image = streamed.pendingImage.release();
+			*&streamed.memory = streamed.pendingMemory.release();
+			*&streamed.view = streamed.pendingView.release();
+
+			textureStreamer.onResident(texture, streamed.pendingLevel);
+			streamed.pendingValue = 0;
+		}
+
+		for (const TextureStreamer::Change& change : textureStreamer.update()) {
+			StreamedImage& streamed = *textureImages[change.texture];
+			streamed.pendingLevel = change.firstLevel;
+			streamed.pendingValue = createStreamedImage(change.texture, change.firstLevel, streamed.pendingImage, streamed.pendingMemory, streamed.pendingView);
+		}
+	}
+
+	//ask for the level matching the size on screen of the largest object drawn with each texture: its bounding sphere,
+	//projected with the frame's matrices. Textures no object uses are not requested, the streamer evicts them first.
+	void requestTextureLevels(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& sceneModel) {
+		textureScreenPixels.assign(textureImages.size(), 0.0f);
+		for (const SceneObject& object : objects) {
+			glm::vec4 center = view * sceneModel * glm::vec4(object.center, 1.0f);
+			float distance = -center.z;
+			float screenPixels = distance > object.radius
+				? object.radius * std::abs(proj[1][1]) * swapChainExtent.height / distance
+				: static_cast<float>(std::max(swapChainExtent.width, swapChainExtent.height)); //camera inside the bounds
+			float& pixels = textureScreenPixels[materialTextures[object.material]];
+			pixels = std::max(pixels, screenPixels);
+		}
+		for (uint32_t texture = 0; texture < textureImages.size(); texture++) {
+			if (textureScreenPixels[texture] == 0.0f) continue;
+			uint32_t level = TextureStreamer::levelForScreenSize(textureStreamer.mips(texture), textureScreenPixels[texture]);
+			textureStreamer.request(texture, level, frameNumber);
+		}
 	}
 
 	void createTextureSampler() {
@@ -1116,9 +2299,11 @@ private:
 		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
 		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
 
-		//use anisotropic filtering to preserve high-frequency details at extreme view angles
-		samplerInfo.anisotropyEnable = VK_TRUE;
-		samplerInfo.maxAnisotropy = 16; //max number of taps. No need to go beyond 16 (unsupported and negligible)
+		//use anisotropic filtering to preserve high-frequency details at extreme view angles, when the device has it
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		samplerInfo.anisotropyEnable = samplerAnisotropy ? VK_TRUE : VK_FALSE;
+		samplerInfo.maxAnisotropy = samplerAnisotropy ? std::min(16.0f, properties.limits.maxSamplerAnisotropy) : 1.0f; //max number of taps. No need to go beyond 16 (unsupported and negligible)
 
 		samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_WHITE;
 
@@ -1127,7 +2312,7 @@ private:
 		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 		samplerInfo.mipLodBias = 0.0f;
 		samplerInfo.minLod = 0.0f;
-		samplerInfo.maxLod = 0.0f;
+		samplerInfo.maxLod = VK_LOD_CLAMP_NONE; //every level the streamed image holds
 
 		//n.b. the sampler is a generic object and is not linked to a specific texture.
 		if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS) {
@@ -1135,33 +2320,322 @@ private:
 		}
 	}
 	
-	void loadModel() {
+	//bounding sphere of the triangles of an index range, to estimate their size on screen
+	static void computeBounds(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t firstIndex, uint32_t indexCount,
+		glm::vec3& center, float& radius) {
+		glm::vec3 minimum = indexCount == 0 ? glm::vec3(0.0f) : vertices[indices[firstIndex]].pos;
+		glm::vec3 maximum = minimum;
+		for (uint32_t i = firstIndex; i < firstIndex + indexCount; i++) {
+			minimum = glm::min(minimum, vertices[indices[i]].pos);
+			maximum = glm::max(maximum, vertices[indices[i]].pos);
+		}
+		center = (minimum + maximum) * 0.5f;
+		radius = glm::length(maximum - minimum) * 0.5f;
+	}
+
+	//--object-draws : every cube of the synthetic scene is its own object. Otherwise each submesh of the scene is one.
+	void createSceneObjects() {
+		objects.clear();
+		if (!options.objectDraws) {
+			for (const Submesh& submesh : sceneSubmeshes) {
+				std::vector<MeshLod> lods(sceneLods.begin() + submesh.firstLod, sceneLods.begin() + submesh.firstLod + submesh.lodCount);
+				objects.push_back({ lods, submesh.center, submesh.radius, submesh.material });
+			}
+			return;
+		}
+
+		uint32_t indexCount = static_cast<uint32_t>(cubeIndices.size());
+		for (uint32_t first = 0; first < sceneLods[0].indexCount; first += indexCount) {
+			SceneObject object = { { { first, indexCount, 0.0f } }, glm::vec3(), 0.0f, 0 };
+			computeBounds(vertices, indices, first, indexCount, object.center, object.radius);
+			objects.push_back(object);
+		}
+	}
+
+	//triangles and error of each level of detail over all the submeshes, those with fewer levels counting their last one
+	static std::vector<MeshLod> sceneLevels(const std::vector<MeshLod>& lods, const std::vector<Submesh>& submeshes) {
+		uint32_t levelCount = 0;
+		for (const Submesh& submesh : submeshes) levelCount = std::max(levelCount, submesh.lodCount);
+		std::vector<MeshLod> levels(levelCount, { 0, 0, 0.0f });
+		for (uint32_t level = 0; level < levelCount; level++) {
+			for (const Submesh& submesh : submeshes) {
+				const MeshLod& lod = lods[submesh.firstLod + std::min(level, submesh.lodCount - 1)];
+				levels[level].indexCount += lod.indexCount;
+				levels[level].error = std::max(levels[level].error, lod.error);
+			}
+		}
+		return levels;
+	}
+
+	std::string texturePath() const {
+		return options.scene == Scene::Heart ? HEART_TEXTURE_PATH : TEXTURE_PATH;
+	}
+
+	//name of the scene mesh in the asset pack
+	static std::string sceneAssetName(Scene scene, uint32_t syntheticInstances) {
+		std::string name = AppOptions::sceneName(scene);
+		return scene == Scene::Synthetic ? name + ":" + std::to_string(syntheticInstances) : name;
+	}
+
+	//--io-benchmark : the files given, or the assets of the scene, read cold then warm with every reader backend
+	void runIoBenchmark() {
+		std::vector<std::string> files = options.ioBenchmarkFiles;
+		if (files.empty()) {
+			files = { MODEL_PATH, TEXTURE_PATH, HEART_TEXTURE_PATH, VERTEX_SHADER_PATH, FRAGMENT_SHADER_PATH };
+			if (!options.assetsPath.empty()) files.push_back(options.assetsPath);
+		}
+		AsyncFileReader::benchmark(files, std::cout);
+	}
+
+	//--codec-benchmark : the streams of the scene as the asset pack stores them, every level of detail included
+	void runCodecBenchmark() {
+		SceneData scene;
+		loadScene(options.scene, options.syntheticInstances, scene);
+		buildSceneLods(options.scene, scene);
+		std::cout << AppOptions::sceneName(options.scene) << " : " << scene.vertices.size() << " vertices, " << scene.indices.size() << " indices" << std::endl;
+		MeshCodec::benchmark(scene.vertices, scene.indices, std::cout);
+	}
+
+	//--pack : the scene, its textures with all their mip levels and the shaders, in one file. No window nor device needed.
+	void writeAssetPack() {
+		auto start = std::chrono::high_resolution_clock::now();
+		SceneData scene;
+		loadScene(options.scene, options.syntheticInstances, scene);
+		buildSceneLods(options.scene, scene);
+		loadMaterialTextures(scene, nullptr);
+		TextureData texture = decodeTexture(texturePath());
+		double looseMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		AssetPackWriter writer;
+		writer.addMesh(sceneAssetName(options.scene, options.syntheticInstances), scene.vertices, scene.indices, scene.lods, scene.submeshes, scene.materials);
+		writer.addTexture(texturePath(), *texture.mips);
+		for (const auto& material : scene.materialTextures) {
+			if (material.first != texturePath()) writer.addTexture(material.first, *material.second.mips);
+		}
+		writer.addShader(VERTEX_SHADER_PATH, loadFile(VERTEX_SHADER_PATH));
+		writer.addShader(DEPTH_VERTEX_SHADER_PATH, loadFile(DEPTH_VERTEX_SHADER_PATH));
+		writer.addShader(FRAGMENT_SHADER_PATH, loadFile(FRAGMENT_SHADER_PATH));
+		writer.addShader(BINDLESS_FRAGMENT_SHADER_PATH, loadFile(BINDLESS_FRAGMENT_SHADER_PATH));
+		writer.addShader(HIZ_SHADER_PATH, loadFile(HIZ_SHADER_PATH));
+		writer.addShader(CULL_SHADER_PATH, loadFile(CULL_SHADER_PATH));
+		uint64_t size = writer.write(options.packPath);
+
+		//load it back the way the application does, to compare with the loose files. Both are measured with a warm file
+		//cache: this is the CPU cost of loading, not the disk speed. The hashes are checked apart, the application doesn't.
+		start = std::chrono::high_resolution_clock::now();
+		std::shared_ptr<AssetPack> pack = AssetPack::open(options.packPath);
+		SceneData packedScene;
+		pack->readMesh(sceneAssetName(options.scene, options.syntheticInstances), packedScene.vertices, packedScene.indices, packedScene.lods,
+			packedScene.submeshes, packedScene.materials);
+		MipChain packedMips = AssetPack::mapTexture(pack, texturePath());
+		double packMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		start = std::chrono::high_resolution_clock::now();
+		pack->verify();
+		double verifyMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		if (packedScene.vertices.size() != scene.vertices.size() || packedScene.submeshes.size() != scene.submeshes.size() ||
+			packedScene.materials != scene.materials || packedMips.size() != texture.mips->size()) {
+			throw std::runtime_error("failed to read back " + options.packPath + "!");
+		}
+		std::cout << "packed " << AppOptions::sceneName(options.scene) << " into " << options.packPath << " (" << size / 1024 << " KB)" << std::endl;
+		size_t meshBytes = scene.vertices.size() * sizeof(Vertex) + scene.indices.size() * sizeof(uint32_t);
+		std::cout << "  mesh : " << meshBytes / 1024 << " KB of vertices and indices, " << pack->get(sceneAssetName(options.scene, options.syntheticInstances),
+			AssetType::Mesh).size / 1024 << " KB packed" << std::endl;
+		std::cout << "  load from loose files : " << looseMs << " ms (parse, decode, generate mips, simplify)" << std::endl;
+		std::cout << "  " << scene.submeshes.size() << " submeshes, " << scene.materials.size() << " materials, "
+			<< scene.materialTextures.size() << " material textures" << std::endl;
+		std::vector<MeshLod> levels = sceneLevels(scene.lods, scene.submeshes);
+		for (size_t i = 0; i < levels.size(); i++) {
+			std::cout << "  lod " << i << " : " << levels[i].indexCount / 3 << " triangles, error " << levels[i].error << std::endl;
+		}
+		std::cout << "  load from asset pack : " << packMs << " ms (map, decode mesh)" << std::endl;
+		std::cout << "  verify asset pack hashes : " << verifyMs << " ms (not on the loading path)" << std::endl;
+	}
+
+	//pure CPU work, runs on a worker thread: must not touch the members of the application
+	static void loadScene(Scene scene, uint32_t syntheticInstances, SceneData& data) {
+		switch (scene) {
+		case Scene::Cube:
+			data.vertices = cubeVertices;
+			data.indices = cubeIndices;
+			break;
+		case Scene::Heart:
+			data.vertices = heartVertices;
+			data.indices = heartIndices;
+			break;
+		case Scene::Chalet: {
+			std::ifstream obj(MODEL_PATH);
+			if (!obj.is_open()) {
+				throw std::runtime_error("failed to open " + MODEL_PATH + "!");
+			}
+			loadModel(obj, MODEL_PATH, data);
+			return;
+		}
+		case Scene::Synthetic:
+			createSyntheticScene(syntheticInstances, data.vertices, data.indices);
+			break;
+		case Scene::CullTest:
+			createCullTestScene(data);
+			return;
+		}
+
+		//the built-in scenes are a single submesh, drawn with the texture of the scene
+		data.lods = { { 0, static_cast<uint32_t>(data.indices.size()), 0.0f } };
+		data.submeshes = { { glm::vec3(), 0.0f, 0, 0, 1, 0 } };
+		data.materials = { "" };
+	}
+
+	//appends the simplified levels of each submesh to the indices and computes its bounds, on a worker thread too. The
+	//loaders only give the submeshes their full level. The cubes of the synthetic scene are as simple as they get, they keep it.
+	static void buildSceneLods(Scene scene, SceneData& data) {
+		auto start = std::chrono::high_resolution_clock::now();
+		std::vector<MeshLod> fullLods = std::move(data.lods);
+		data.lods.clear();
+		std::unique_ptr<MeshSimplifier> simplifier;
+		if (scene != Scene::Synthetic && scene != Scene::CullTest) simplifier.reset(new MeshSimplifier(data.vertices));
+
+		for (Submesh& submesh : data.submeshes) {
+			MeshLod full = fullLods[submesh.firstLod];
+			computeBounds(data.vertices, data.indices, full.firstIndex, full.indexCount, submesh.center, submesh.radius);
+			std::vector<MeshLod> lods = simplifier
+				? MeshSimplifier::buildLods(*simplifier, data.indices, full, MESH_LOD_LEVELS)
+				: std::vector<MeshLod>{ full };
+			submesh.firstLod = static_cast<uint32_t>(data.lods.size());
+			submesh.lodCount = static_cast<uint32_t>(lods.size());
+			data.lods.insert(data.lods.end(), lods.begin(), lods.end());
+		}
+		data.lodMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	//the textures the materials of the scene use, decoded (or mapped from the pack) on the worker that loaded the mesh
+	static void loadMaterialTextures(SceneData& data, const std::shared_ptr<AssetPack>& pack) {
+		for (const std::string& path : data.materials) {
+			if (path.empty() || data.materialTextures.count(path) != 0) continue;
+			TextureData& texture = data.materialTextures[path];
+			if (pack) texture.mips = std::make_shared<MipChain>(AssetPack::mapTexture(pack, path));
+			else texture = decodeTexture(path);
+		}
+	}
+
+	//instanceCount cubes on a square grid spanning the same area as a single cube
+	static void createSyntheticScene(uint32_t instanceCount, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+		uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(instanceCount))));
+		float scale = 1.0f / side;
+
+		vertices.reserve(instanceCount * cubeVertices.size());
+		indices.reserve(instanceCount * cubeIndices.size());
+		for (uint32_t instance = 0; instance < instanceCount; instance++) {
+			glm::vec3 offset = { ((instance % side) + 0.5f) * scale - 0.5f, ((instance / side) + 0.5f) * scale - 0.5f, 0.0f };
+			uint32_t firstVertex = static_cast<uint32_t>(vertices.size());
+
+			for (Vertex vertex : cubeVertices) {
+				vertex.pos = vertex.pos * (scale * 0.8f) + offset; //leave a gap between the cubes
+				vertices.push_back(vertex);
+			}
+			for (uint32_t index : cubeIndices) {
+				indices.push_back(firstVertex + index);
+			}
+		}
+	}
+
+	//--cull-test : three boxes, each its own submesh. The camera is at (3, 3, 1) looking at the origin: the box at the origin
+	//hides the small one behind it from the camera, and the third one is behind the camera. Faces are wound both ways,
+	//so that back face culling can't open a hole in the occluder.
+	static void createCullTestScene(SceneData& data) {
+		struct Box {
+			glm::vec3 center;
+			float halfSize;
+		};
+		const Box boxes[] = {
+			{ glm::vec3(0.0f), 0.5f }, //occluder, about 280 pixels wide
+			{ glm::vec3(-1.5f, -1.5f, -0.5f), 0.1f }, //occluded: on the line from the camera through the origin, farther
+			{ glm::vec3(6.0f, 6.0f, 2.0f), 0.5f } //outside the frustum
+		};
+		const uint32_t faces[6][4] = { { 0, 1, 3, 2 }, { 4, 6, 7, 5 }, { 0, 4, 5, 1 }, { 2, 3, 7, 6 }, { 0, 2, 6, 4 }, { 1, 5, 7, 3 } };
+
+		data.vertices.clear();
+		data.indices.clear();
+		data.lods.clear();
+		data.submeshes.clear();
+		for (const Box& box : boxes) {
+			uint32_t firstVertex = static_cast<uint32_t>(data.vertices.size());
+			uint32_t firstIndex = static_cast<uint32_t>(data.indices.size());
+			for (uint32_t corner = 0; corner < 8; corner++) {
+				glm::vec3 side((corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f, (corner & 4) ? 1.0f : -1.0f);
+				data.vertices.push_back({ box.center + side * box.halfSize, { 1.0f, 1.0f, 1.0f }, { (corner & 1) ? 1.0f : 0.0f, (corner & 2) ? 1.0f : 0.0f } });
+			}
+			for (const auto& face : faces) {
+				const uint32_t quad[12] = { face[0], face[1], face[2], face[2], face[3], face[0], face[0], face[2], face[1], face[2], face[0], face[3] };
+				for (uint32_t corner : quad) data.indices.push_back(firstVertex + corner);
+			}
+			uint32_t lod = static_cast<uint32_t>(data.lods.size());
+			data.lods.push_back({ firstIndex, static_cast<uint32_t>(data.indices.size()) - firstIndex, 0.0f });
+			data.submeshes.push_back({ glm::vec3(), 0.0f, 0, lod, 1, 0 });
+		}
+		data.materials = { "" };
+	}
+
+	//one submesh per material of each shape, with its full level only, all in the same vertex and index buffers. The
+	//materials come from the mtl files next to the obj file (path), and are drawn with their diffuse texture. Material 0
+	//is for the faces without any, and uses the texture of the scene.
+	static void loadModel(std::istream& obj, const std::string& path, SceneData& data) {
 		tinyobj::attrib_t attrib;
 		std::vector<tinyobj::shape_t> shapes;
 		std::vector<tinyobj::material_t> materials;
 		std::string err;
+		std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+		tinyobj::MaterialFileReader materialReader(directory);
 
-		if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, MODEL_PATH.c_str(), nullptr, true /*automatically triangulate*/)) {
+		if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, &obj, &materialReader, true /*automatically triangulate*/)) {
 			throw std::runtime_error(err);
 		}
 
-		for (const auto& shape : shapes) {
-			for (const auto& index : shape.mesh.indices) {
-				Vertex vertex = {};
-
-				vertex.pos = {
-					attrib.vertices[3 * index.vertex_index + 0],
-					attrib.vertices[3 * index.vertex_index + 1],
-					attrib.vertices[3 * index.vertex_index + 2]
-				};
+		data.materials = { "" };
+		for (const auto& material : materials) {
+			data.materials.push_back(material.diffuse_texname.empty() ? "" : directory + material.diffuse_texname);
+		}
 
-				vertex.texCoord = {
-					attrib.texcoords[2 * index.texcoord_index + 0],
-					1.0f - attrib.texcoords[2 * index.texcoord_index + 1] //flipping the vertical component of the texture coordinates
-				};
+		std::vector<uint32_t> faces, faceMaterials;
+		for (const auto& shape : shapes) {
+			//the faces of the shape grouped by material, in the order they come in otherwise
+			uint32_t faceCount = static_cast<uint32_t>(shape.mesh.indices.size() / 3);
+			faceMaterials.resize(faceCount);
+			faces.resize(faceCount);
+			for (uint32_t f = 0; f < faceCount; f++) {
+				int material = f < shape.mesh.material_ids.size() ? shape.mesh.material_ids[f] : -1;
+				faceMaterials[f] = material >= 0 && material + 1u < data.materials.size() ? material + 1 : 0;
+				faces[f] = f;
+			}
+			std::stable_sort(faces.begin(), faces.end(), [&](uint32_t a, uint32_t b) { return faceMaterials[a] < faceMaterials[b]; });
 
-				vertices.push_back(vertex);
-				indices.push_back(indices.size());
+			for (uint32_t f = 0; f < faceCount; f++) {
+				uint32_t material = faceMaterials[faces[f]];
+				if (f == 0 || material != faceMaterials[faces[f - 1]]) {
+					data.submeshes.push_back({ glm::vec3(), 0.0f, material, static_cast<uint32_t>(data.lods.size()), 1, 0 });
+					data.lods.push_back({ static_cast<uint32_t>(data.indices.size()), 0, 0.0f });
+				}
+				for (uint32_t corner = 0; corner < 3; corner++) {
+					const tinyobj::index_t& index = shape.mesh.indices[3 * faces[f] + corner];
+					Vertex vertex = {};
+
+					vertex.pos = {
+						attrib.vertices[3 * index.vertex_index + 0],
+						attrib.vertices[3 * index.vertex_index + 1],
+						attrib.vertices[3 * index.vertex_index + 2]
+					};
+
+					if (index.texcoord_index >= 0) { //shapes of a multi-object file do not all have texture coordinates
+						vertex.texCoord = {
+							attrib.texcoords[2 * index.texcoord_index + 0],
+							1.0f - attrib.texcoords[2 * index.texcoord_index + 1] //flipping the vertical component of the texture coordinates
+						};
+					}
+
+					data.indices.push_back(static_cast<uint32_t>(data.vertices.size()));
+					data.vertices.push_back(vertex);
+				}
+				data.lods.back().indexCount += 3;
 			}
 		}
 	}
@@ -1178,19 +2652,23 @@ private:
 		vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
 		memcpy(data, vertices.data(), (size_t)bufferSize);
 		vkUnmapMemory(device, stagingBufferMemory);
+		recordMeshUpload("vertices", bufferSize);
 
 		//vertex buffer is a device-local buffer, 
 		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
 
-		//copyBuffer will create a copy command, submit it and wait for it to end
-		copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+		//uploadBuffer will record the copy on the transfer queue and return without waiting for it
+		uploadBuffer(stagingBuffer, stagingBufferMemory, vertexBuffer, bufferSize, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
 	}
 
 	void createIndexBuffer() {
 		//Two differences with the vertex buffer:
 		//1) buffer size (obviously)
 		//2) VK_BUFFER_USAGE_INDEX_BUFFER_BIT instead of VK_BUFFER_USAGE_VERTEX_BUFFER_BIT (actually obvious too)
-		VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+		//16-bit indices when they can address every vertex: half the memory and bandwidth of 32-bit ones
+		indexType = vertices.size() <= 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+		VkDeviceSize indexSize = indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+		VkDeviceSize bufferSize = indexSize * indices.size();
 
 		VDeleter<VkBuffer> stagingBuffer{ device, vkDestroyBuffer };
 		VDeleter<VkDeviceMemory> stagingBufferMemory{ device, vkFreeMemory };
@@ -1198,91 +2676,122 @@ private:
 
 		void* data;
 		vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, indices.data(), (size_t)bufferSize);
+		if (indexType == VK_INDEX_TYPE_UINT16) { //narrowed on the way into staging memory, no intermediate copy
+			uint16_t* narrowIndices = static_cast<uint16_t*>(data);
+			for (size_t i = 0; i < indices.size(); i++) narrowIndices[i] = static_cast<uint16_t>(indices[i]);
+		}
+		else memcpy(data, indices.data(), (size_t)bufferSize);
 		vkUnmapMemory(device, stagingBufferMemory);
+		recordMeshUpload("indices", bufferSize);
 
 		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
 
-		copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+		uploadBuffer(stagingBuffer, stagingBufferMemory, indexBuffer, bufferSize, VK_ACCESS_INDEX_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+	}
+
+	//the mesh is always copied from the CPU side arrays, which the application keeps (bounds, statistics).
+	//Read from the asset pack, the arrays were already a copy of the mapping.
+	void recordMeshUpload(const char* name, VkDeviceSize size) {
+		UploadStats& stats = uploadStats[name];
+		stats.uploadedBytes += size;
+		stats.copiedBytes += assets ? 2 * size : size;
+		stats.path = "copy";
 	}
 
 	void createUniformBuffer() {
 		VkDeviceSize bufferSize = sizeof(UniformBufferObject);
 
-		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-			uniformStagingBuffer, uniformStagingBufferMemory);
+		//one staging buffer per frame in flight, so that the CPU never overwrites data an upload is still reading
+		uniformStagingBuffers.resize(MAX_FRAMES_IN_FLIGHT, VDeleter<VkBuffer>{ device, vkDestroyBuffer });
+		uniformStagingBufferMemories.resize(MAX_FRAMES_IN_FLIGHT, VDeleter<VkDeviceMemory>{ device, vkFreeMemory });
+		for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				uniformStagingBuffers[i], uniformStagingBufferMemories[i]);
+		}
 		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 
 			uniformBuffer, uniformBufferMemory);
-	}
 
+		//model matrices of the objects, written by the CPU every frame. Only read with --object-transforms uniform,
+		//but the shader declares the set either way.
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+		objectUniformStride = (sizeof(glm::mat4) + alignment - 1) / alignment * alignment;
 
-	void createDescriptorPool() {
-		std::array<VkDescriptorPoolSize, 2> poolSizes = {};
-		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		poolSizes[0].descriptorCount = 1;
-		poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		poolSizes[1].descriptorCount = 1;
-		
-		VkDescriptorPoolCreateInfo poolInfo = {};
-		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-		poolInfo.pPoolSizes = poolSizes.data();
-		poolInfo.maxSets = 1;
-
-		if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create descriptor pool!");
+		objectUniformBuffers.resize(MAX_FRAMES_IN_FLIGHT, VDeleter<VkBuffer>{ device, vkDestroyBuffer });
+		objectUniformBufferMemories.resize(MAX_FRAMES_IN_FLIGHT, VDeleter<VkDeviceMemory>{ device, vkFreeMemory });
+		for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			createBuffer(objectUniformStride * objects.size(), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, objectUniformBuffers[i], objectUniformBufferMemories[i]);
 		}
 	}
 
-	void createDescriptorSet() {
-		VkDescriptorSetLayout layouts[] = { descriptorSetLayout };
-		VkDescriptorSetAllocateInfo allocInfo = {};
-		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		allocInfo.descriptorPool = descriptorPool;
-		allocInfo.descriptorSetCount = 1;
-		allocInfo.pSetLayouts = layouts;
 
-		if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS) {
-			throw std::runtime_error("failed to allocate descriptor set!");
+	//per frame in flight : the objects' spheres and index ranges written by the CPU, the draws written by the culling pass,
+	//and its counters, read back by the CPU once the frame has completed
+	void createCullingBuffers() {
+		if (!options.culling) return;
+
+		cullObjectBuffers.resize(MAX_FRAMES_IN_FLIGHT, VDeleter<VkBuffer>{ device, vkDestroyBuffer });
+		cullObjectBufferMemories.resize(MAX_FRAMES_IN_FLIGHT, VDeleter<VkDeviceMemory>{ device, vkFreeMemory });
+		indirectDrawBuffers.resize(MAX_FRAMES_IN_FLIGHT, VDeleter<VkBuffer>{ device, vkDestroyBuffer });
+		indirectDrawBufferMemories.resize(MAX_FRAMES_IN_FLIGHT, VDeleter<VkDeviceMemory>{ device, vkFreeMemory });
+		cullStatsBuffers.resize(MAX_FRAMES_IN_FLIGHT, VDeleter<VkBuffer>{ device, vkDestroyBuffer });
+		cullStatsBufferMemories.resize(MAX_FRAMES_IN_FLIGHT, VDeleter<VkDeviceMemory>{ device, vkFreeMemory });
+		cullStatsFrames.assign(MAX_FRAMES_IN_FLIGHT, -1);
+		for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			createBuffer(sizeof(CullObject) * objects.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, cullObjectBuffers[i], cullObjectBufferMemories[i]);
+			createBuffer(sizeof(VkDrawIndexedIndirectCommand) * objects.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indirectDrawBuffers[i], indirectDrawBufferMemories[i]);
+			createBuffer(sizeof(CullStats), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, cullStatsBuffers[i], cullStatsBufferMemories[i]);
 		}
+	}
 
-		VkDescriptorBufferInfo bufferInfo = {};
-		bufferInfo.buffer = uniformBuffer;
-		bufferInfo.offset = 0;
-		bufferInfo.range = sizeof(UniformBufferObject);
-
-		VkDescriptorImageInfo imageInfo = {};
-		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		imageInfo.imageView = textureImageView;
-		imageInfo.sampler = textureSampler;
-
-		std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+	//the scene's set is persistent, replaced when a texture is added or streams in a level. The others are requested again
+	//every frame, from pools that are reset when the slot comes around.
+	void createDescriptorAllocator() {
+		descriptors.create(MAX_FRAMES_IN_FLIGHT);
+		descriptors.registerLayout(descriptorSetLayout, {
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, bindless ? bindlessTextureCapacity : 1 }
+		});
+		descriptors.registerLayout(objectSetLayout, { { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 } });
+		if (options.culling) {
+			descriptors.registerLayout(hiZSetLayout, { { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 }, { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 } });
+			descriptors.registerLayout(cullSetLayout, { { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 }, { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 } });
+		}
+	}
 
-		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[0].dstSet = descriptorSet;
-		descriptorWrites[0].dstBinding = 0;
-		descriptorWrites[0].dstArrayElement = 0;
-		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptorWrites[0].descriptorCount = 1;
-		descriptorWrites[0].pBufferInfo = &bufferInfo;
+	//texture table : element i of the sampler array is texture i of the streamer. Without bindless the array has a single
+	//element, the texture of the scene, which is then the only one the materials use.
+	std::vector<VkImageView> textureViews() {
+		std::vector<VkImageView> views;
+		for (const auto& streamed : textureImages) views.push_back(streamed->view);
+		return views;
+	}
 
-		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[1].dstSet = descriptorSet;
-		descriptorWrites[1].dstBinding = 1;
-		descriptorWrites[1].dstArrayElement = 0;
-		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		descriptorWrites[1].descriptorCount = 1;
-		descriptorWrites[1].pImageInfo = &imageInfo;
+	//the UBO and the textures, as they are this frame
+	DescriptorWrites sceneDescriptorWrites() {
+		DescriptorWrites writes;
+		writes.buffer(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, uniformBuffer, 0, sizeof(UniformBufferObject));
+		std::vector<VkImageView> views = textureViews();
+		for (uint32_t i = 0; i < views.size(); i++) {
+			writes.image(1, i, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, views[i], textureSampler);
+		}
+		return writes;
+	}
 
-		vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	DescriptorWrites objectDescriptorWrites(size_t object) {
+		DescriptorWrites writes;
+		writes.buffer(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, objectUniformBuffers[frameSlot], object * objectUniformStride, sizeof(glm::mat4));
+		return writes;
 	}
 
 	void createCommandBuffers() {
-		if (commandBuffers.size() > 0) {
-			vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
-		}
-
-		commandBuffers.resize(swapChainFramebuffers.size());
+		//one command buffer per frame in flight, recorded each frame once the swap chain image is known
+		commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
 
 		VkCommandBufferAllocateInfo allocInfo = {};
 		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -1293,69 +2802,340 @@ private:
 		if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
 			throw std::runtime_error("failed to allocate command buffers!");
 		}
+	}
+
+	//the GPU is done with the previous use of this slot's command buffer (beginFrame waited for it), so it can be reset
+	void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+		vkResetCommandBuffer(commandBuffer, 0);
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = nullptr; // Optional
+
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		profiler.beginFrame(commandBuffer, frameSlot);
+
+		RenderGraph graph;
+		buildFrameGraph(graph, imageIndex);
+		graph.compile();
+		if (frameNumber == 0) {
+			std::ostringstream description;
+			graph.describe(description);
+			frameGraphDescription = description.str();
+			frameGraphBarriers = graph.barrierCount();
+			frameGraphBatches = graph.batchCount();
+		}
+		graph.execute(commandBuffer);
 
-		for (size_t i = 0; i < commandBuffers.size(); i++) {
-			VkCommandBufferBeginInfo beginInfo = {};
-			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-			beginInfo.pInheritanceInfo = nullptr; // Optional
+		lastBinds = bindCache.takeStats();
+		if (frameNumber >= options.warmupFrames) {
+			bindTotals += lastBinds;
+			bindFrames++;
+		}
 
-			vkBeginCommandBuffer(commandBuffers[i], &beginInfo);
+		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record command buffer!");
+		}
+	}
 
-			VkRenderPassBeginInfo renderPassInfo = {};
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			renderPassInfo.renderPass = renderPass;
-			renderPassInfo.framebuffer = swapChainFramebuffers[i];
-			renderPassInfo.renderArea.offset = { 0, 0 };
-			renderPassInfo.renderArea.extent = swapChainExtent;
+	//the passes of a frame and what they read and write : the graph works out the barriers between them
+	void buildFrameGraph(RenderGraph& graph, uint32_t imageIndex) {
+		const RenderGraph::Access uniformRead = { VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_UNIFORM_READ_BIT };
+		const RenderGraph::Access indirectRead = { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT };
+		const RenderGraph::Access hostRead = { VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT };
+
+		//the previous frame may still be reading it in its vertex shader
+		RenderGraph::Resource uniforms = graph.importBuffer("uniform buffer", uniformBuffer, uniformRead);
+		graph.addPass("uniform upload", [this](VkCommandBuffer commandBuffer) {
+			uint32_t uploadScope = profiler.beginGpuScope(commandBuffer, "uniform upload");
+			VkBufferCopy copyRegion = {};
+			copyRegion.size = sizeof(UniformBufferObject);
+			vkCmdCopyBuffer(commandBuffer, uniformStagingBuffers[frameSlot], uniformBuffer, 1, &copyRegion);
+			profiler.endGpuScope(commandBuffer, uploadScope);
+		}).write(uniforms, { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT });
+
+		if (!options.culling) {
+			graph.addPass("main render pass", [this, imageIndex](VkCommandBuffer commandBuffer) { recordMainRenderPass(commandBuffer, imageIndex); })
+				.sideEffects()
+				.read(uniforms, uniformRead);
+			return;
+		}
+
+		//the culling pass of the next frame reads the pyramid, the CPU reads the counters once the frame has completed, and
+		//the depth buffer is left as an attachment for the next frame. It comes in synchronized: the final barrier of the
+		//previous frame's graph, or the external dependency of the render pass, orders the depth clear after the last use.
+		RenderGraph::Resource stats = graph.importBuffer("cull stats", cullStatsBuffers[frameSlot], hostRead);
+		RenderGraph::Resource draws = graph.importBuffer("indirect draws", indirectDrawBuffers[frameSlot], indirectRead);
+		RenderGraph::Resource pyramid = graph.importImage("depth pyramid", depthPyramid, VK_IMAGE_ASPECT_COLOR_BIT, depthPyramidLevels, DEPTH_PYRAMID_READ);
+		RenderGraph::Resource depth = graph.importImage("depth", depthImage, depthAspectMask(), 1, DEPTH_ATTACHMENT, true);
+		graph.exportResource(stats, hostRead);
+		graph.exportResource(pyramid, DEPTH_PYRAMID_READ);
+		graph.exportResource(depth, DEPTH_ATTACHMENT);
+
+		graph.addPass("clear cull stats", [this](VkCommandBuffer commandBuffer) {
+			vkCmdFillBuffer(commandBuffer, cullStatsBuffers[frameSlot], 0, sizeof(CullStats), 0);
+		}).write(stats, { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT });
+
+		graph.addPass("culling", [this](VkCommandBuffer commandBuffer) { recordCulling(commandBuffer); })
+			.read(pyramid, DEPTH_PYRAMID_READ)
+			.write(draws, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT })
+			.write(stats, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT });
+
+		graph.addPass("main render pass", [this, imageIndex](VkCommandBuffer commandBuffer) { recordMainRenderPass(commandBuffer, imageIndex); })
+			.sideEffects()
+			.read(uniforms, uniformRead)
+			.read(draws, indirectRead)
+			.write(depth, DEPTH_ATTACHMENT);
+
+		//each level of the pyramid is downsampled from the previous one, level 0 from the depth buffer
+		for (uint32_t level = 0; level < depthPyramidLevels; level++) {
+			RenderGraph::PassBuilder pass = graph.addPass("depth pyramid " + std::to_string(level),
+				[this, level](VkCommandBuffer commandBuffer) { recordDepthPyramidLevel(commandBuffer, level); });
+			if (level == 0) {
+				pass.read(depth, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL });
+			}
+			else {
+				pass.read(pyramid, DEPTH_PYRAMID_READ, level - 1, 1);
+			}
+			pass.write(pyramid, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL }, level, 1);
+		}
+	}
 
-			std::array<VkClearValue, 2> clearValues = {};
-			clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-			clearValues[1].depthStencil = { 1.0f, 0 };
+	void recordMainRenderPass(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+		VkRenderPassBeginInfo renderPassInfo = {};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = renderPass;
+		renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+		renderPassInfo.renderArea.offset = { 0, 0 };
+		renderPassInfo.renderArea.extent = swapChainExtent;
+
+		std::array<VkClearValue, 2> clearValues = {};
+		clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+		clearValues[1].depthStencil = { 1.0f, 0 };
+
+		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+		renderPassInfo.pClearValues = clearValues.data();
+
+		uint32_t renderPassScope = profiler.beginGpuScope(commandBuffer, "main render pass");
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+		bindCache.reset();
+		bindCache.bindVertexBuffer(commandBuffer, vertexBuffer);
+		bindCache.bindIndexBuffer(commandBuffer, indexBuffer, indexType);
+		bindCache.bindDescriptorSet(commandBuffer, pipelineLayout, 0, descriptors.getPersistent(descriptorSetLayout, sceneDescriptorWrites()));
+		bindCache.bindDescriptorSet(commandBuffer, pipelineLayout, 1, descriptors.get(objectSetLayout, objectDescriptorWrites(drawOrder[0].index)));
+		//both pipelines share the layout, the sets and push constants stay bound across the subpasses
+		if (options.depthPrepass) {
+			bindCache.bindPipeline(commandBuffer, depthPrepassPipeline);
+			recordObjectDraws(commandBuffer);
+			vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+		}
+		bindCache.bindPipeline(commandBuffer, graphicsPipeline);
+		recordObjectDraws(commandBuffer);
+		vkCmdEndRenderPass(commandBuffer);
+		profiler.endGpuScope(commandBuffer, renderPassScope);
+	}
 
-			renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-			renderPassInfo.pClearValues = clearValues.data();
+	//every object with its transform in key order, once per subpass, only binding what changes from one draw to the next
+	void recordObjectDraws(VkCommandBuffer commandBuffer) {
+		for (const DrawSort::Draw& draw : drawOrder) {
+			uint32_t i = draw.index;
+			if (bindless && bindCache.changeMaterial(DrawKey::material(draw.key))) {
+				uint32_t textureIndex = DrawKey::material(draw.key);
+				vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, offsetof(DrawPushConstants, textureIndex), sizeof(textureIndex), &textureIndex);
+			}
+			if (options.objectTransforms == ObjectTransforms::PushConstants) {
+				vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, offsetof(DrawPushConstants, mvp), sizeof(glm::mat4), &objectMvps[i]);
+			}
+			else {
+				bindCache.bindDescriptorSet(commandBuffer, pipelineLayout, 1, descriptors.get(objectSetLayout, objectDescriptorWrites(i)));
+			}
+			if (options.culling) { //the culling pass wrote the draw, with no instance when the object is culled
+				vkCmdDrawIndexedIndirect(commandBuffer, indirectDrawBuffers[frameSlot], i * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+			}
+			else {
+				const MeshLod& lod = objects[i].lods[objectLods[i]];
+				vkCmdDrawIndexed(commandBuffer, lod.indexCount, 1, lod.firstIndex, 0, 0);
+			}
+		}
+	}
 
-			vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	//one thread per object : frustum test, then the sphere against the pyramid of the previous frame's depth. The objects
+	//move little from one frame to the next, an object that gets uncovered can show up one frame late.
+	void recordCulling(VkCommandBuffer commandBuffer) {
+		uint32_t cullScope = profiler.beginGpuScope(commandBuffer, "culling");
+		DescriptorWrites writes;
+		writes.image(0, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, depthPyramidView, depthPyramidSampler, VK_IMAGE_LAYOUT_GENERAL);
+		writes.buffer(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, cullObjectBuffers[frameSlot], 0, VK_WHOLE_SIZE);
+		writes.buffer(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, indirectDrawBuffers[frameSlot], 0, VK_WHOLE_SIZE);
+		writes.buffer(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, cullStatsBuffers[frameSlot], 0, VK_WHOLE_SIZE);
+		VkDescriptorSet set = descriptors.get(cullSetLayout, writes);
+
+		cullConstants.levelCount = depthPyramidReady ? depthPyramidLevels : 0;
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &set, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(cullConstants), &cullConstants);
+		vkCmdDispatch(commandBuffer, static_cast<uint32_t>(objects.size() + 63) / 64, 1, 1);
+		cullStatsFrames[frameSlot] = static_cast<int64_t>(frameNumber);
+		profiler.endGpuScope(commandBuffer, cullScope);
+	}
 
-			vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-			VkBuffer vertexBuffers[] = { vertexBuffer };
-			VkDeviceSize offsets[] = { 0 };
-			vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
-			vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
-			//vkCmdDraw(commandBuffers[i], static_cast<uint32_t>(vertices.size()), 1, 0, 0);
-			vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0); 
-			vkCmdEndRenderPass(commandBuffers[i]);
+	//after the render pass, one level per pass : level 0 from the depth buffer, the others from the level before
+	void recordDepthPyramidLevel(VkCommandBuffer commandBuffer, uint32_t level) {
+		if (level == 0) depthPyramidScope = profiler.beginGpuScope(commandBuffer, "depth pyramid");
 
-			if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-				throw std::runtime_error("failed to record command buffer!");
+		int32_t sizes[4] = { static_cast<int32_t>(swapChainExtent.width), static_cast<int32_t>(swapChainExtent.height), 0, 0 };
+		for (uint32_t i = 0; i <= level; i++) {
+			if (i > 0) {
+				sizes[0] = sizes[2];
+				sizes[1] = sizes[3];
 			}
+			sizes[2] = (sizes[0] + 1) / 2;
+			sizes[3] = (sizes[1] + 1) / 2;
+		}
+
+		DescriptorWrites writes;
+		if (level == 0) {
+			writes.image(0, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, depthImageView, depthPyramidSampler, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+		}
+		else {
+			writes.image(0, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, depthPyramidLevelViews[level - 1], depthPyramidSampler, VK_IMAGE_LAYOUT_GENERAL);
+		}
+		writes.image(1, 0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, depthPyramidLevelViews[level], VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL);
+		VkDescriptorSet set = descriptors.get(hiZSetLayout, writes);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiZPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiZPipelineLayout, 0, 1, &set, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, hiZPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sizes), sizes);
+		vkCmdDispatch(commandBuffer, (sizes[2] + 7) / 8, (sizes[3] + 7) / 8, 1);
+
+		if (level + 1 == depthPyramidLevels) {
+			depthPyramidReady = true; //for the frames recorded after this one, which run after it on the queue
+			profiler.endGpuScope(commandBuffer, depthPyramidScope);
 		}
 	}
 
-	void createSemaphores() {
-		//we will use 2 semaphores to synchronize swap chain events in the main loop : when one image is available and when one image finished rendering
+	void createSyncObjects() {
+		//each frame in flight uses 2 semaphores to synchronize swap chain events in the main loop : when one image is available and when one image finished rendering
+		//the CPU knows when the GPU is done with a frame through the timeline value its submission signaled
+		imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT, VDeleter<VkSemaphore>{ device, vkDestroySemaphore });
+		renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT, VDeleter<VkSemaphore>{ device, vkDestroySemaphore });
+		frameTimelineValues.resize(MAX_FRAMES_IN_FLIGHT, 0);
+
 		VkSemaphoreCreateInfo semaphoreInfo = {};
 		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphore) != VK_SUCCESS ||
-			vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphore) != VK_SUCCESS) {
 
-			throw std::runtime_error("failed to create semaphores!");
+		for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
+				vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS) {
+
+				throw std::runtime_error("failed to create semaphores!");
+			}
 		}
+
+		lastLatencyReport = std::chrono::high_resolution_clock::now();
 	}
 
 	void mainLoop() {
-		//run until window should close (error occurs/window was closed by user)
-		while (!glfwWindowShouldClose(window)) {
-			glfwPollEvents();
-
-			updateUniformBuffer();
-			drawFrame();
+		frameLimiter.setRate(options.fpsLimit);
+
+		//run until window should close (error occurs/window was closed by user), or for a fixed number of frames when benchmarking
+		while (options.benchmark ? frameNumber < options.frames : !glfwWindowShouldClose(window)) {
+			frameStats.beginFrame();
+			beginFrame();
+
+			//input is sampled as late as possible : once the frame slot is free, and the limiter says the frame has to start
+			double sleptMs = frameLimiter.wait();
+			if (frameNumber >= options.warmupFrames) limiterSleepMs += sleptMs;
+			if (!options.headless) glfwPollEvents();
+			FrameLimiter::Clock::time_point inputTime = FrameLimiter::Clock::now();
+			uint64_t inputFrame = frameNumber;
+
+			if (frameNumber == 0) startup.begin("first frame");
+			{
+				GpuProfiler::CpuScope scope(profiler, "updateUniformBuffer");
+				FrameStats::ScopedPhase phase(frameStats, FrameStats::Update);
+				updateUniformBuffer();
+			}
+			{
+				GpuProfiler::CpuScope scope(profiler, "drawFrame");
+				drawFrame();
+			}
+			//only measured when something reads the samples: the report drains them every 2 s, the benchmark runs a fixed number of frames
+			if (frameNumber > inputFrame && (options.report || options.benchmark)) inputLatency.track(inputFrame, lastFrameValue, inputTime);
+			frameLimiter.endFrame();
+			if (frameNumber == 1 && timeToFirstFrameMs == 0.0) {
+				startup.end();
+				timeToFirstFrameMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+				if (!options.benchmark) {
+					reportStartup(std::cout);
+				}
+			}
 		}
 		
 		//wait until device finishes operations in order to cleanly dispose of resources
 		vkDeviceWaitIdle(device);
+		inputLatency.stop();
+		deletionQueue.flush();
+		transferDeletionQueue.flush();
+
+		if (!options.profilePath.empty()) {
+			profiler.writeChromeTrace(options.profilePath);
+			std::cerr << "profiler trace written to " << options.profilePath << std::endl;
+		}
+		if (!options.frameStatsPath.empty()) {
+			frameStats.writeCsv(options.frameStatsPath);
+		}
+		if (options.report && !options.benchmark) {
+			std::cout << "frame time histogram (" << frameStats.hitchCount() << " hitches) :" << std::endl;
+			frameStats.writeHistogram(std::cout);
+		}
+	}
+
+	void beginFrame() {
+		//Wait until the GPU is done with the frame that last used this slot, then release what it was keeping alive
+		frameSlot = frameNumber % MAX_FRAMES_IN_FLIGHT;
+		timeline.wait(frameTimelineValues[frameSlot]);
+		deletionQueue.collect(timeline.completedValue());
+		acquireCompletedUploads(false);
+		profiler.resolveFrame(frameSlot);
+
+		descriptors.beginFrame(frameSlot);
+		streamTextures();
+		if (options.culling) readCullStats();
+
+		if (options.report && !options.benchmark) { //benchmark output stays machine readable
+			auto now = std::chrono::high_resolution_clock::now();
+			if (now - lastLatencyReport > std::chrono::seconds(2)) {
+				std::cout << "frame " << frameNumber
+					<< " : cpu->gpu latency last " << timeline.lastLatencyMs() << " ms"
+					<< ", avg " << timeline.averageLatencyMs() << " ms"
+					<< ", max " << timeline.maxLatencyMs() << " ms"
+					<< ", " << (timeline.lastSignaledValue() - timeline.completedValue()) << " submissions in flight" << std::endl;
+				frameStats.report(std::cout);
+				FrameStats::Percentiles input = inputLatencyPercentiles(0);
+				std::cout << "  input latency : p50 " << input.p50 << " ms, p95 " << input.p95 << " ms, p99 " << input.p99 << " ms ("
+					<< presentModeName(presentMode) << ", " << swapChainImages.size() << " images"
+					<< (frameLimiter.enabled() ? ", " + std::to_string(options.fpsLimit) + " fps limit" : std::string()) << ")" << std::endl;
+				std::cout << "  textures : " << textureImages.size() << ", level " << textureStreamer.residentLevel(sceneTextureId) << " of the scene's resident, "
+					<< textureStreamer.residentBytes() / (1024 * 1024) << " MB of " << textureStreamer.getBudget() / (1024 * 1024) << " MB budget" << std::endl;
+				const DescriptorAllocator::Stats& descriptorStats = descriptors.getStats();
+				std::cout << "  descriptors : " << descriptorStats.requests << " sets requested, " << descriptorStats.allocations << " allocated in "
+					<< descriptorStats.allocateMs << " ms, " << descriptorStats.poolsCreated << " pools" << std::endl;
+				std::cout << "  lod : " << (objectLods.empty() ? 0 : objectLods[0]) << " of " << objects[0].lods.size() << " levels, "
+					<< frameTriangles << " triangles drawn" << std::endl;
+				std::cout << "  binds : " << lastBinds.pipelines << " pipelines, " << lastBinds.descriptorSets << " descriptor sets, "
+					<< lastBinds.materials << " materials, " << lastBinds.skipped << " skipped" << std::endl;
+				if (options.culling) {
+					std::cout << "  culling : " << lastCullStats.visible << " visible, " << lastCullStats.frustumCulled << " outside the frustum, "
+						<< lastCullStats.occlusionCulled << " occluded" << std::endl;
+				}
+				if (!options.profilePath.empty()) profiler.report(std::cout);
+				timeline.resetLatencyStats();
+				lastLatencyReport = now;
+			}
+		}
 	}
 
 	void updateUniformBuffer() {
@@ -1363,24 +3143,170 @@ private:
 
 		auto currentTime = std::chrono::high_resolution_clock::now();
 		float time = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - startTime).count() / 1000.0f;
+		if (options.benchmark) {
+			time = frameNumber * options.timestepMs / 1000.0f; //simulated time: every run renders the same frames
+		}
+		glm::mat4 sceneModel = glm::rotate(glm::mat4(), time * glm::radians(45.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		glm::mat4 view = glm::lookAt(glm::vec3(3.0f, 3.0f, 1.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		float zNear = 0.1f, zFar = 10.0f;
+		glm::mat4 proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, zNear, zFar);
+		if(fixYAxis) proj[1][1] *= -1;
 		UniformBufferObject ubo = {};
-		ubo.model = glm::rotate(glm::mat4(), time * glm::radians(45.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		ubo.view = glm::lookAt(glm::vec3(3.0f, 3.0f, 1.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 10.0f);
-		if(fixYAxis) ubo.proj[1][1] *= -1;
+		ubo.viewProj = proj * view;
+		requestTextureLevels(view, proj, sceneModel);
+		selectObjectLods(view, proj, sceneModel);
+		sortDraws(view, sceneModel, zFar);
+		if (options.culling) updateCullObjects(view, proj, sceneModel, zNear, zFar);
+		updateObjectTransforms(ubo.viewProj * sceneModel, time);
 		
 		void* data;
-		vkMapMemory(device, uniformStagingBufferMemory, 0, sizeof(ubo), 0, &data);
+		vkMapMemory(device, uniformStagingBufferMemories[frameSlot], 0, sizeof(ubo), 0, &data);
 		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, uniformStagingBufferMemory);
+		vkUnmapMemory(device, uniformStagingBufferMemories[frameSlot]);
+		//the copy into the device local uniform buffer is recorded at the start of the frame command buffer
+	}
+
+	//the coarsest level of each object whose error, projected at the distance of the object, stays under LOD_ERROR_PIXELS.
+	//The objects spin around their center, so the scene model is enough to place them.
+	void selectObjectLods(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& sceneModel) {
+		objectLods.resize(objects.size());
+		uint64_t triangles = 0;
+		for (size_t i = 0; i < objects.size(); i++) {
+			const std::vector<MeshLod>& lods = objects[i].lods;
+			uint32_t level = 0;
+			if (options.lod >= 0) {
+				level = std::min(static_cast<uint32_t>(options.lod), static_cast<uint32_t>(lods.size() - 1));
+			}
+			else {
+				glm::vec4 center = view * sceneModel * glm::vec4(objects[i].center, 1.0f);
+				float distance = -center.z;
+				if (distance > objects[i].radius) { //else the camera is inside the object, keep the full level
+					float pixelsPerUnit = std::abs(proj[1][1]) * swapChainExtent.height * 0.5f / distance;
+					while (level + 1 < lods.size() && lods[level + 1].error * pixelsPerUnit <= LOD_ERROR_PIXELS) level++;
+				}
+			}
+			objectLods[i] = level;
+			triangles += lods[level].indexCount / 3;
+		}
+		frameTriangles = triangles;
+		if (frameNumber >= options.warmupFrames) {
+			drawnTriangles += triangles;
+			drawnFrames++;
+		}
+	}
+
+	//a key per object : the material and level of detail it is drawn with, and its distance. Recorded in key order, the
+	//draws sharing a material or a mesh follow each other, and go front to back within them.
+	void sortDraws(const glm::mat4& view, const glm::mat4& sceneModel, float zFar) {
+		auto start = std::chrono::high_resolution_clock::now();
+		drawOrder.resize(objects.size());
+		for (size_t i = 0; i < objects.size(); i++) {
+			glm::vec4 center = view * sceneModel * glm::vec4(objects[i].center, 1.0f);
+			uint32_t material = materialTextures[objects[i].material]; //the texture index the fragment shader gets
+			drawOrder[i] = { DrawKey::pack(0, material, objectLods[i], -center.z / zFar), static_cast<uint32_t>(i) };
+		}
+		DrawSort::sort(drawOrder, drawSortScratch);
+		if (frameNumber >= options.warmupFrames) {
+			drawSortMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		}
+	}
+
+	//bounding spheres in view space for the culling pass, with the index range of the level each object is drawn with
+	void updateCullObjects(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& sceneModel, float zNear, float zFar) {
+		CullObject* cullObjects;
+		vkMapMemory(device, cullObjectBufferMemories[frameSlot], 0, sizeof(CullObject) * objects.size(), 0, (void**)&cullObjects);
+		for (size_t i = 0; i < objects.size(); i++) {
+			glm::vec4 center = view * sceneModel * glm::vec4(objects[i].center, 1.0f);
+			const MeshLod& lod = objects[i].lods[objectLods[i]];
+			cullObjects[i] = { glm::vec4(center.x, center.y, -center.z, objects[i].radius), lod.firstIndex, lod.indexCount, { 0, 0 } };
+		}
+		vkUnmapMemory(device, cullObjectBufferMemories[frameSlot]);
+
+		//normals of the right and top planes of the symmetric frustum, and the depth the projection writes at a distance
+		float p00 = std::abs(proj[0][0]), p11 = std::abs(proj[1][1]);
+		cullConstants.frustum = glm::vec4(p00, 1.0f, p11, 1.0f) / glm::vec4(std::sqrt(p00 * p00 + 1.0f), std::sqrt(p00 * p00 + 1.0f),
+			std::sqrt(p11 * p11 + 1.0f), std::sqrt(p11 * p11 + 1.0f));
+		cullConstants.projection = glm::vec2(proj[0][0], proj[1][1]);
+		cullConstants.depthTransform = glm::vec2(-proj[2][2], proj[3][2]);
+		cullConstants.nearFar = glm::vec2(zNear, zFar);
+		cullConstants.depthSize = glm::vec2(swapChainExtent.width, swapChainExtent.height);
+		cullConstants.objectCount = static_cast<uint32_t>(objects.size());
+	}
+
+	//counters of the culling pass of the frame that last used this slot, which beginFrame waited for
+	void readCullStats() {
+		int64_t frame = cullStatsFrames[frameSlot];
+		if (frame < 0) return;
+		cullStatsFrames[frameSlot] = -1;
+		lastCullStats = mapCullStats(frameSlot);
+		if (frame >= static_cast<int64_t>(options.warmupFrames)) {
+			cullTotals[0] += lastCullStats.visible;
+			cullTotals[1] += lastCullStats.frustumCulled;
+			cullTotals[2] += lastCullStats.occlusionCulled;
+			cullFrames++;
+		}
+	}
+
+	CullStats mapCullStats(size_t slot) {
+		CullStats stats;
+		void* data;
+		vkMapMemory(device, cullStatsBufferMemories[slot], 0, sizeof(CullStats), 0, &data);
+		memcpy(&stats, data, sizeof(CullStats));
+		vkUnmapMemory(device, cullStatsBufferMemories[slot]);
+		return stats;
+	}
+
+	//--cull-test : the counters of the last frame, culled against the depth of the frame before, read back once the device
+	//is idle. Throws when they are not what the scene was built for.
+	void checkCullTest() {
+		CullStats stats = mapCullStats(static_cast<size_t>((frameNumber - 1) % MAX_FRAMES_IN_FLIGHT));
+		std::cout << "cull test : " << stats.visible << " visible (expected 1), " << stats.frustumCulled << " outside the frustum (expected 1), "
+			<< stats.occlusionCulled << " occluded (expected 1)" << std::endl;
+		if (stats.visible != 1 || stats.frustumCulled != 1 || stats.occlusionCulled != 1) {
+			throw std::runtime_error("cull test failed!");
+		}
+	}
 
-		copyBuffer(uniformStagingBuffer, uniformBuffer, sizeof(ubo));
+	//every object turns with the scene, the cubes of --object-draws also spin around their own center.
+	//The vertex shader only does mvp * position: the products are done here once per object, in one batch.
+	void updateObjectTransforms(const glm::mat4& sceneViewProj, float time) {
+		objectLocalModels.resize(objects.size());
+		objectMvps.resize(objects.size());
+		for (size_t i = 0; i < objects.size(); i++) {
+			objectLocalModels[i] = glm::mat4();
+			if (options.objectDraws) { //not the submeshes of a model, they would come apart
+				glm::vec3 center = objects[i].center;
+				float angle = time * glm::radians(90.0f) + i * 0.1f;
+				objectLocalModels[i] = glm::translate(glm::mat4(), center) * glm::rotate(glm::mat4(), angle, glm::vec3(0.0f, 0.0f, 1.0f)) *
+					glm::translate(glm::mat4(), -center);
+			}
+		}
+		MatrixBatch::multiply(sceneViewProj, objectLocalModels.data(), objectMvps.data(), objects.size());
+
+		if (options.objectTransforms == ObjectTransforms::UniformBuffer) {
+			char* data;
+			vkMapMemory(device, objectUniformBufferMemories[frameSlot], 0, objectUniformStride * objects.size(), 0, (void**)&data);
+			for (size_t i = 0; i < objects.size(); i++) {
+				memcpy(data + i * objectUniformStride, &objectMvps[i], sizeof(glm::mat4));
+			}
+			vkUnmapMemory(device, objectUniformBufferMemories[frameSlot]);
+		}
 	}
 
 	void drawFrame() {
+		if (options.headless) {
+			drawOffscreenFrame();
+			return;
+		}
+
 		//Acquire an image from the swap chain
 		uint32_t imageIndex;
-		VkResult result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+		VkResult result;
+		{
+			GpuProfiler::CpuScope scope(profiler, "vkAcquireNextImageKHR");
+			FrameStats::ScopedPhase phase(frameStats, FrameStats::Acquire);
+			result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphores[frameSlot], VK_NULL_HANDLE, &imageIndex);
+		}
 
 		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
 			throw std::runtime_error("That's interesting!");
@@ -1389,24 +3315,23 @@ private:
 			throw std::runtime_error("failed to acquire swap chain image!");
 		}
 
-		//Execute the command buffer with that image as attachment in the framebuffer
-		VkSubmitInfo submitInfo = {};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[frameSlot] };
+		{
+			FrameStats::ScopedPhase phase(frameStats, FrameStats::Submit);
+			recordCommandBuffer(commandBuffers[frameSlot], imageIndex);
 
-		VkSemaphore waitSemaphores[] = { imageAvailableSemaphore };
-		VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-		submitInfo.waitSemaphoreCount = 1;
-		submitInfo.pWaitSemaphores = waitSemaphores;
-		submitInfo.pWaitDstStageMask = waitStages;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
-		VkSemaphore signalSemaphores[] = { renderFinishedSemaphore };
-		submitInfo.signalSemaphoreCount = 1;
-		submitInfo.pSignalSemaphores = signalSemaphores;
+			//Execute the command buffer with that image as attachment in the framebuffer, once the image is available
+			SubmitBatch batch;
+			batch.waitBinary(imageAvailableSemaphores[frameSlot], VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+			batch.addCommandBuffer(commandBuffers[frameSlot]);
+			batch.signalBinary(signalSemaphores[0]);
 
-		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
-			throw std::runtime_error("failed to submit draw command buffer!");
+			lastFrameValue = batch.submit(graphicsQueue, timeline);
+			profiler.markSubmit();
 		}
+		frameTimelineValues[frameSlot] = lastFrameValue;
+		timeline.trackLatency(lastFrameValue);
+		frameNumber++;
 
 		//Return the image to the swap chain for presentation
 		VkPresentInfoKHR presentInfo = {};
@@ -1421,7 +3346,11 @@ private:
 		presentInfo.pImageIndices = &imageIndex;
 		presentInfo.pResults = nullptr; // Optional
 
-		result = vkQueuePresentKHR(presentQueue, &presentInfo);
+		{
+			GpuProfiler::CpuScope scope(profiler, "vkQueuePresentKHR");
+			FrameStats::ScopedPhase phase(frameStats, FrameStats::Present);
+			result = vkQueuePresentKHR(presentQueue, &presentInfo);
+		}
 
 		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
 			throw std::runtime_error("That's interesting too!");
@@ -1431,32 +3360,268 @@ private:
 		}
 	}
 
+	//headless: the offscreen image of the frame slot is free once beginFrame waited for the slot, nothing to acquire nor present
+	void drawOffscreenFrame() {
+		FrameStats::ScopedPhase phase(frameStats, FrameStats::Submit);
+		recordCommandBuffer(commandBuffers[frameSlot], static_cast<uint32_t>(frameSlot));
+
+		SubmitBatch batch;
+		batch.addCommandBuffer(commandBuffers[frameSlot]);
+		lastFrameValue = batch.submit(graphicsQueue, timeline);
+		profiler.markSubmit();
+
+		frameTimelineValues[frameSlot] = lastFrameValue;
+		timeline.trackLatency(lastFrameValue);
+		frameNumber++;
+	}
+
+	//what the depth attachment costs : lazily allocated memory is only committed as far as the device actually needed it
+	VkDeviceSize depthCommittedBytes() {
+		if (!depthLazilyAllocated) return depthMemoryBytes;
+		VkDeviceSize committed = 0;
+		vkGetDeviceMemoryCommitment(device, depthImageMemory, &committed);
+		return committed;
+	}
+
+	void reportDepthMemory(std::ostream& out) {
+		out << "depth attachment : " << depthMemoryBytes / 1024 << " KB" << (depthTransient ? ", transient" : ", sampled by the culling pass")
+			<< (depthLazilyAllocated ? ", lazily allocated, " : ", ") << depthCommittedBytes() / 1024 << " KB committed" << std::endl;
+	}
+
+	void reportStartup(std::ostream& out) {
+		out << "startup (" << (options.parallelStartup ? "parallel" : "serial") << ") :" << std::endl;
+		for (auto& phase : startup.results()) {
+			out << "  " << phase.first << " : " << phase.second << " ms" << std::endl;
+		}
+		out << "  time to first frame : " << timeToFirstFrameMs << " ms" << std::endl;
+		out << "uploads :" << std::endl;
+		for (auto& upload : uploadStats) {
+			out << "  " << upload.first << " : " << upload.second.uploadedBytes / 1024 << " KB uploaded, "
+				<< upload.second.copiedBytes / 1024 << " KB copied by the CPU (" << upload.second.path << ")" << std::endl;
+		}
+		reportDepthMemory(out);
+		out << "frame graph : " << frameGraphBarriers << " barriers in " << frameGraphBatches << " batches" << std::endl << frameGraphDescription;
+	}
+
+	//of the frames measured since the last call, from the first frame on
+	FrameStats::Percentiles inputLatencyPercentiles(uint64_t firstFrame) {
+		std::vector<float> values;
+		for (const InputLatency::Sample& sample : inputLatency.take()) {
+			if (sample.frameNumber >= firstFrame) values.push_back(sample.ms);
+		}
+		inputLatencySamples = values.size();
+		return FrameStats::percentiles(std::move(values));
+	}
+
+	void writeBenchmarkResults() {
+		std::vector<FrameStats::FrameRecord> frames = frameStats.snapshot();
+		frames.erase(std::remove_if(frames.begin(), frames.end(),
+			[this](const FrameStats::FrameRecord& frame) { return frame.frameNumber < options.warmupFrames; }), frames.end());
+
+		double sum = 0.0;
+		float maxFrameMs = 0.0f;
+		for (const auto& frame : frames) {
+			sum += frame.frameMs;
+			maxFrameMs = std::max(maxFrameMs, frame.frameMs);
+		}
+		FrameStats::Percentiles percentiles = FrameStats::percentiles(frames, FrameStats::NumberOfPhases);
+		FrameStats::Percentiles input = inputLatencyPercentiles(options.warmupFrames);
+		size_t hitches = std::count_if(frames.begin(), frames.end(), [](const FrameStats::FrameRecord& frame) { return frame.hitch; });
+
+		VkPhysicalDeviceProperties deviceProperties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+		//one JSON object, stable keys: meant to be diffed and plotted across commits
+		std::ostringstream json;
+		json << "{" << std::endl;
+		json << "  \"scene\": \"" << AppOptions::sceneName(options.scene) << "\"," << std::endl;
+		json << "  \"instances\": " << (options.scene == Scene::Synthetic ? options.syntheticInstances : 1) << "," << std::endl;
+		json << "  \"vertices\": " << vertices.size() << "," << std::endl;
+		json << "  \"indices\": " << indices.size() << "," << std::endl;
+		json << "  \"index_bits\": " << (indexType == VK_INDEX_TYPE_UINT16 ? 16 : 32) << "," << std::endl;
+		json << "  \"objects\": " << objects.size() << "," << std::endl;
+		json << "  \"object_transforms\": \"" << AppOptions::objectTransformsName(options.objectTransforms) << "\"," << std::endl;
+		json << "  \"lod\": \"" << (options.lod >= 0 ? std::to_string(options.lod) : "auto") << "\"," << std::endl;
+		json << "  \"submeshes\": " << sceneSubmeshes.size() << "," << std::endl;
+		json << "  \"materials\": " << materialTextures.size() << "," << std::endl;
+		json << "  \"textures\": " << textureImages.size() << "," << std::endl;
+		json << "  \"lods\": [";
+		std::vector<MeshLod> levels = sceneLevels(sceneLods, sceneSubmeshes);
+		for (size_t i = 0; i < levels.size(); i++) {
+			json << (i == 0 ? "" : ",") << " { \"triangles\": " << levels[i].indexCount / 3 << ", \"error\": " << levels[i].error << " }";
+		}
+		json << " ]," << std::endl;
+		json << "  \"triangles_per_frame\": " << (drawnFrames == 0 ? 0 : drawnTriangles / drawnFrames) << "," << std::endl;
+		json << "  \"draw_sort_ms\": " << (drawnFrames == 0 ? 0.0 : drawSortMs / drawnFrames) << "," << std::endl;
+		double bindDivisor = bindFrames == 0 ? 1.0 : double(bindFrames);
+		json << "  \"binds_per_frame\": { \"pipelines\": " << bindTotals.pipelines / bindDivisor << ", \"descriptor_sets\": " << bindTotals.descriptorSets / bindDivisor
+			<< ", \"vertex_buffers\": " << bindTotals.vertexBuffers / bindDivisor << ", \"index_buffers\": " << bindTotals.indexBuffers / bindDivisor
+			<< ", \"materials\": " << bindTotals.materials / bindDivisor << ", \"skipped\": " << bindTotals.skipped / bindDivisor << " }," << std::endl;
+		json << "  \"depth_prepass\": " << (options.depthPrepass ? "true" : "false") << "," << std::endl;
+		json << "  \"culling\": { \"enabled\": " << (options.culling ? "true" : "false") << ", \"frames\": " << cullFrames;
+		const char* cullNames[] = { "visible", "frustum_culled", "occlusion_culled" };
+		for (int i = 0; i < 3; i++) {
+			json << ", \"" << cullNames[i] << "_per_frame\": " << (cullFrames == 0 ? 0.0 : double(cullTotals[i]) / cullFrames);
+		}
+		json << " }," << std::endl;
+		json << "  \"device\": \"" << deviceProperties.deviceName << "\"," << std::endl;
+		json << "  \"device_type\": \"" << deviceTypeName(deviceProperties.deviceType) << "\"," << std::endl;
+		json << "  \"headless\": " << (options.headless ? "true" : "false") << "," << std::endl;
+		json << "  \"latency_mode\": \"" << AppOptions::latencyModeName(options.latencyMode) << "\"," << std::endl;
+		json << "  \"present_mode\": \"" << (options.headless ? "none" : presentModeName(presentMode)) << "\"," << std::endl;
+		json << "  \"swapchain_images\": " << swapChainImages.size() << "," << std::endl;
+		json << "  \"fps_limit\": " << options.fpsLimit << "," << std::endl;
+		json << "  \"limiter_sleep_ms\": " << (frames.empty() ? 0.0 : limiterSleepMs / frames.size()) << "," << std::endl;
+		json << "  \"input_latency_ms\": { \"samples\": " << inputLatencySamples << ", \"p50\": " << input.p50
+			<< ", \"p95\": " << input.p95 << ", \"p99\": " << input.p99 << " }," << std::endl;
+		json << "  \"frames\": " << options.frames << "," << std::endl;
+		json << "  \"warmup_frames\": " << options.warmupFrames << "," << std::endl;
+		json << "  \"timestep_ms\": " << options.timestepMs << "," << std::endl;
+		json << "  \"startup_ms\": {";
+		for (auto& phase : startup.results()) {
+			json << " \"" << phase.first << "\": " << phase.second << ",";
+		}
+		json << " \"total\": " << startup.totalMs() << " }," << std::endl;
+		json << "  \"assets\": \"" << (assets ? "pack" : "loose") << "\"," << std::endl;
+		json << "  \"uploads\": {";
+		for (auto it = uploadStats.begin(); it != uploadStats.end(); ++it) {
+			json << (it == uploadStats.begin() ? "" : ",") << " \"" << it->first << "\": { \"uploaded_bytes\": " << it->second.uploadedBytes
+				<< ", \"copied_bytes\": " << it->second.copiedBytes << ", \"path\": \"" << it->second.path << "\" }";
+		}
+		json << " }," << std::endl;
+		json << "  \"parallel_startup\": " << (options.parallelStartup ? "true" : "false") << "," << std::endl;
+		json << "  \"time_to_first_frame_ms\": " << timeToFirstFrameMs << "," << std::endl;
+		json << "  \"frame_ms\": { \"samples\": " << frames.size()
+			<< ", \"mean\": " << (frames.empty() ? 0.0 : sum / frames.size())
+			<< ", \"p50\": " << percentiles.p50 << ", \"p95\": " << percentiles.p95 << ", \"p99\": " << percentiles.p99
+			<< ", \"max\": " << maxFrameMs << ", \"hitches\": " << hitches << " }," << std::endl;
+		json << "  \"texture_resident_bytes\": " << textureStreamer.residentBytes() << "," << std::endl;
+		const DescriptorAllocator::Stats& descriptorStats = descriptors.getStats();
+		json << "  \"descriptors\": { \"requests\": " << descriptorStats.requests << ", \"allocations\": " << descriptorStats.allocations
+			<< ", \"allocate_ms\": " << descriptorStats.allocateMs << ", \"pools_created\": " << descriptorStats.poolsCreated
+			<< ", \"pool_resets\": " << descriptorStats.poolResets << " }," << std::endl;
+		json << "  \"depth_attachment\": { \"bytes\": " << depthMemoryBytes << ", \"transient\": " << (depthTransient ? "true" : "false")
+			<< ", \"lazily_allocated\": " << (depthLazilyAllocated ? "true" : "false") << ", \"committed_bytes\": " << depthCommittedBytes() << " }," << std::endl;
+		json << "  \"render_graph\": { \"barriers\": " << frameGraphBarriers << ", \"batches\": " << frameGraphBatches << " }," << std::endl;
+		json << "  \"device_memory_allocated_bytes\": " << allocatedDeviceMemory << "," << std::endl;
+		json << "  \"peak_resident_bytes\": " << peakResidentMemory() << std::endl;
+		json << "}" << std::endl;
+
+		if (options.resultsPath.empty()) {
+			std::cout << json.str();
+		}
+		else {
+			std::ofstream file(options.resultsPath);
+			if (!file.is_open()) {
+				throw std::runtime_error("failed to open " + options.resultsPath + "!");
+			}
+			file << json.str();
+		}
+	}
+
 private:
-	GLFWwindow* window;
+	AppOptions options;
+	PhaseTimer startup;
+	std::chrono::high_resolution_clock::time_point startTime;
+	double timeToFirstFrameMs = 0.0; //construction of the application to the first frame submitted
+	std::shared_ptr<AssetPack> assets; //null when loading the loose files
+	std::map<std::string, UploadStats> uploadStats; //by asset
+	bool hostMemoryImport = false; //VK_EXT_external_memory_host is enabled
+	bool samplerAnisotropy = false; //the samplerAnisotropy feature is enabled
+	VkDeviceSize hostPointerAlignment = 0;
+	PFN_vkGetMemoryHostPointerPropertiesEXT getMemoryHostPointerProperties = nullptr;
+	bool bindless = false; //VK_EXT_descriptor_indexing is enabled and binding 1 is the texture array
+	uint32_t bindlessTextureCapacity = 1;
+	std::unique_ptr<AsyncFileReader> fileReader;
+	std::map<std::string, std::shared_future<std::vector<char>>> prefetchedFiles;
+	std::future<SceneData> sceneTask;
+	std::future<TextureData> textureTask;
+	VkDeviceSize allocatedDeviceMemory = 0; //total ever allocated, for the benchmark results
+
+	GLFWwindow* window = nullptr;
 	VDeleter<VkInstance> instance{ vkDestroyInstance };
 	VDeleter<VkDebugReportCallbackEXT> callback{ instance, DestroyDebugReportCallbackEXT };
 	VDeleter<VkSurfaceKHR> surface{ instance, vkDestroySurfaceKHR };
 	VDeleter<VkDevice> device{ vkDestroyDevice }; //device must be deleted before the instance
+	DeletionQueue deletionQueue; //declared right after the device so that it is flushed after every other object, but before the device
+	GpuTimeline timeline{ device };
+	GpuTimeline transferTimeline{ device }; //separate timeline: signals from two queues could reach one semaphore out of order
+	DeletionQueue transferDeletionQueue; //keyed by transferTimeline values
+	GpuProfiler profiler{ device };
+	DescriptorAllocator descriptors{ device };
+	FrameStats frameStats;
+	InputLatency inputLatency{ timeline }; //its thread waits on the timeline, so declared after it
+	FrameLimiter frameLimiter;
+	double limiterSleepMs = 0.0; //after the warmup frames
+	size_t inputLatencySamples = 0; //behind the last inputLatencyPercentiles
 	VDeleter<VkSwapchainKHR> swapChain{ device, vkDestroySwapchainKHR }; //swap chain must be deleted before the device
 	std::vector<VDeleter<VkImageView>> swapChainImageViews; //unlike the VkImage, the VkImageView s are created and deleted by us
 	VDeleter<VkRenderPass> renderPass{ device, vkDestroyRenderPass };
 	VDeleter<VkDescriptorSetLayout> descriptorSetLayout{ device, vkDestroyDescriptorSetLayout }; 
-	VDeleter<VkDescriptorPool> descriptorPool{ device, vkDestroyDescriptorPool }; 
+	VDeleter<VkDescriptorSetLayout> objectSetLayout{ device, vkDestroyDescriptorSetLayout };
 	VDeleter<VkPipelineLayout> pipelineLayout{ device, vkDestroyPipelineLayout };
 	VDeleter<VkPipeline> graphicsPipeline{ device, vkDestroyPipeline };
+	VDeleter<VkPipeline> depthPrepassPipeline{ device, vkDestroyPipeline }; //--depth-prepass only
 	std::vector<VDeleter<VkFramebuffer>> swapChainFramebuffers;
 	VDeleter<VkCommandPool> commandPool{ device, vkDestroyCommandPool };
+	VDeleter<VkCommandPool> transferCommandPool{ device, vkDestroyCommandPool };
 
 	VDeleter<VkImage> depthImage{ device, vkDestroyImage };
 	VDeleter<VkDeviceMemory> depthImageMemory{ device, vkFreeMemory };
 	VDeleter<VkImageView> depthImageView{ device, vkDestroyImageView };
-
-	VDeleter<VkImage> stagingImage{ device, vkDestroyImage };
-	VDeleter<VkDeviceMemory> stagingImageMemory{ device, vkFreeMemory };
-	VDeleter<VkImage> textureImage{ device, vkDestroyImage }; //unlike swap chain images, creation and deletion are handled by us
-	VDeleter<VkDeviceMemory> textureImageMemory{ device, vkFreeMemory };
-	VDeleter<VkImageView> textureImageView{ device, vkDestroyImageView }; 
+	bool depthTransient = false;
+	bool depthLazilyAllocated = false;
+	VkDeviceSize depthMemoryBytes = 0;
+
+	//occlusion culling : depth pyramid of the previous frame, and the compute passes that build and read it
+	VDeleter<VkImage> depthPyramid{ device, vkDestroyImage };
+	VDeleter<VkDeviceMemory> depthPyramidMemory{ device, vkFreeMemory };
+	VDeleter<VkImageView> depthPyramidView{ device, vkDestroyImageView }; //every level, for the culling pass
+	std::vector<VDeleter<VkImageView>> depthPyramidLevelViews; //one level each, for the downsample
+	VDeleter<VkSampler> depthPyramidSampler{ device, vkDestroySampler };
+	uint32_t depthPyramidLevels = 0;
+	bool depthPyramidReady = false; //a recorded frame builds it, so later frames can cull against it
+	uint32_t depthPyramidScope = UINT32_MAX;
+	VDeleter<VkDescriptorSetLayout> hiZSetLayout{ device, vkDestroyDescriptorSetLayout };
+	VDeleter<VkPipelineLayout> hiZPipelineLayout{ device, vkDestroyPipelineLayout };
+	VDeleter<VkPipeline> hiZPipeline{ device, vkDestroyPipeline };
+	VDeleter<VkDescriptorSetLayout> cullSetLayout{ device, vkDestroyDescriptorSetLayout };
+	VDeleter<VkPipelineLayout> cullPipelineLayout{ device, vkDestroyPipelineLayout };
+	VDeleter<VkPipeline> cullPipeline{ device, vkDestroyPipeline };
+	std::vector<VDeleter<VkBuffer>> cullObjectBuffers; //one per frame in flight, host visible
+	std::vector<VDeleter<VkDeviceMemory>> cullObjectBufferMemories;
+	std::vector<VDeleter<VkBuffer>> indirectDrawBuffers; //one per frame in flight, written by the culling pass
+	std::vector<VDeleter<VkDeviceMemory>> indirectDrawBufferMemories;
+	std::vector<VDeleter<VkBuffer>> cullStatsBuffers; //one per frame in flight, host visible
+	std::vector<VDeleter<VkDeviceMemory>> cullStatsBufferMemories;
+	std::vector<int64_t> cullStatsFrames; //frame whose counters each slot holds, -1 once read
+	CullPushConstants cullConstants = {};
+	CullStats lastCullStats = {};
+	uint64_t cullTotals[3] = {}; //visible, frustum culled, occlusion culled, after the warmup frames
+	uint64_t cullFrames = 0;
+
+	std::vector<std::unique_ptr<StreamedImage>> textureImages; //by texture of the streamer
 	VDeleter<VkSampler> textureSampler{ device, vkDestroySampler };
+	TextureStreamer textureStreamer;
+	uint32_t sceneTextureId = 0; //the texture of the scene, also used by the materials without their own
+	std::vector<uint32_t> materialTextures; //texture of the streamer, by material of the scene
+	std::vector<float> textureScreenPixels; //this frame's, by texture
+	std::vector<SceneObject> objects;
+	std::vector<glm::mat4> objectLocalModels; //this frame's, by object, relative to the scene
+	std::vector<glm::mat4> objectMvps;
+	std::vector<MeshLod> sceneLods;
+	std::vector<Submesh> sceneSubmeshes;
+	std::vector<uint32_t> objectLods; //this frame's level of detail, by object
+	uint64_t frameTriangles = 0;
+	uint64_t drawnTriangles = 0; //after the warmup frames, for the benchmark results
+	uint64_t drawnFrames = 0;
+	std::vector<DrawSort::Draw> drawOrder; //this frame's objects, sorted by draw key
+	std::vector<DrawSort::Draw> drawSortScratch;
+	double drawSortMs = 0.0; //after the warmup frames
+	BindCache bindCache;
+	BindCache::Stats lastBinds;
+	BindCache::Stats bindTotals; //after the warmup frames
+	uint64_t bindFrames = 0;
 	
 	std::vector<Vertex> vertices;
 	std::vector<uint32_t> indices;
@@ -1464,30 +3629,58 @@ private:
 	VDeleter<VkDeviceMemory> vertexBufferMemory{ device, vkFreeMemory };
 	VDeleter<VkBuffer> indexBuffer{ device, vkDestroyBuffer };
 	VDeleter<VkDeviceMemory> indexBufferMemory{ device, vkFreeMemory };
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32; //16 bits when the scene has few enough vertices
 
-	VDeleter<VkBuffer> uniformStagingBuffer{ device, vkDestroyBuffer };
-	VDeleter<VkDeviceMemory> uniformStagingBufferMemory{ device, vkFreeMemory };
+	std::vector<VDeleter<VkBuffer>> uniformStagingBuffers;
+	std::vector<VDeleter<VkDeviceMemory>> uniformStagingBufferMemories;
+	std::vector<VDeleter<VkBuffer>> objectUniformBuffers; //one per frame in flight, host visible
+	std::vector<VDeleter<VkDeviceMemory>> objectUniformBufferMemories;
+	VkDeviceSize objectUniformStride = 0;
 	VDeleter<VkBuffer> uniformBuffer{ device, vkDestroyBuffer };
 	VDeleter<VkDeviceMemory> uniformBufferMemory{ device, vkFreeMemory };
 
 	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE; //This object will be implicitly destroyed when the VkInstance is destroyed
 	VkQueue graphicsQueue; //Device queues are implicitly cleaned up when the device is destroyed
 	VkQueue presentQueue;
+	VkQueue transferQueue;
+	uint32_t graphicsFamily;
+	uint32_t transferFamily;
+	std::deque<PendingUpload> pendingUploads; //copies done on the transfer queue, not yet acquired by the graphics queue
+	uint64_t acquiredTransferValue = 0; //uploads up to this transferTimeline value are usable by the next frames
+	std::vector<VDeleter<VkImage>> offscreenImages; //headless only, stand in for the swap chain images
+	std::vector<VDeleter<VkDeviceMemory>> offscreenImageMemories;
 	std::vector<VkImage> swapChainImages; //to store the handles to the	images in the swap chain (creation and deletion are handled by the swap chain)
 	VkFormat swapChainImageFormat;
 	VkExtent2D swapChainExtent;
-	VkDescriptorSet descriptorSet;
-	std::vector<VkCommandBuffer> commandBuffers; //command buffers are automatically deleted when the command pool is deleted
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR; //chosen from options.latencyMode
+	std::vector<VkCommandBuffer> commandBuffers; //one per frame in flight. Command buffers are automatically deleted when the command pool is deleted
+	std::string frameGraphDescription; //the render graph of the first frame, for the startup report
+	size_t frameGraphBarriers = 0;
+	size_t frameGraphBatches = 0;
 
 	std::vector<const char*> requiredExtensions;
 
-	VDeleter<VkSemaphore> imageAvailableSemaphore{ device, vkDestroySemaphore };
-	VDeleter<VkSemaphore> renderFinishedSemaphore{ device, vkDestroySemaphore };
+	std::vector<VDeleter<VkSemaphore>> imageAvailableSemaphores;
+	std::vector<VDeleter<VkSemaphore>> renderFinishedSemaphores;
+	std::vector<uint64_t> frameTimelineValues; //timeline value signaled by the last submission of each frame slot
+	uint64_t frameNumber = 0;
+	size_t frameSlot = 0;
+	uint64_t lastFrameValue = 0; //timeline value of the last draw submission
+	std::chrono::high_resolution_clock::time_point lastLatencyReport;
 
 };
 
-int main() {
-	HelloTriangleApplication app;
+int main(int argc, char** argv) {
+	AppOptions options;
+	try {
+		options = AppOptions::parse(argc, argv);
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl << AppOptions::usage() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	HelloTriangleApplication app(options);
 
 	try {
 		app.run();